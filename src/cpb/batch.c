@@ -0,0 +1,145 @@
+/** @file batch.c
+ *
+ * Implementation of the batch encoder.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cpb/cpb.h>
+#include <cpb/core/encoder2.h>
+#include <cpb/utils/batch.h>
+
+#include "private.h"
+
+
+/* Batch encoder */
+
+/**
+ * Initializes a batch encoder.
+ * @param batch Batch encoder
+ * @param data Data buffer to encode into
+ * @param len Length of data buffer
+ * @param offsets Returns the offsets of the records, may be NULL
+ * @param max_records Number of record offsets
+ */
+void cpb_batch_init(struct cpb_batch *batch, void *data, size_t len,
+                    size_t *offsets, size_t max_records)
+{
+    cpb_encoder_init(&batch->encoder);
+    batch->data = data;
+    batch->len = len;
+    batch->used = 0;
+    batch->offsets = offsets;
+    batch->max_records = max_records;
+    batch->num_records = 0;
+    batch->width = 0;
+    batch->open = 0;
+}
+
+/**
+ * Starts encoding a record. The length prefix is reserved for the size hint
+ * and the message is encoded right behind it with the batch's encoder, which
+ * is used as usual between cpb_batch_start() and cpb_batch_finish().
+ * @param batch Batch encoder
+ * @param msg_desc Message descriptor of the record
+ * @param size_hint Expected encoded size of the message
+ * @return Returns CPB_ERR_OK if successful, CPB_ERR_MEM if all record offsets
+ * are used or CPB_ERR_END_OF_BUF if the length prefix does not fit.
+ */
+cpb_err_t cpb_batch_start(struct cpb_batch *batch,
+                            const struct cpb_msg_desc *msg_desc,
+                            size_t size_hint)
+{
+    CPB_ASSERT(!batch->open, "Record already started");
+
+    if (batch->offsets && batch->num_records == batch->max_records)
+        return CPB_ERR_MEM;
+
+    batch->width = cpb_varint_size(size_hint);
+    if (batch->len - batch->used < batch->width)
+        return CPB_ERR_END_OF_BUF;
+
+    cpb_encoder_start(&batch->encoder, msg_desc,
+                      batch->data + batch->used + batch->width,
+                      batch->len - batch->used - batch->width);
+    batch->open = 1;
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Finishes encoding a record and writes its length prefix. A message smaller
+ * than the size hint keeps the reserved width with a padded prefix, a larger
+ * one is moved behind a wider prefix.
+ * @param batch Batch encoder
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_END_OF_BUF if a wider
+ * length prefix does not fit, the record is dropped then.
+ */
+cpb_err_t cpb_batch_finish(struct cpb_batch *batch)
+{
+    u8_t *record = batch->data + batch->used;
+    size_t size;
+    size_t width;
+
+    CPB_ASSERT(batch->open, "No record started");
+    CPB_ASSERT(batch->encoder.depth == 1, "Nested message not ended");
+
+    batch->open = 0;
+    size = cpb_encoder_finish(&batch->encoder);
+
+    width = cpb_varint_size(size);
+    if (width > batch->width) {
+        if (batch->len - batch->used < width + size)
+            return CPB_ERR_END_OF_BUF;
+        memmove(record + width, record + batch->width, size);
+        batch->width = width;
+    }
+
+    cpb_encode_varint_width(record, size, batch->width);
+
+    if (batch->offsets)
+        batch->offsets[batch->num_records] = batch->used;
+    batch->num_records++;
+    batch->used += batch->width + size;
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Drops the record being encoded, for instance when it does not fit.
+ * @param batch Batch encoder
+ */
+void cpb_batch_abort(struct cpb_batch *batch)
+{
+    batch->open = 0;
+}
+
+/**
+ * Returns the size of the finished records.
+ * @param batch Batch encoder
+ * @return Returns the number of bytes used in the data buffer.
+ */
+size_t cpb_batch_used(struct cpb_batch *batch)
+{
+    return batch->used;
+}
+
+/**
+ * Returns the number of finished records.
+ * @param batch Batch encoder
+ * @return Returns the number of records.
+ */
+size_t cpb_batch_num_records(struct cpb_batch *batch)
+{
+    return batch->num_records;
+}
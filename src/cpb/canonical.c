@@ -0,0 +1,808 @@
+/** @file canonical.c
+ *
+ * Implementation of canonical message encoding.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cpb/cpb.h>
+#include <cpb/core/encoder2.h>
+#include <cpb/utils/canonical.h>
+
+#include "private.h"
+
+
+/** Builds a 64 bit constant from two 32 bit halves */
+#define U64(hi, lo) (((u64_t) (hi) << 32) | (u64_t) (lo))
+
+/** Rotates a 64 bit value left */
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/** Hash state, fed with the bytes as they are written */
+struct hasher {
+    u64_t h;                    /**< Hash of the complete words */
+    u64_t word;                 /**< Pending bytes, little endian */
+    u64_t len;                  /**< Number of bytes hashed */
+    int n;                      /**< Number of pending bytes */
+};
+
+/** Canonical encoding output */
+struct writer {
+    u8_t *data;                 /**< Data buffer */
+    size_t pos;                 /**< Number of bytes written */
+    struct hasher *hasher;      /**< Hash state or NULL */
+};
+
+/**
+ * Occurrence of a known field. The occurrences of the fields of a message are
+ * indexed in one run of entries, sorted by field number. A nested message is
+ * indexed in a run of its own, all occurrences of a singular message merged.
+ */
+struct entry {
+    const struct cpb_field_desc *field_desc; /**< Field, NULL if left out */
+    const u8_t *pos;            /**< Encoded value, without length prefix */
+    const u8_t *end;            /**< End of encoded value */
+    int wire_type;              /**< Wire type of the occurrence */
+    size_t first;               /**< Message: index of its first entry */
+    size_t count;               /**< Message: number of its entries */
+    size_t size;                /**< Message: canonical size, first packed
+                                     occurrence: size of all elements */
+};
+
+/** Index of a message and its nested messages */
+struct index {
+    struct entry *entries;
+    size_t num;                 /**< Number of entries */
+    size_t cap;                 /**< Number of allocated entries */
+};
+
+static cpb_err_t index_message(struct index *index,
+                               const struct cpb_msg_desc *msg_desc,
+                               size_t occ, size_t num_occ, int depth,
+                               size_t *first, size_t *count, size_t *size);
+
+
+/* Hashing */
+
+static void hash_init(struct hasher *hasher)
+{
+    hasher->h = U64(0x9e3779b9, 0x7f4a7c15);
+    hasher->word = 0;
+    hasher->len = 0;
+    hasher->n = 0;
+}
+
+static u64_t hash_mix(u64_t h, u64_t k)
+{
+    k *= U64(0x87c37b91, 0x114253d5);
+    k = ROTL64(k, 31);
+    k *= U64(0x4cf5ad43, 0x2745937f);
+    return h ^ k;
+}
+
+static void hash_update(struct hasher *hasher, const u8_t *data, size_t len)
+{
+    size_t i;
+
+    hasher->len += len;
+    for (i = 0; i < len; i++) {
+        hasher->word |= (u64_t) data[i] << (8 * hasher->n);
+        if (++hasher->n == 8) {
+            hasher->h = hash_mix(hasher->h, hasher->word);
+            hasher->h = ROTL64(hasher->h, 27) * 5 + 0x52dce729;
+            hasher->word = 0;
+            hasher->n = 0;
+        }
+    }
+}
+
+static u64_t hash_final(struct hasher *hasher)
+{
+    u64_t h = hasher->h;
+
+    if (hasher->n)
+        h = hash_mix(h, hasher->word);
+
+    h ^= hasher->len;
+    h ^= h >> 33;
+    h *= U64(0xff51afd7, 0xed558ccd);
+    h ^= h >> 33;
+    h *= U64(0xc4ceb9fe, 0x1a85ec53);
+    h ^= h >> 33;
+
+    return h;
+}
+
+
+/* Output */
+
+static void write_bytes(struct writer *w, const u8_t *data, size_t len)
+{
+    if (w->data && len)
+        memcpy(w->data + w->pos, data, len);
+    if (w->hasher)
+        hash_update(w->hasher, data, len);
+    w->pos += len;
+}
+
+static void write_varint(struct writer *w, u64_t value)
+{
+    u8_t tmp[10];
+
+    write_bytes(w, tmp, cpb_encode_varint(tmp, value));
+}
+
+/**
+ * Writes a scalar value without key.
+ * @param w Output
+ * @param wire_type Wire type of the value
+ * @param value Normalized value
+ */
+static void write_scalar(struct writer *w, int wire_type, u64_t value)
+{
+    u8_t tmp[10];
+
+    switch (wire_type) {
+    case WT_64BIT:
+        write_bytes(w, tmp, cpb_encode_64bit(tmp, value));
+        break;
+    case WT_32BIT:
+        write_bytes(w, tmp, cpb_encode_32bit(tmp, (u32_t) value));
+        break;
+    default:
+        write_varint(w, value);
+        break;
+    }
+}
+
+
+/* Indexing */
+
+/**
+ * Normalizes a scalar value, so that equal field values compare equal however
+ * they were encoded. Varints are truncated to the width of the field type,
+ * negative 32 bit integers are sign extended and booleans are 0 or 1.
+ * @param field_desc Field descriptor
+ * @param value Wire value
+ * @return Returns the normalized value.
+ */
+static u64_t normalize(const struct cpb_field_desc *field_desc, u64_t value)
+{
+    switch (field_desc->opts.typ) {
+    case CPB_INT32:
+    case CPB_ENUM:
+        return (u64_t) (s64_t) (s32_t) (u32_t) value;
+    case CPB_UINT32:
+    case CPB_SINT32:
+        return (u32_t) value;
+    case CPB_BOOL:
+        return value != 0;
+    default:
+        return value;
+    }
+}
+
+/**
+ * Reads a normalized scalar value.
+ * @param buf Memory buffer
+ * @param field_desc Field descriptor
+ * @param value Returns the normalized value
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_END_OF_BUF if the value
+ * is truncated.
+ */
+static cpb_err_t read_scalar(struct cpb_buf *buf,
+                             const struct cpb_field_desc *field_desc,
+                             u64_t *value)
+{
+    u32_t int32;
+    cpb_err_t ret;
+
+    switch (CPB_WIRE_TYPE(field_desc->opts.typ)) {
+    case WT_64BIT:
+        return cpb_decode_64bit(buf, value);
+    case WT_32BIT:
+        ret = cpb_decode_32bit(buf, &int32);
+        *value = int32;
+        return ret;
+    default:
+        ret = cpb_decode_varint(buf, value);
+        *value = normalize(field_desc, *value);
+        return ret;
+    }
+}
+
+/**
+ * Returns the size of a scalar value without key.
+ * @param wire_type Wire type of the value
+ * @param value Normalized value
+ * @return Returns the encoded size.
+ */
+static size_t scalar_size(int wire_type, u64_t value)
+{
+    switch (wire_type) {
+    case WT_64BIT:
+        return 8;
+    case WT_32BIT:
+        return 4;
+    default:
+        return cpb_varint_size(value);
+    }
+}
+
+/**
+ * Checks whether the value of a singular field is its default value. Bytes
+ * defaults whose length is not set in the field descriptor, as generated,
+ * never match.
+ * @param field_desc Field descriptor
+ * @param value Encoded value, without length prefix
+ * @return Returns 1 if the value is the default value, 0 otherwise.
+ */
+static cpb_bool_t is_default(const struct cpb_field_desc *field_desc,
+                             const struct cpb_buf *value)
+{
+    struct cpb_buf buf = *value;
+    size_t len = value->end - value->pos;
+    u64_t scalar;
+#if CPB_FIELD_DEFAULTS
+    const union cpb_value *def = &field_desc->def;
+    union wire_value wire_value;
+    size_t def_len;
+
+    switch (field_desc->opts.typ) {
+    case CPB_STRING:
+        def_len = def->string.str ? strlen(def->string.str) : 0;
+        return len == def_len &&
+               (!len || memcmp(value->pos, def->string.str, len) == 0);
+    case CPB_BYTES:
+        def_len = 0;
+        if (field_desc->opts.flags & CPB_HAS_DEFAULT) {
+            def_len = def->bytes.len;
+            if (!def_len)
+                return 0;
+        }
+        return len == def_len &&
+               (!len || memcmp(value->pos, def->bytes.data, len) == 0);
+    }
+
+    if (read_scalar(&buf, field_desc, &scalar) != CPB_ERR_OK)
+        return 0;
+
+    switch (cpb_value_to_wire(field_desc, def, &wire_value)) {
+    case WT_64BIT:
+        return scalar == wire_value.int64;
+    case WT_32BIT:
+        return scalar == wire_value.int32;
+    default:
+        return scalar == normalize(field_desc, wire_value.varint);
+    }
+#else
+    if (field_desc->opts.typ == CPB_STRING || field_desc->opts.typ == CPB_BYTES)
+        return len == 0;
+
+    return read_scalar(&buf, field_desc, &scalar) == CPB_ERR_OK && scalar == 0;
+#endif
+}
+
+/**
+ * Makes room for more entries in the index.
+ * @param index Index
+ * @param n Number of entries to make room for
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_MEM if the entries
+ * could not be allocated.
+ */
+static cpb_err_t reserve(struct index *index, size_t n)
+{
+    const struct cpb_allocator *allocator = &cpb_default_allocator;
+    struct entry *entries;
+    size_t cap;
+
+    if (index->num + n <= index->cap)
+        return CPB_ERR_OK;
+
+    cap = index->cap ? index->cap : 32;
+    while (cap < index->num + n)
+        cap *= 2;
+
+    entries = allocator->alloc(allocator->ctx, cap * sizeof(*entries));
+    if (!entries)
+        return CPB_ERR_MEM;
+    if (index->entries) {
+        memcpy(entries, index->entries, index->num * sizeof(*entries));
+        allocator->free(allocator->ctx, index->entries);
+    }
+    index->entries = entries;
+    index->cap = cap;
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Finds the descriptor of a field, trying the field after the previous one
+ * first, since fields are usually encoded in order of declaration.
+ * @param msg_desc Message descriptor
+ * @param number Field number
+ * @param hint Index of the previous field, updated
+ * @return Returns the field descriptor or NULL if the field is unknown.
+ */
+static const struct cpb_field_desc *find_field(const struct cpb_msg_desc *msg_desc,
+                                               u32_t number, u32_t *hint)
+{
+    u32_t i;
+
+    if (*hint < msg_desc->num_fields && msg_desc->fields[*hint].number == number)
+        return &msg_desc->fields[*hint];
+    if (*hint + 1 < msg_desc->num_fields &&
+        msg_desc->fields[*hint + 1].number == number)
+        return &msg_desc->fields[++*hint];
+
+    for (i = 0; i < msg_desc->num_fields; i++)
+        if (msg_desc->fields[i].number == number) {
+            *hint = i;
+            return &msg_desc->fields[i];
+        }
+
+    return NULL;
+}
+
+/**
+ * Adds the occurrences of the known fields of an encoded message to the
+ * index. Unknown fields and fields of the wrong wire type are left out.
+ * @param index Index
+ * @param msg_desc Message descriptor
+ * @param data Encoded message
+ * @param end End of encoded message
+ * @return Returns CPB_ERR_OK if successful, CPB_ERR_END_OF_BUF if the message
+ * is truncated, CPB_ERR_INVALID_WIRE_TYPE if it contains invalid data or
+ * CPB_ERR_MEM if the index could not grow.
+ */
+static cpb_err_t scan_message(struct index *index,
+                              const struct cpb_msg_desc *msg_desc,
+                              const u8_t *data, const u8_t *end)
+{
+    const struct cpb_field_desc *field_desc;
+    struct cpb_buf buf;
+    struct entry *entry;
+    cpb_err_t ret;
+    u32_t hint = 0;
+    u64_t key;
+    u64_t n;
+    int wire_type;
+    int field_wire_type;
+
+    buf.base = buf.pos = (u8_t *) data;
+    buf.end = (u8_t *) end;
+
+    while (buf.pos < buf.end) {
+        ret = cpb_decode_varint(&buf, &key);
+        if (ret != CPB_ERR_OK)
+            return ret;
+        wire_type = key & 0x07;
+
+        if (wire_type == WT_STRING) {
+            ret = cpb_decode_varint(&buf, &n);
+            if (ret != CPB_ERR_OK)
+                return ret;
+            if (n > cpb_buf_left(&buf))
+                return CPB_ERR_END_OF_BUF;
+            data = buf.pos;
+            buf.pos += n;
+        } else {
+            data = buf.pos;
+            ret = cpb_skip_field(&buf, wire_type, key >> 3);
+            if (ret != CPB_ERR_OK)
+                return ret;
+        }
+
+        field_desc = find_field(msg_desc, key >> 3, &hint);
+        if (!field_desc)
+            continue;
+        field_wire_type = CPB_WIRE_TYPE(field_desc->opts.typ);
+        if (wire_type != field_wire_type &&
+            !(wire_type == WT_STRING && field_desc->opts.label == CPB_REPEATED))
+            continue;
+
+        ret = reserve(index, 1);
+        if (ret != CPB_ERR_OK)
+            return ret;
+        entry = &index->entries[index->num++];
+        entry->field_desc = field_desc;
+        entry->pos = data;
+        entry->end = buf.pos;
+        entry->wire_type = wire_type;
+    }
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Sorts a run of entries by field number, keeping the order of the
+ * occurrences of each field. Runs are usually sorted already.
+ * @param index Index
+ * @param first Index of the first entry
+ * @param n Number of entries
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_MEM if there is no room
+ * for sorting.
+ */
+static cpb_err_t sort_entries(struct index *index, size_t first, size_t n)
+{
+    struct entry *entries, *tmp;
+    size_t width, i, left, right, mid, end, k;
+    cpb_err_t ret;
+
+    for (i = 1; i < n; i++)
+        if (index->entries[first + i].field_desc->number <
+            index->entries[first + i - 1].field_desc->number)
+            break;
+    if (i >= n)
+        return CPB_ERR_OK;
+
+    /* Bottom-up merge sort, through the room after the last entry */
+    ret = reserve(index, n);
+    if (ret != CPB_ERR_OK)
+        return ret;
+    entries = index->entries + first;
+    tmp = index->entries + index->num;
+
+    for (width = 1; width < n; width *= 2) {
+        for (i = 0; i < n; i += 2 * width) {
+            left = i;
+            mid = i + width < n ? i + width : n;
+            right = mid;
+            end = i + 2 * width < n ? i + 2 * width : n;
+            for (k = i; k < end; k++)
+                if (left < mid &&
+                    (right == end || entries[left].field_desc->number <=
+                                     entries[right].field_desc->number))
+                    tmp[k] = entries[left++];
+                else
+                    tmp[k] = entries[right++];
+        }
+        memcpy(entries, tmp, n * sizeof(*entries));
+    }
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Computes the canonical size of the occurrences of a field, indexing nested
+ * messages on the way. Occurrences that are not written are left out.
+ * @param index Index
+ * @param g Index of the first occurrence
+ * @param n Number of occurrences
+ * @param depth Nesting depth of the message holding the field
+ * @param size Returns the canonical size of the field
+ * @return Returns CPB_ERR_OK if successful or an error code otherwise.
+ */
+static cpb_err_t size_field(struct index *index, size_t g, size_t n, int depth,
+                            size_t *size)
+{
+    const struct cpb_field_desc *field_desc = index->entries[g].field_desc;
+    int wire_type = CPB_WIRE_TYPE(field_desc->opts.typ);
+    size_t key_size = cpb_varint_size((u64_t) field_desc->number << 3);
+    size_t first, count, msg_size;
+    size_t payload = 0;
+    size_t elements = 0;
+    struct cpb_buf buf;
+    struct entry *entry;
+    cpb_err_t ret;
+    u64_t scalar;
+    size_t i;
+
+    *size = 0;
+
+    if (field_desc->opts.typ == CPB_MESSAGE) {
+        /* Occurrences of a singular message are merged into the last one */
+        for (i = 0; i < n; i++) {
+            if (field_desc->opts.label != CPB_REPEATED && i < n - 1) {
+                index->entries[g + i].field_desc = NULL;
+                continue;
+            }
+            if (field_desc->opts.label == CPB_REPEATED)
+                ret = index_message(index, field_desc->msg_desc, g + i, 1,
+                                    depth + 1, &first, &count, &msg_size);
+            else
+                ret = index_message(index, field_desc->msg_desc, g, n,
+                                    depth + 1, &first, &count, &msg_size);
+            if (ret != CPB_ERR_OK)
+                return ret;
+            entry = &index->entries[g + i];
+            entry->first = first;
+            entry->count = count;
+            entry->size = msg_size;
+            *size += key_size + cpb_varint_size(msg_size) + msg_size;
+        }
+        return CPB_ERR_OK;
+    }
+
+    if (field_desc->opts.label != CPB_REPEATED) {
+        /* Singular fields keep their last value */
+        for (i = 0; i < n - 1; i++)
+            index->entries[g + i].field_desc = NULL;
+        entry = &index->entries[g + n - 1];
+        buf.base = buf.pos = (u8_t *) entry->pos;
+        buf.end = (u8_t *) entry->end;
+        if (field_desc->opts.label == CPB_OPTIONAL && is_default(field_desc, &buf)) {
+            entry->field_desc = NULL;
+            return CPB_ERR_OK;
+        }
+        if (wire_type == WT_STRING) {
+            *size = key_size + cpb_varint_size(buf.end - buf.pos) +
+                    (buf.end - buf.pos);
+            return CPB_ERR_OK;
+        }
+        ret = read_scalar(&buf, field_desc, &scalar);
+        if (ret != CPB_ERR_OK)
+            return ret;
+        *size = key_size + scalar_size(wire_type, scalar);
+        return CPB_ERR_OK;
+    }
+
+    if (wire_type == WT_STRING) {
+        for (i = 0; i < n; i++) {
+            entry = &index->entries[g + i];
+            *size += key_size + cpb_varint_size(entry->end - entry->pos) +
+                     (entry->end - entry->pos);
+        }
+        return CPB_ERR_OK;
+    }
+
+    /* Repeated scalars, each occurrence packed or not */
+    for (i = 0; i < n; i++) {
+        entry = &index->entries[g + i];
+        buf.base = buf.pos = (u8_t *) entry->pos;
+        buf.end = (u8_t *) entry->end;
+        while (buf.pos < buf.end) {
+            ret = read_scalar(&buf, field_desc, &scalar);
+            if (ret != CPB_ERR_OK)
+                return ret;
+            payload += scalar_size(wire_type, scalar);
+            elements++;
+        }
+    }
+
+    if (!CPB_IS_PACKED_REPEATED(field_desc))
+        *size = payload + elements * key_size;
+    else if (payload)
+        *size = key_size + cpb_varint_size(payload) + payload;
+    index->entries[g].size = payload;
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Indexes a message, scanning each of its occurrences once, and computes its
+ * canonical size. The message entries are added after all existing entries.
+ * @param index Index
+ * @param msg_desc Message descriptor
+ * @param occ Index of the entry of the first occurrence
+ * @param num_occ Number of occurrences, at consecutive entries
+ * @param depth Nesting depth of the message
+ * @param first Returns the index of the first message entry
+ * @param count Returns the number of message entries
+ * @param size Returns the canonical size of the message
+ * @return Returns CPB_ERR_OK if successful, CPB_ERR_END_OF_BUF if the message
+ * is truncated, CPB_ERR_INVALID_WIRE_TYPE if it contains invalid data,
+ * CPB_ERR_DEPTH if it is nested too deeply or CPB_ERR_MEM if the index could
+ * not grow.
+ */
+static cpb_err_t index_message(struct index *index,
+                               const struct cpb_msg_desc *msg_desc,
+                               size_t occ, size_t num_occ, int depth,
+                               size_t *first, size_t *count, size_t *size)
+{
+    const struct entry *entry;
+    size_t field_size;
+    cpb_err_t ret;
+    size_t i, next;
+
+    if (depth == CPB_MAX_DEPTH)
+        return CPB_ERR_DEPTH;
+
+    *first = index->num;
+    for (i = 0; i < num_occ; i++) {
+        entry = &index->entries[occ + i];
+        ret = scan_message(index, msg_desc, entry->pos, entry->end);
+        if (ret != CPB_ERR_OK)
+            return ret;
+    }
+    *count = index->num - *first;
+
+    ret = sort_entries(index, *first, *count);
+    if (ret != CPB_ERR_OK)
+        return ret;
+
+    *size = 0;
+    for (i = 0; i < *count; i = next) {
+        for (next = i + 1; next < *count; next++)
+            if (index->entries[*first + next].field_desc->number !=
+                index->entries[*first + i].field_desc->number)
+                break;
+        ret = size_field(index, *first + i, next - i, depth, &field_size);
+        if (ret != CPB_ERR_OK)
+            return ret;
+        *size += field_size;
+    }
+
+    return CPB_ERR_OK;
+}
+
+
+/* Canonical encoding */
+
+/**
+ * Writes the repeated scalar elements of an occurrence.
+ * @param w Output
+ * @param entry Occurrence, packed or not
+ * @param key Key to write before each element or 0 to write them packed
+ */
+static void write_elements(struct writer *w, const struct entry *entry, u64_t key)
+{
+    const struct cpb_field_desc *field_desc = entry->field_desc;
+    struct cpb_buf buf;
+    u64_t scalar;
+
+    buf.base = buf.pos = (u8_t *) entry->pos;
+    buf.end = (u8_t *) entry->end;
+    while (buf.pos < buf.end) {
+        read_scalar(&buf, field_desc, &scalar);
+        if (key)
+            write_varint(w, key);
+        write_scalar(w, CPB_WIRE_TYPE(field_desc->opts.typ), scalar);
+    }
+}
+
+/**
+ * Writes the canonical encoding of an indexed message. The values have been
+ * checked when indexing.
+ * @param w Output
+ * @param index Index
+ * @param first Index of the first message entry
+ * @param count Number of message entries
+ */
+static void write_message(struct writer *w, const struct index *index,
+                          size_t first, size_t count)
+{
+    const struct cpb_field_desc *field_desc;
+    const struct entry *entry;
+    struct cpb_buf buf;
+    u64_t scalar;
+    u64_t number;
+    int wire_type;
+    size_t i;
+
+    for (i = first; i < first + count; i++) {
+        entry = &index->entries[i];
+        field_desc = entry->field_desc;
+        if (!field_desc)
+            continue;
+        number = field_desc->number;
+        wire_type = CPB_WIRE_TYPE(field_desc->opts.typ);
+
+        if (field_desc->opts.typ == CPB_MESSAGE) {
+            write_varint(w, (number << 3) | WT_STRING);
+            write_varint(w, entry->size);
+            write_message(w, index, entry->first, entry->count);
+        } else if (wire_type == WT_STRING) {
+            write_varint(w, (number << 3) | WT_STRING);
+            write_varint(w, entry->end - entry->pos);
+            write_bytes(w, entry->pos, entry->end - entry->pos);
+        } else if (field_desc->opts.label != CPB_REPEATED) {
+            buf.base = buf.pos = (u8_t *) entry->pos;
+            buf.end = (u8_t *) entry->end;
+            read_scalar(&buf, field_desc, &scalar);
+            write_varint(w, (number << 3) | wire_type);
+            write_scalar(w, wire_type, scalar);
+        } else if (!CPB_IS_PACKED_REPEATED(field_desc)) {
+            write_elements(w, entry, (number << 3) | wire_type);
+        } else {
+            /* All occurrences in one packed field */
+            if (entry->size) {
+                write_varint(w, (number << 3) | WT_STRING);
+                write_varint(w, entry->size);
+            }
+            for (; i < first + count &&
+                   index->entries[i].field_desc == field_desc; i++)
+                write_elements(w, &index->entries[i], 0);
+            i--;
+        }
+    }
+}
+
+/**
+ * Re-encodes a message in canonical encoding, so that equal messages encode
+ * to the same bytes. Known fields are written in order of their numbers and
+ * varints in their shortest form. Singular fields keep their last value and
+ * occurrences of singular messages are merged, as when decoding. Repeated
+ * scalar fields are packed if declared packed and unpacked otherwise.
+ * Optional fields holding their default value are dropped, as are unknown
+ * fields and fields of the wrong wire type.
+ * @note Each message is scanned once into an index of its fields, allocated
+ * from the default allocator, which also holds the nested message sizes.
+ * @note The message and the data buffer must not overlap.
+ * @param msg_desc Message descriptor
+ * @param msg Encoded message
+ * @param msg_len Length of encoded message
+ * @param data Data buffer to write into
+ * @param len Length of data buffer
+ * @param used Returns the length of the canonical message when not NULL.
+ * @param hash Returns the hash of the canonical message when not NULL, as
+ * computed by cpb_canonical_hash().
+ * @return Returns CPB_ERR_OK if successful, CPB_ERR_END_OF_BUF if the data
+ * buffer is too small or the message is truncated,
+ * CPB_ERR_INVALID_WIRE_TYPE if the message contains invalid data,
+ * CPB_ERR_DEPTH if it nests messages more than CPB_MAX_DEPTH deep or
+ * CPB_ERR_MEM if the index could not be allocated.
+ */
+cpb_err_t cpb_canonical_encode(const struct cpb_msg_desc *msg_desc,
+                                 const void *msg, size_t msg_len,
+                                 void *data, size_t len, size_t *used,
+                                 u64_t *hash)
+{
+    const struct cpb_allocator *allocator = &cpb_default_allocator;
+    struct hasher hasher;
+    struct writer w;
+    struct index index;
+    size_t first, count, size;
+    cpb_err_t ret;
+
+    index.entries = NULL;
+    index.num = 0;
+    index.cap = 0;
+
+    /* The root message is the only occurrence of itself */
+    ret = reserve(&index, 1);
+    if (ret != CPB_ERR_OK)
+        return ret;
+    index.entries[0].field_desc = NULL;
+    index.entries[0].pos = msg;
+    index.entries[0].end = (const u8_t *) msg + msg_len;
+    index.num = 1;
+
+    ret = index_message(&index, msg_desc, 0, 1, 0, &first, &count, &size);
+    if (ret == CPB_ERR_OK && size > len)
+        ret = CPB_ERR_END_OF_BUF;
+
+    if (ret == CPB_ERR_OK) {
+        hash_init(&hasher);
+        w.data = data;
+        w.pos = 0;
+        w.hasher = hash ? &hasher : NULL;
+        write_message(&w, &index, first, count);
+
+        if (used)
+            *used = w.pos;
+        if (hash)
+            *hash = hash_final(&hasher);
+    }
+
+    allocator->free(allocator->ctx, index.entries);
+
+    return ret;
+}
+
+/**
+ * Computes the 64 bit hash of a canonical message. The hash is not
+ * cryptographic, it is meant for cache keys and deduplication.
+ * @param data Canonical message
+ * @param len Length of canonical message
+ * @return Returns the hash.
+ */
+u64_t cpb_canonical_hash(const void *data, size_t len)
+{
+    struct hasher hasher;
+
+    hash_init(&hasher);
+    hash_update(&hasher, data, len);
+
+    return hash_final(&hasher);
+}
@@ -156,6 +156,9 @@ cpb_err_t cpb_decode_varint(struct cpb_buf *buf, u64_t *varint)
 {
     int bitpos;
 
+    if (buf->pos >= buf->end)
+        return CPB_ERR_END_OF_BUF;
+
     *varint = 0;
     for (bitpos = 0; *buf->pos & 0x80 && bitpos < 64; bitpos += 7, buf->pos++) {
         *varint |= (u64_t) (*buf->pos & 0x7f) << bitpos;
@@ -243,6 +246,389 @@ static enum wire_type field_wire_type(const struct cpb_field_desc *field_desc)
     }
 }
 
+/**
+ * Skips a variable integer without decoding it.
+ * @param buf Memory buffer
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_END_OF_BUF if the
+ * varint is truncated or longer than 10 bytes.
+ */
+static cpb_err_t skip_varint(struct cpb_buf *buf)
+{
+    u8_t *p = buf->pos;
+    u8_t *end = buf->end;
+
+    if (end - p > 10)
+        end = p + 10;
+    while (p < end)
+        if (!(*p++ & 0x80)) {
+            buf->pos = p;
+            return CPB_ERR_OK;
+        }
+
+    return CPB_ERR_END_OF_BUF;
+}
+
+/**
+ * Skips the value of a field whose key has already been decoded. All wire
+ * types are handled. Groups are skipped up to their matching end-group key,
+ * including any nested groups.
+ * @param buf Memory buffer
+ * @param wire_type Wire type of the field
+ * @param number Field number
+ * @return Returns CPB_ERR_OK if successful, CPB_ERR_END_OF_BUF if the data
+ * is truncated or CPB_ERR_INVALID_WIRE_TYPE if the data contains an invalid
+ * wire type or unbalanced groups.
+ */
+cpb_err_t cpb_skip_field(struct cpb_buf *buf, int wire_type, u32_t number)
+{
+    cpb_err_t ret;
+    u64_t key;
+    u64_t len;
+    u32_t groups[CPB_MAX_DEPTH];
+    int depth = 0;
+
+    for (;;) {
+        switch (wire_type) {
+        case WT_VARINT:
+            ret = skip_varint(buf);
+            if (ret != CPB_ERR_OK)
+                return ret;
+            break;
+        case WT_64BIT:
+            if (cpb_buf_left(buf) < 8)
+                return CPB_ERR_END_OF_BUF;
+            buf->pos += 8;
+            break;
+        case WT_STRING:
+            ret = cpb_decode_varint(buf, &len);
+            if (ret != CPB_ERR_OK)
+                return ret;
+            if (len > cpb_buf_left(buf))
+                return CPB_ERR_END_OF_BUF;
+            buf->pos += len;
+            break;
+        case WT_32BIT:
+            if (cpb_buf_left(buf) < 4)
+                return CPB_ERR_END_OF_BUF;
+            buf->pos += 4;
+            break;
+        case WT_START_GROUP:
+            if (depth == CPB_MAX_DEPTH)
+                return CPB_ERR_INVALID_WIRE_TYPE;
+            groups[depth++] = number;
+            break;
+        case WT_END_GROUP:
+            if (depth == 0 || groups[depth - 1] != number)
+                return CPB_ERR_INVALID_WIRE_TYPE;
+            depth--;
+            break;
+        default:
+            return CPB_ERR_INVALID_WIRE_TYPE;
+        }
+
+        if (depth == 0)
+            return CPB_ERR_OK;
+
+        /* Decode the next key inside the group */
+        ret = cpb_decode_varint(buf, &key);
+        if (ret != CPB_ERR_OK)
+            return ret;
+        number = key >> 3;
+        wire_type = key & 0x07;
+    }
+}
+
+/**
+ * Converts a decoded wire value to a field value.
+ * @param field_desc Field descriptor
+ * @param wire_value Wire value
+ * @param value Field value to convert into
+ */
+void cpb_wire_to_value(const struct cpb_field_desc *field_desc,
+                       const union wire_value *wire_value,
+                       union cpb_value *value)
+{
+    switch (field_desc->opts.typ) {
+    case CPB_DOUBLE:
+        memcpy(&value->double_, &wire_value->int64, sizeof(double));
+        break;
+    case CPB_FLOAT:
+        memcpy(&value->float_, &wire_value->int32, sizeof(float));
+        break;
+    case CPB_INT32:
+        value->int32 = wire_value->varint;
+        break;
+    case CPB_INT64:
+        value->int64 = wire_value->varint;
+        break;
+    case CPB_UINT32:
+        value->uint32 = wire_value->varint;
+        break;
+    case CPB_UINT64:
+        value->uint64 = wire_value->varint;
+        break;
+    case CPB_SINT32:
+        /* Zig-zag encoding */
+        value->int32 = (wire_value->varint >> 1) ^ -((s32_t) (wire_value->varint & 1));
+        break;
+    case CPB_SINT64:
+        /* Zig-zag encoding */
+        value->int64 = (wire_value->varint >> 1) ^ -((s64_t) (wire_value->varint & 1));
+        break;
+    case CPB_FIXED32:
+        value->uint32 = wire_value->int32;
+        break;
+    case CPB_FIXED64:
+        value->uint64 = wire_value->int64;
+        break;
+    case CPB_SFIXED32:
+        value->int32 = wire_value->int32;
+        break;
+    case CPB_SFIXED64:
+        value->int64 = wire_value->int64;
+        break;
+    case CPB_BOOL:
+        value->bool = wire_value->varint;
+        break;
+    case CPB_ENUM:
+        value->enum_ = wire_value->varint;
+        break;
+    case CPB_STRING:
+        value->string.len = wire_value->string.len;
+        value->string.str = wire_value->string.data;
+        break;
+    case CPB_BYTES:
+        value->bytes.len = wire_value->string.len;
+        value->bytes.data = wire_value->string.data;
+        break;
+    default:
+        break;
+    }
+}
+
+/* Segmented buffer reader */
+
+/** Reader over a chain of memory segments */
+struct iov_reader {
+    const struct cpb_iovec *iov;    /**< Segments */
+    int iovcnt;                     /**< Number of segments */
+    int index;                      /**< Index of the current segment */
+    u8_t *seg;                      /**< Base of the current segment */
+    u8_t *pos;                      /**< Position in the current segment */
+    u8_t *end;                      /**< End of the current segment */
+    size_t seg_ofs;                 /**< Absolute offset of the current segment */
+};
+
+/**
+ * Advances the reader to the next non-empty segment if the current segment
+ * is exhausted.
+ * @param r Reader
+ * @return Returns !0 if there are bytes left to read.
+ */
+static int iov_next(struct iov_reader *r)
+{
+    while (r->pos == r->end) {
+        if (r->index + 1 >= r->iovcnt)
+            return 0;
+        r->seg_ofs += r->end - r->seg;
+        r->index++;
+        r->seg = r->iov[r->index].base;
+        r->pos = r->seg;
+        r->end = r->seg + r->iov[r->index].len;
+    }
+    return 1;
+}
+
+/**
+ * Returns the absolute offset of the reader.
+ * @param r Reader
+ * @return Returns the number of bytes read so far.
+ */
+static size_t iov_offset(struct iov_reader *r)
+{
+    return r->seg_ofs + (r->pos - r->seg);
+}
+
+/**
+ * Returns the number of bytes that can be read in place, without crossing
+ * a segment boundary or the given limit.
+ * @param r Reader
+ * @param limit Absolute offset not to read beyond
+ * @return Returns the number of contiguous bytes.
+ */
+static size_t iov_contig(struct iov_reader *r, size_t limit)
+{
+    size_t left = limit - iov_offset(r);
+
+    iov_next(r);
+    if ((size_t) (r->end - r->pos) < left)
+        return r->end - r->pos;
+    return left;
+}
+
+/**
+ * Copies bytes across segment boundaries.
+ * @param r Reader
+ * @param limit Absolute offset not to read beyond
+ * @param dst Destination or NULL to skip the bytes
+ * @param n Number of bytes
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_END_OF_BUF if there
+ * were not enough bytes left.
+ */
+static cpb_err_t iov_copy(struct iov_reader *r, size_t limit,
+                          u8_t *dst, size_t n)
+{
+    size_t chunk;
+
+    if (limit - iov_offset(r) < n)
+        return CPB_ERR_END_OF_BUF;
+
+    while (n > 0) {
+        if (!iov_next(r))
+            return CPB_ERR_END_OF_BUF;
+        chunk = r->end - r->pos;
+        if (chunk > n)
+            chunk = n;
+        if (dst) {
+            memcpy(dst, r->pos, chunk);
+            dst += chunk;
+        }
+        r->pos += chunk;
+        n -= chunk;
+    }
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Returns the next n bytes. They are returned in place unless they straddle
+ * a segment boundary, in which case they are gathered into tmp.
+ * @param r Reader
+ * @param limit Absolute offset not to read beyond
+ * @param n Number of bytes
+ * @param tmp Scratch area
+ * @param tmp_len Length of the scratch area
+ * @param data Returns a pointer to the bytes
+ * @return Returns CPB_ERR_OK if successful, CPB_ERR_END_OF_BUF if there were
+ * not enough bytes left or CPB_ERR_MEM if the scratch area is too small.
+ */
+static cpb_err_t iov_window(struct iov_reader *r, size_t limit, size_t n,
+                            u8_t *tmp, size_t tmp_len, u8_t **data)
+{
+    if (iov_contig(r, limit) >= n) {
+        *data = r->pos;
+        r->pos += n;
+        return CPB_ERR_OK;
+    }
+
+    if (limit - iov_offset(r) < n)
+        return CPB_ERR_END_OF_BUF;
+    if (n > tmp_len)
+        return CPB_ERR_MEM;
+
+    *data = tmp;
+    return iov_copy(r, limit, tmp, n);
+}
+
+/**
+ * Decodes a variable integer, which may straddle segment boundaries.
+ * @param r Reader
+ * @param limit Absolute offset not to read beyond
+ * @param varint Buffer to decode into
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_END_OF_BUF if there
+ * were not enough bytes left.
+ */
+static cpb_err_t iov_decode_varint(struct iov_reader *r, size_t limit,
+                                   u64_t *varint)
+{
+    cpb_err_t ret;
+    struct cpb_buf buf;
+    u8_t tmp[10];
+    size_t n;
+
+    /* Fast path: the varint ends within the current segment */
+    cpb_buf_init(&buf, r->pos, iov_contig(r, limit));
+    if (cpb_decode_varint(&buf, varint) == CPB_ERR_OK) {
+        r->pos = buf.pos;
+        return CPB_ERR_OK;
+    }
+
+    for (n = 0; n < sizeof(tmp); ) {
+        ret = iov_copy(r, limit, &tmp[n], 1);
+        if (ret != CPB_ERR_OK)
+            return ret;
+        if (!(tmp[n++] & 0x80))
+            break;
+    }
+
+    cpb_buf_init(&buf, tmp, n);
+    return cpb_decode_varint(&buf, varint);
+}
+
+/**
+ * Skips the value of a field, see cpb_skip_field().
+ * @param r Reader
+ * @param limit Absolute offset not to read beyond
+ * @param wire_type Wire type of the field
+ * @param number Field number
+ * @return Returns CPB_ERR_OK if successful.
+ */
+static cpb_err_t iov_skip_field(struct iov_reader *r, size_t limit,
+                                int wire_type, u32_t number)
+{
+    cpb_err_t ret;
+    u64_t key;
+    u64_t value;
+    u32_t groups[CPB_MAX_DEPTH];
+    int depth = 0;
+
+    for (;;) {
+        switch (wire_type) {
+        case WT_VARINT:
+            ret = iov_decode_varint(r, limit, &value);
+            break;
+        case WT_64BIT:
+            ret = iov_copy(r, limit, NULL, 8);
+            break;
+        case WT_STRING:
+            ret = iov_decode_varint(r, limit, &value);
+            if (ret == CPB_ERR_OK)
+                ret = value > limit - iov_offset(r) ? CPB_ERR_END_OF_BUF :
+                      iov_copy(r, limit, NULL, value);
+            break;
+        case WT_32BIT:
+            ret = iov_copy(r, limit, NULL, 4);
+            break;
+        case WT_START_GROUP:
+            if (depth == CPB_MAX_DEPTH)
+                return CPB_ERR_INVALID_WIRE_TYPE;
+            groups[depth++] = number;
+            ret = CPB_ERR_OK;
+            break;
+        case WT_END_GROUP:
+            if (depth == 0 || groups[depth - 1] != number)
+                return CPB_ERR_INVALID_WIRE_TYPE;
+            depth--;
+            ret = CPB_ERR_OK;
+            break;
+        default:
+            return CPB_ERR_INVALID_WIRE_TYPE;
+        }
+        if (ret != CPB_ERR_OK)
+            return ret;
+
+        if (depth == 0)
+            return CPB_ERR_OK;
+
+        /* Decode the next key inside the group */
+        ret = iov_decode_varint(r, limit, &key);
+        if (ret != CPB_ERR_OK)
+            return ret;
+        number = key >> 3;
+        wire_type = key & 0x07;
+    }
+}
+
 /**
  * Pushes the decoder stack.
  * @param decoder Dncoder
@@ -255,6 +641,42 @@ static struct cpb_decoder_stack_frame *push_stack_frame(struct cpb_decoder *deco
     return &decoder->stack[decoder->depth - 1];
 }
 
+#if CPB_FIELD_TAGS
+/**
+ * Matches the next field key against the pre-encoded tags of the fields
+ * most likely to follow the previously decoded one: the same field again
+ * (repeated fields) and the next field in declaration order.
+ * @param frame Current stack frame
+ * @param wire_type Returns the wire type of the matched key
+ * @return Returns the matched field descriptor with the key consumed, or NULL
+ * if the key has to be decoded and looked up.
+ */
+static const struct cpb_field_desc *match_tag(struct cpb_decoder_stack_frame *frame,
+                                              enum wire_type *wire_type)
+{
+    const struct cpb_field_desc *field_desc, *end;
+    const struct cpb_field_tag *tag;
+    int i;
+
+    end = &frame->msg_desc->fields[frame->msg_desc->num_fields];
+    field_desc = frame->hint ? frame->hint : frame->msg_desc->fields;
+
+    for (i = 0; i < 2 && field_desc < end; i++, field_desc++) {
+        tag = CPB_IS_PACKED_REPEATED(field_desc) ? &field_desc->packed_tag :
+                                                    &field_desc->tag;
+        if (tag->len && cpb_buf_left(&frame->buf) >= tag->len &&
+            memcmp(frame->buf.pos, tag->bytes, tag->len) == 0) {
+            frame->buf.pos += tag->len;
+            *wire_type = CPB_IS_PACKED_REPEATED(field_desc) ?
+                         WT_STRING : field_wire_type(field_desc);
+            return field_desc;
+        }
+    }
+
+    return NULL;
+}
+#endif
+
 /* Decoder */
 
 /**
@@ -267,6 +689,8 @@ void cpb_decoder_init(struct cpb_decoder *decoder)
     decoder->msg_start_handler = NULL;
     decoder->msg_end_handler = NULL;
     decoder->field_handler = NULL;
+    decoder->scratch = NULL;
+    decoder->scratch_len = 0;
 }
 
 /**
@@ -304,6 +728,21 @@ void cpb_decoder_field_handler(struct cpb_decoder *decoder,
     decoder->field_handler = field_handler;
 }
 
+/**
+ * Sets the scratch area used by cpb_decoder_decode_iov(). Length-delimited
+ * values that straddle a segment boundary are gathered into it before they
+ * are passed to the field handler. Values that do not straddle a boundary,
+ * as well as nested messages and packed repeated fields, never use it.
+ * @param decoder Decoder
+ * @param data Scratch area
+ * @param len Length of scratch area
+ */
+void cpb_decoder_scratch(struct cpb_decoder *decoder, void *data, size_t len)
+{
+    decoder->scratch = data;
+    decoder->scratch_len = len;
+}
+
 /**
  * Setups the decoder to use the verbose debug handlers which output the
  * message contents to the console.
@@ -345,6 +784,7 @@ cpb_err_t cpb_decoder_decode(struct cpb_decoder *decoder,
     frame = &decoder->stack[decoder->depth - 1];
     cpb_buf_init(&frame->buf, data, len);
     frame->msg_desc = msg_desc;
+    frame->hint = NULL;
 
     while (decoder->depth >= 1) {
 decode_nested:
@@ -363,20 +803,38 @@ decode_nested:
             if (decoder->packed) {
                 wire_type = field_wire_type(field_desc);
             } else {
-                /* Decode the field key */
-                ret = cpb_decode_varint(&frame->buf, &key);
-                if (ret != CPB_ERR_OK)
-                    return ret;
+                field_desc = NULL;
+#if CPB_FIELD_TAGS
+                field_desc = match_tag(frame, &wire_type);
+#endif
+                if (!field_desc) {
+                    /* Decode the field key */
+                    ret = cpb_decode_varint(&frame->buf, &key);
+                    if (ret != CPB_ERR_OK)
+                        return ret;
+
+                    number = key >> 3;
+                    wire_type = key & 0x07;
 
-                number = key >> 3;
-                wire_type = key & 0x07;
+                    /* Find the field descriptor */
+                    for (i = 0; i < frame->msg_desc->num_fields; i++)
+                        if (frame->msg_desc->fields[i].number == number) {
+                            field_desc = &frame->msg_desc->fields[i];
+                            break;
+                        }
 
-                /* Find the field descriptor */
-                for (i = 0; i < frame->msg_desc->num_fields; i++)
-                    if (frame->msg_desc->fields[i].number == number) {
-                        field_desc = &frame->msg_desc->fields[i];
-                        break;
+                    /* Skip unknown fields and fields with unexpected wire types */
+                    if (!field_desc ||
+                        (wire_type != field_wire_type(field_desc) &&
+                         !(wire_type == WT_STRING &&
+                           CPB_IS_PACKED_REPEATED(field_desc)))) {
+                        ret = cpb_skip_field(&frame->buf, wire_type, number);
+                        if (ret != CPB_ERR_OK)
+                            return ret;
+                        continue;
                     }
+                }
+                frame->hint = field_desc;
             }
 
             /* Decode field's wire value */
@@ -406,14 +864,9 @@ decode_nested:
                     return ret;
                 break;
             default:
-                CPB_ASSERT(1, "Unknown wire type");
-                break;
+                return CPB_ERR_INVALID_WIRE_TYPE;
             }
 
-            /* Skip unknown fields */
-            if (!field_desc)
-                continue;
-
             /* Handle packed repeated fields */
             if ((wire_type == WT_STRING) &&
                 CPB_IS_PACKED_REPEATED(field_desc)) {
@@ -429,61 +882,7 @@ decode_nested:
                 goto decode_nested;
             }
 
-            switch (field_desc->opts.typ) {
-            case CPB_DOUBLE:
-                memcpy(&value.double_, &wire_value.int64, sizeof(double));
-                break;
-            case CPB_FLOAT:
-                memcpy(&value.float_, &wire_value.int32, sizeof(float));
-                break;
-            case CPB_INT32:
-                value.int32 = wire_value.varint;
-                break;
-            case CPB_INT64:
-                value.int64 = wire_value.varint;
-                break;
-            case CPB_UINT32:
-                value.uint32 = wire_value.varint;
-                break;
-            case CPB_UINT64:
-                value.uint64 = wire_value.varint;
-                break;
-            case CPB_SINT32:
-                /* Zig-zag encoding */
-                value.int32 = (wire_value.varint >> 1) ^ -((s32_t) (wire_value.varint & 1));
-                break;
-            case CPB_SINT64:
-                /* Zig-zag encoding */
-                value.int64 = (wire_value.varint >> 1) ^ -((s64_t) (wire_value.varint & 1));
-                break;
-            case CPB_FIXED32:
-                value.uint32 = wire_value.int32;
-                break;
-            case CPB_FIXED64:
-                value.uint64 = wire_value.int64;
-                break;
-            case CPB_SFIXED32:
-                value.int32 = wire_value.int32;
-                break;
-            case CPB_SFIXED64:
-                value.int64 = wire_value.int64;
-                break;
-            case CPB_BOOL:
-                value.bool = wire_value.varint;
-                break;
-            case CPB_ENUM:
-                value.enum_ = wire_value.varint;
-                break;
-            case CPB_STRING:
-                value.string.len = wire_value.string.len;
-                value.string.str = wire_value.string.data;
-                break;
-            case CPB_BYTES:
-                value.bytes.len = wire_value.string.len;
-                value.bytes.data = wire_value.string.data;
-                break;
-            case CPB_MESSAGE:
-            default:
+            if (field_desc->opts.typ == CPB_MESSAGE) {
                 if (decoder->field_handler)
                     decoder->field_handler(decoder, msg_desc, field_desc, NULL, decoder->arg);
 
@@ -491,10 +890,13 @@ decode_nested:
                 new_frame = push_stack_frame(decoder);
                 cpb_buf_init(&new_frame->buf, wire_value.string.data, wire_value.string.len);
                 new_frame->msg_desc = field_desc->msg_desc;
+                new_frame->hint = NULL;
 
                 goto decode_nested;
             }
 
+            cpb_wire_to_value(field_desc, &wire_value, &value);
+
             if (decoder->field_handler)
                 decoder->field_handler(decoder, frame->msg_desc, field_desc, &value, decoder->arg);
         }
@@ -516,3 +918,178 @@ decode_nested:
 
     return CPB_ERR_OK;
 }
+
+/**
+ * Decodes a protocol buffer held in a chain of memory segments, without
+ * coalescing them first. Values that straddle a segment boundary are
+ * gathered into a small local buffer (varints and fixed width values) or
+ * into the scratch area set with cpb_decoder_scratch() (strings and bytes).
+ * @param decoder Decoder
+ * @param msg_desc Root message descriptor of the protocol buffer
+ * @param iov Segments holding the data to decode
+ * @param iovcnt Number of segments
+ * @param used Returns the number of decoded bytes when not NULL.
+ * @return Returns CPB_ERR_OK when data was successfully decoded or
+ * CPB_ERR_MEM if a straddling value does not fit into the scratch area.
+ */
+cpb_err_t cpb_decoder_decode_iov(struct cpb_decoder *decoder,
+                                   const struct cpb_msg_desc *msg_desc,
+                                   const struct cpb_iovec *iov, int iovcnt,
+                                   size_t *used)
+{
+    cpb_err_t ret;
+    int i;
+    u64_t key;
+    int number;
+    const struct cpb_field_desc *field_desc = NULL;
+    enum wire_type wire_type;
+    union wire_value wire_value;
+    union cpb_value value;
+    struct cpb_decoder_stack_frame *frame, *new_frame;
+    struct iov_reader r;
+    size_t limits[CPB_MAX_DEPTH];
+    size_t limit;
+    u8_t tmp[8];
+    u8_t *data;
+    struct cpb_buf buf;
+
+    r.iov = iov;
+    r.iovcnt = iovcnt;
+    r.index = -1;
+    r.seg = r.pos = r.end = NULL;
+    r.seg_ofs = 0;
+
+    /* Setup initial stack frame */
+    decoder->depth = 1;
+    decoder->packed = 0;
+    frame = &decoder->stack[0];
+    cpb_buf_init(&frame->buf, NULL, 0);
+    frame->msg_desc = msg_desc;
+    limits[0] = 0;
+    for (i = 0; i < iovcnt; i++)
+        limits[0] += iov[i].len;
+
+    if (decoder->msg_start_handler)
+        decoder->msg_start_handler(decoder, msg_desc, decoder->arg);
+
+    while (decoder->depth >= 1) {
+
+        /* Get current frame */
+        frame = &decoder->stack[decoder->depth - 1];
+        limit = limits[decoder->depth - 1];
+
+        if (iov_offset(&r) >= limit) {
+            /* Notify end message */
+            if (decoder->msg_end_handler)
+                decoder->msg_end_handler(decoder, frame->msg_desc, decoder->arg);
+
+            /* Pop the stack and leave packed repeated mode */
+            decoder->depth--;
+            decoder->packed = 0;
+            continue;
+        }
+
+        if (decoder->packed) {
+            wire_type = field_wire_type(field_desc);
+        } else {
+            /* Decode the field key */
+            ret = iov_decode_varint(&r, limit, &key);
+            if (ret != CPB_ERR_OK)
+                return ret;
+
+            number = key >> 3;
+            wire_type = key & 0x07;
+
+            /* Find the field descriptor */
+            field_desc = NULL;
+            for (i = 0; i < frame->msg_desc->num_fields; i++)
+                if (frame->msg_desc->fields[i].number == number) {
+                    field_desc = &frame->msg_desc->fields[i];
+                    break;
+                }
+
+            /* Skip unknown fields and fields with unexpected wire types */
+            if (!field_desc ||
+                (wire_type != field_wire_type(field_desc) &&
+                 !(wire_type == WT_STRING &&
+                   CPB_IS_PACKED_REPEATED(field_desc)))) {
+                ret = iov_skip_field(&r, limit, wire_type, number);
+                if (ret != CPB_ERR_OK)
+                    return ret;
+                continue;
+            }
+        }
+
+        /* Decode field's wire value */
+        switch (wire_type) {
+        case WT_VARINT:
+            ret = iov_decode_varint(&r, limit, &wire_value.varint);
+            if (ret != CPB_ERR_OK)
+                return ret;
+            break;
+        case WT_64BIT:
+            ret = iov_window(&r, limit, 8, tmp, sizeof(tmp), &data);
+            if (ret != CPB_ERR_OK)
+                return ret;
+            cpb_buf_init(&buf, data, 8);
+            cpb_decode_64bit(&buf, &wire_value.int64);
+            break;
+        case WT_STRING:
+            ret = iov_decode_varint(&r, limit, &wire_value.string.len);
+            if (ret != CPB_ERR_OK)
+                return ret;
+            if (wire_value.string.len > limit - iov_offset(&r))
+                return CPB_ERR_END_OF_BUF;
+
+            /* Nested messages and packed repeated fields get a new frame */
+            if (CPB_IS_PACKED_REPEATED(field_desc) ||
+                field_desc->opts.typ == CPB_MESSAGE) {
+                if (!CPB_IS_PACKED_REPEATED(field_desc) && decoder->field_handler)
+                    decoder->field_handler(decoder, frame->msg_desc, field_desc, NULL, decoder->arg);
+
+                new_frame = push_stack_frame(decoder);
+                cpb_buf_init(&new_frame->buf, NULL, 0);
+                limits[decoder->depth - 1] = iov_offset(&r) + wire_value.string.len;
+
+                if (CPB_IS_PACKED_REPEATED(field_desc)) {
+                    /* Enter packed repeated mode */
+                    new_frame->msg_desc = frame->msg_desc;
+                    decoder->packed = 1;
+                } else {
+                    new_frame->msg_desc = field_desc->msg_desc;
+                }
+
+                /* Notify start message */
+                if (decoder->msg_start_handler)
+                    decoder->msg_start_handler(decoder, new_frame->msg_desc, decoder->arg);
+                continue;
+            }
+
+            ret = iov_window(&r, limit, wire_value.string.len,
+                             decoder->scratch, decoder->scratch_len, &data);
+            if (ret != CPB_ERR_OK)
+                return ret;
+            wire_value.string.data = data;
+            break;
+        case WT_32BIT:
+            ret = iov_window(&r, limit, 4, tmp, sizeof(tmp), &data);
+            if (ret != CPB_ERR_OK)
+                return ret;
+            cpb_buf_init(&buf, data, 4);
+            cpb_decode_32bit(&buf, &wire_value.int32);
+            break;
+        default:
+            return CPB_ERR_INVALID_WIRE_TYPE;
+        }
+
+        cpb_wire_to_value(field_desc, &wire_value, &value);
+
+        if (decoder->field_handler)
+            decoder->field_handler(decoder, frame->msg_desc, field_desc, &value, decoder->arg);
+    }
+
+    if (used)
+        *used = iov_offset(&r);
+
+    return CPB_ERR_OK;
+}
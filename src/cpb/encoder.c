@@ -16,12 +16,16 @@
  */
 
 #include <cpb/cpb.h>
+#include <cpb/core/encoder2.h>
 
 #include "private.h"
 
 
 #define MSG_RESERVE_BYTES 10
 
+/* No checkpoint is pinning the output */
+#define NO_PIN ((size_t) -1)
+
 /* Encoder utilities */
 
 /**
@@ -35,17 +39,10 @@
  */
 static cpb_err_t encode_varint(struct cpb_buf *buf, u64_t varint)
 {
-    do {
-        if (cpb_buf_left(buf) < 1)
-            return CPB_ERR_END_OF_BUF;
-        if (varint > 127) {
-            *buf->pos = 0x80 | (varint & 0x7F);
-        } else {
-            *buf->pos = (varint & 0x7F);
-        }
-        varint >>= 7;
-        buf->pos++;
-    } while (varint);
+    if (cpb_buf_left(buf) < cpb_varint_size(varint))
+        return CPB_ERR_END_OF_BUF;
+
+    buf->pos += cpb_encode_varint(buf->pos, varint);
 
     return CPB_ERR_OK;
 }
@@ -97,6 +94,35 @@ static cpb_err_t encode_64bit(struct cpb_buf *buf, u64_t value)
     return CPB_ERR_OK;
 }
 
+/**
+ * Encodes a field key, copying the pre-encoded tag if available.
+ * @param buf Memory buffer
+ * @param field_desc Field descriptor
+ * @param wire_type Wire type
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_END_OF_BUF if there
+ * was not enough space left in the memory buffer.
+ */
+static cpb_err_t encode_key(struct cpb_buf *buf,
+                            const struct cpb_field_desc *field_desc,
+                            enum wire_type wire_type)
+{
+#if CPB_FIELD_TAGS
+    const struct cpb_field_tag *tag;
+
+    tag = CPB_IS_PACKED_REPEATED(field_desc) ? &field_desc->packed_tag :
+                                                &field_desc->tag;
+    if (tag->len) {
+        if (cpb_buf_left(buf) < tag->len)
+            return CPB_ERR_END_OF_BUF;
+        memcpy(buf->pos, tag->bytes, tag->len);
+        buf->pos += tag->len;
+        return CPB_ERR_OK;
+    }
+#endif
+
+    return encode_varint(buf, wire_type | (field_desc->number << 3));
+}
+
 /**
  * Pushes the encoder stack.
  * @param encoder Encoder
@@ -121,6 +147,175 @@ static struct cpb_encoder_stack_frame *pop_stack_frame(struct cpb_encoder *encod
     return &encoder->stack[encoder->depth - 1];
 }
 
+static cpb_err_t add_field(struct cpb_encoder *encoder,
+                           const struct cpb_field_desc *field_desc,
+                           union cpb_value *value);
+
+/**
+ * Returns the output offset of the current frame position, counting the bytes
+ * already passed to the sink.
+ * @param encoder Encoder
+ * @return Returns the output offset.
+ */
+static size_t output_offset(struct cpb_encoder *encoder)
+{
+    size_t ofs = 0;
+    int i;
+
+    /* Every flushed byte is accounted to exactly one open frame */
+    for (i = 0; i < encoder->depth; i++)
+        ofs += encoder->stack[i].flushed;
+
+    return ofs + (encoder->stack[encoder->depth - 1].buf.pos -
+                  encoder->stack[0].buf.base);
+}
+
+/**
+ * Passes the encoded bytes that can no longer change to the sink and moves
+ * the remaining bytes to the front of the staging buffer. Bytes are final up
+ * to the reserved key and length of the outermost nested message or packed
+ * repeated field whose length is not known yet, and up to the oldest open
+ * checkpoint.
+ * @param encoder Encoder
+ * @return Returns CPB_ERR_OK if successful or the error code of the sink.
+ */
+static cpb_err_t flush(struct cpb_encoder *encoder)
+{
+    cpb_err_t ret;
+    struct cpb_encoder_stack_frame *frame;
+    u8_t *staging, *limit, *end;
+    size_t delta, pin;
+    int i;
+
+    staging = encoder->stack[0].buf.base;
+    end = encoder->stack[encoder->depth - 1].buf.pos;
+
+    limit = end;
+    for (i = 1; i < encoder->depth; i++)
+        if (encoder->stack[i].reserved) {
+            limit = encoder->stack[i].buf.base - MSG_RESERVE_BYTES;
+            break;
+        }
+
+    /* Bytes after a checkpoint may still be rolled back */
+    if (encoder->pin != NO_PIN) {
+        pin = encoder->pin - (output_offset(encoder) - (end - staging));
+        if (pin < (size_t) (limit - staging))
+            limit = staging + pin;
+    }
+
+    delta = limit - staging;
+    if (delta == 0)
+        return CPB_ERR_OK;
+
+    ret = encoder->sink(encoder->sink_arg, staging, delta);
+    if (ret != CPB_ERR_OK)
+        return ret;
+
+    memmove(staging, limit, end - limit);
+
+    /* Rebase the frames, accounting for their flushed bytes */
+    for (i = 0; i < encoder->depth; i++) {
+        frame = &encoder->stack[i];
+        if (frame->buf.base < limit) {
+            frame->flushed += (frame->buf.pos < limit ? frame->buf.pos : limit) -
+                              frame->buf.base;
+            frame->buf.base = limit;
+            if (frame->buf.pos < limit)
+                frame->buf.pos = limit;
+        }
+        frame->buf.base -= delta;
+        frame->buf.pos -= delta;
+    }
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Makes room in the staging buffer by flushing final bytes to the sink.
+ * @param encoder Encoder
+ * @return Returns CPB_ERR_OK if room was made, CPB_ERR_END_OF_BUF if not
+ * encoding to a sink or no byte could be flushed, or the error code of the
+ * sink.
+ */
+static cpb_err_t make_room(struct cpb_encoder *encoder)
+{
+    cpb_err_t ret;
+    u8_t *pos = encoder->stack[encoder->depth - 1].buf.pos;
+
+    if (!encoder->sink)
+        return CPB_ERR_END_OF_BUF;
+
+    ret = flush(encoder);
+    if (ret != CPB_ERR_OK)
+        return ret;
+
+    if (encoder->stack[encoder->depth - 1].buf.pos == pos)
+        return CPB_ERR_END_OF_BUF;
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Makes sure the current frame has a number of bytes left.
+ * @param encoder Encoder
+ * @param len Number of bytes needed
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_END_OF_BUF if there
+ * is not enough space left in the memory buffer.
+ */
+static cpb_err_t ensure(struct cpb_encoder *encoder, size_t len)
+{
+    cpb_err_t ret;
+
+    while (cpb_buf_left(&encoder->stack[encoder->depth - 1].buf) < len) {
+        ret = make_room(encoder);
+        if (ret != CPB_ERR_OK)
+            return ret;
+    }
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Pushes a frame whose key and length are reserved in the parent frame and
+ * written once the length is known.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor
+ * @param msg_desc Message descriptor or NULL for packed repeated fields
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_END_OF_BUF if there
+ * is not enough space left in the memory buffer.
+ */
+static cpb_err_t push_reserved_frame(struct cpb_encoder *encoder,
+                                     const struct cpb_field_desc *field_desc,
+                                     const struct cpb_msg_desc *msg_desc)
+{
+    cpb_err_t ret;
+    struct cpb_encoder_stack_frame *frame, *new_frame;
+
+    /*
+     * Reserve a few bytes for the field on the parent frame. This is where
+     * the field key and the length will be stored, once it is known.
+     */
+    ret = ensure(encoder, MSG_RESERVE_BYTES);
+    if (ret != CPB_ERR_OK)
+        return ret;
+
+    /* Get parent frame */
+    frame = &encoder->stack[encoder->depth - 1];
+
+    /* Create a new frame */
+    new_frame = push_stack_frame(encoder);
+    new_frame->field_desc = field_desc;
+    new_frame->msg_desc = msg_desc;
+    new_frame->reserved = 1;
+    new_frame->len = 0;
+    new_frame->flushed = 0;
+    cpb_buf_init(&new_frame->buf, frame->buf.pos + MSG_RESERVE_BYTES,
+                  cpb_buf_left(&frame->buf) - MSG_RESERVE_BYTES);
+
+    return CPB_ERR_OK;
+}
+
 /* Encoder */
 
 /**
@@ -130,6 +325,7 @@ static struct cpb_encoder_stack_frame *pop_stack_frame(struct cpb_encoder *encod
 void cpb_encoder_init(struct cpb_encoder *encoder)
 {
     encoder->depth = 0;
+    encoder->sink = NULL;
 }
 
 /**
@@ -147,20 +343,166 @@ void cpb_encoder_start(struct cpb_encoder *encoder,
 
     encoder->depth = 1;
     encoder->packed = 0;
+    encoder->sink = NULL;
+    encoder->hints = NULL;
+    encoder->num_hints = 0;
+    encoder->hint = 0;
+    encoder->pin = NO_PIN;
 
     cpb_buf_init(&frame->buf, data, len);
     frame->field_desc = NULL;
     frame->msg_desc = msg_desc;
+    frame->reserved = 0;
+    frame->len = 0;
+    frame->flushed = 0;
+}
+
+/**
+ * Starts encoding a message to a sink. The data buffer is used as a staging
+ * buffer. Encoded bytes are passed to the sink as soon as they can no longer
+ * change, that is when they do not precede the reserved length of an open
+ * nested message or packed repeated field. Use cpb_encoder_nested_start_len()
+ * to start nested messages of known length without reserving.
+ * @note String and bytes fields larger than the staging buffer are passed to
+ * the sink directly when no reserved length is open.
+ * @param encoder Encoder
+ * @param msg_desc Root message descriptor
+ * @param data Staging buffer
+ * @param len Length of staging buffer
+ * @param sink Output sink
+ * @param arg User argument of the sink
+ */
+void cpb_encoder_start_sink(struct cpb_encoder *encoder,
+                             const struct cpb_msg_desc *msg_desc,
+                             void *data, size_t len,
+                             cpb_encoder_sink_t sink, void *arg)
+{
+    cpb_encoder_start(encoder, msg_desc, data, len);
+    encoder->sink = sink;
+    encoder->sink_arg = arg;
+}
+
+/**
+ * Sets the sizes of the nested messages to be encoded, as computed by a
+ * cpb_sizer run over the same sequence of calls. cpb_encoder_nested_start()
+ * takes the next size and encodes the nested message in place, as
+ * cpb_encoder_nested_start_len() does. Once the sizes are exhausted, nested
+ * messages are encoded with a reserved length again. Must be called after
+ * cpb_encoder_start().
+ * @param encoder Encoder
+ * @param sizes Nested message sizes in order of cpb_encoder_nested_start()
+ * @param num_sizes Number of sizes, see cpb_sizer_num_sizes()
+ */
+void cpb_encoder_size_hints(struct cpb_encoder *encoder,
+                             const size_t *sizes, size_t num_sizes)
+{
+    encoder->hints = sizes;
+    encoder->num_hints = num_sizes;
+    encoder->hint = 0;
+}
+
+/**
+ * Flushes all encoded bytes that can no longer change to the sink. Must be
+ * called once the message is complete and all checkpoints are released.
+ * @param encoder Encoder
+ * @return Returns CPB_ERR_OK if successful or the error code of the sink.
+ */
+cpb_err_t cpb_encoder_flush(struct cpb_encoder *encoder)
+{
+    if (!encoder->sink)
+        return CPB_ERR_OK;
+
+    return flush(encoder);
+}
+
+/**
+ * Sink writing to a stdio stream.
+ * @param arg Stream (FILE *)
+ * @param data Encoded bytes
+ * @param len Number of bytes
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_IO on write errors.
+ */
+cpb_err_t cpb_encoder_file_sink(void *arg, const void *data, size_t len)
+{
+    if (fwrite(data, 1, len, (FILE *) arg) != len)
+        return CPB_ERR_IO;
+
+    return CPB_ERR_OK;
 }
 
 /**
  * Finishes encoding a message.
  * @param encoder Encoder
- * @return Returns the total size of the encoded message.
+ * @return Returns the total size of the encoded message, including the
+ * bytes passed to the sink.
  */
 size_t cpb_encoder_finish(struct cpb_encoder *encoder)
 {
-    return cpb_buf_used(&encoder->stack[0].buf);
+    return encoder->stack[0].flushed + cpb_buf_used(&encoder->stack[0].buf);
+}
+
+/**
+ * Records the encoder state, so that everything encoded afterwards can be
+ * dropped with cpb_encoder_rollback(). This allows to stop adding elements
+ * once the buffer is full, or to drop an optional trailing section, and still
+ * finish a valid message. Checkpoints nest and must be released in reverse
+ * order with cpb_encoder_rollback() or cpb_encoder_commit().
+ * @note When encoding to a sink, bytes after the oldest open checkpoint are
+ * kept in the staging buffer until it is released.
+ * @param encoder Encoder
+ * @param checkpoint Returns the checkpoint
+ */
+void cpb_encoder_checkpoint(struct cpb_encoder *encoder,
+                             struct cpb_encoder_checkpoint *checkpoint)
+{
+    CPB_ASSERT(encoder->depth > 0, "Checkpoints can only be taken inside a message");
+
+    checkpoint->depth = encoder->depth;
+    checkpoint->packed = encoder->packed;
+    checkpoint->hint = encoder->hint;
+    checkpoint->ofs = output_offset(encoder);
+    checkpoint->pin = encoder->pin;
+
+    if (encoder->pin == NO_PIN)
+        encoder->pin = checkpoint->ofs;
+}
+
+/**
+ * Drops everything encoded since a checkpoint and releases it. Nested messages
+ * and packed repeated fields started since are dropped as well. The message
+ * or packed repeated field that was current at the checkpoint must not have
+ * been ended since.
+ * @param encoder Encoder
+ * @param checkpoint Checkpoint
+ */
+void cpb_encoder_rollback(struct cpb_encoder *encoder,
+                           const struct cpb_encoder_checkpoint *checkpoint)
+{
+    struct cpb_encoder_stack_frame *frame;
+
+    CPB_ASSERT(encoder->depth >= checkpoint->depth,
+               "Message of the checkpoint has already ended");
+
+    encoder->depth = checkpoint->depth;
+    encoder->packed = checkpoint->packed;
+    encoder->hint = checkpoint->hint;
+
+    /* Nothing after the checkpoint has been flushed, dropped frames included */
+    frame = &encoder->stack[encoder->depth - 1];
+    frame->buf.pos = frame->buf.pos - (output_offset(encoder) - checkpoint->ofs);
+
+    encoder->pin = checkpoint->pin;
+}
+
+/**
+ * Keeps everything encoded since a checkpoint and releases it.
+ * @param encoder Encoder
+ * @param checkpoint Checkpoint
+ */
+void cpb_encoder_commit(struct cpb_encoder *encoder,
+                         const struct cpb_encoder_checkpoint *checkpoint)
+{
+    encoder->pin = checkpoint->pin;
 }
 
 /**
@@ -172,27 +514,73 @@ size_t cpb_encoder_finish(struct cpb_encoder *encoder)
 cpb_err_t cpb_encoder_nested_start(struct cpb_encoder *encoder,
                                      const struct cpb_field_desc *field_desc)
 {
+    cpb_err_t ret;
+
+    CPB_ASSERT(field_desc->opts.typ == CPB_MESSAGE, "Field is not a message");
+
+    /* Encode in place if the size is known from a sizing pass */
+    if (encoder->hint < encoder->num_hints) {
+        ret = cpb_encoder_nested_start_len(encoder, field_desc,
+                                           encoder->hints[encoder->hint]);
+        if (ret == CPB_ERR_OK)
+            encoder->hint++;
+        return ret;
+    }
+
+    return push_reserved_frame(encoder, field_desc, field_desc->msg_desc);
+}
+
+/**
+ * Starts encoding a nested message of known length. The key and length are
+ * written right away, so the nested message is encoded in place and never
+ * moved. cpb_encoder_nested_end() checks that exactly len bytes have been
+ * encoded.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor holding the nested message
+ * @param len Length of the encoded nested message
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_encoder_nested_start_len(struct cpb_encoder *encoder,
+                                         const struct cpb_field_desc *field_desc,
+                                         size_t len)
+{
+    cpb_err_t ret;
     struct cpb_encoder_stack_frame *frame, *new_frame;
+    u8_t *pos;
 
     CPB_ASSERT(field_desc->opts.typ == CPB_MESSAGE, "Field is not a message");
+    CPB_ASSERT(!encoder->packed, "Messages must not be nested in packed fields");
 
     /* Get parent frame */
     frame = &encoder->stack[encoder->depth - 1];
 
-    /* Create a new frame */
+    /* Check that field belongs to the current message */
+    if (!CPB_FIELD_IN_MSG(frame->msg_desc, field_desc))
+        return CPB_ERR_UNKNOWN_FIELD;
+
+    ret = ensure(encoder, cpb_varint_size(WT_STRING | (field_desc->number << 3)) +
+                          cpb_varint_size(len));
+    if (ret != CPB_ERR_OK)
+        return ret;
+
+    /* Write key and length */
+    pos = frame->buf.pos;
+    ret = encode_key(&frame->buf, field_desc, WT_STRING);
+    if (ret == CPB_ERR_OK)
+        ret = encode_varint(&frame->buf, len);
+    if (ret != CPB_ERR_OK) {
+        frame->buf.pos = pos;
+        return ret;
+    }
+
+    /* Create a new frame continuing the parent's buffer */
     new_frame = push_stack_frame(encoder);
     new_frame->field_desc = field_desc;
     new_frame->msg_desc = field_desc->msg_desc;
-
-    /*
-     * Reserve a few bytes for the field on the parent frame. This is where
-     * the field key (message) and the message length will be stored, once it
-     * is known.
-     */
-    if (cpb_buf_left(&frame->buf) < MSG_RESERVE_BYTES)
-        return CPB_ERR_END_OF_BUF;
-    cpb_buf_init(&new_frame->buf, frame->buf.pos + MSG_RESERVE_BYTES,
-                  cpb_buf_left(&frame->buf) - MSG_RESERVE_BYTES);
+    new_frame->reserved = 0;
+    new_frame->len = len;
+    new_frame->flushed = 0;
+    cpb_buf_init(&new_frame->buf, frame->buf.pos, cpb_buf_left(&frame->buf));
 
     return CPB_ERR_OK;
 }
@@ -200,22 +588,32 @@ cpb_err_t cpb_encoder_nested_start(struct cpb_encoder *encoder,
 /**
  * Ends encoding a nested message.
  * @param encoder Encoder
- * @return Returns CPB_ERR_OK if successful.
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_INVALID_FIELD if the
+ * length announced to cpb_encoder_nested_start_len() does not match.
  */
 cpb_err_t cpb_encoder_nested_end(struct cpb_encoder *encoder)
 {
-    struct cpb_encoder_stack_frame *frame;
+    struct cpb_encoder_stack_frame *frame, *parent;
     union cpb_value value;
 
     /* Get current frame */
     frame = &encoder->stack[encoder->depth - 1];
 
     /* Pop the stack */
-    pop_stack_frame(encoder);
+    parent = pop_stack_frame(encoder);
+
+    if (!frame->reserved) {
+        /* Key and length have already been written, continue after body */
+        parent->buf.pos = frame->buf.pos;
+        parent->flushed += frame->flushed;
+        if (frame->flushed + cpb_buf_used(&frame->buf) != frame->len)
+            return CPB_ERR_INVALID_FIELD;
+        return CPB_ERR_OK;
+    }
 
     value.message.data = frame->buf.base;
     value.message.len = cpb_buf_used(&frame->buf);
-    return cpb_encoder_add_field(encoder, frame->field_desc, &value);
+    return add_field(encoder, frame->field_desc, &value);
 }
 
 /**
@@ -227,30 +625,16 @@ cpb_err_t cpb_encoder_nested_end(struct cpb_encoder *encoder)
 cpb_err_t cpb_encoder_packed_repeated_start(struct cpb_encoder *encoder,
                                               const struct cpb_field_desc *field_desc)
 {
-    struct cpb_encoder_stack_frame *frame, *new_frame;
+    cpb_err_t ret;
 
     CPB_ASSERT(CPB_IS_PACKED_REPEATED(field_desc),
                 "Field is not repeated packed");
 
     CPB_ASSERT(!encoder->packed, "Packed repeated fields must not be nested");
 
-    /* Get parent frame */
-    frame = &encoder->stack[encoder->depth - 1];
-
-    /* Create a new frame */
-    new_frame = push_stack_frame(encoder);
-    new_frame->field_desc = field_desc;
-    new_frame->msg_desc = NULL;
-
-    /*
-     * Reserve a few bytes for the field on the parent frame. This is where
-     * the field key (type) and the message length will be stored, once it
-     * is known.
-     */
-    if (cpb_buf_left(&frame->buf) < MSG_RESERVE_BYTES)
-        return CPB_ERR_END_OF_BUF;
-    cpb_buf_init(&new_frame->buf, frame->buf.pos + MSG_RESERVE_BYTES,
-                  cpb_buf_left(&frame->buf) - MSG_RESERVE_BYTES);
+    ret = push_reserved_frame(encoder, field_desc, NULL);
+    if (ret != CPB_ERR_OK)
+        return ret;
 
     /* Enter packed repeated mode */
     encoder->packed = 1;
@@ -281,31 +665,25 @@ cpb_err_t cpb_encoder_packed_repeated_end(struct cpb_encoder *encoder)
 
     value.message.data = frame->buf.base;
     value.message.len = cpb_buf_used(&frame->buf);
-    return cpb_encoder_add_field(encoder, frame->field_desc, &value);
+    return add_field(encoder, frame->field_desc, &value);
 }
 
 /**
- * Encodes a field.
- * @note This method should not normally be used. Use the cpb_encoder_add_xxx()
- * methods to directly add a field of a given type.
+ * Encodes a field into the current frame.
  * @param encoder Encoder
  * @param field_desc Field descriptor of field to encode
  * @param value Field value
  * @return Returns CPB_ERR_OK if successful.
  */
-cpb_err_t cpb_encoder_add_field(struct cpb_encoder *encoder,
-                                  const struct cpb_field_desc *field_desc,
-                                  union cpb_value *value)
+static cpb_err_t add_field(struct cpb_encoder *encoder,
+                           const struct cpb_field_desc *field_desc,
+                           union cpb_value *value)
 {
     cpb_err_t ret;
     struct cpb_encoder_stack_frame *frame;
-    int i;
-    u64_t key;
     enum wire_type wire_type = 0;
     union wire_value wire_value;
 
-    CPB_ASSERT(encoder->depth > 0, "Fields can only be added inside a message");
-
     /* Get current frame */
     frame = &encoder->stack[encoder->depth - 1];
 
@@ -318,10 +696,7 @@ cpb_err_t cpb_encoder_add_field(struct cpb_encoder *encoder,
             return CPB_ERR_INVALID_FIELD;
     } else {
         /* Check that field belongs to the current message */
-        for (i = 0; i < frame->msg_desc->num_fields; i++)
-            if (field_desc == &frame->msg_desc->fields[i])
-                break;
-        if (i == frame->msg_desc->num_fields)
+        if (!CPB_FIELD_IN_MSG(frame->msg_desc, field_desc))
             return CPB_ERR_UNKNOWN_FIELD;
     }
 
@@ -411,8 +786,7 @@ cpb_err_t cpb_encoder_add_field(struct cpb_encoder *encoder,
             wire_value.string.len = value->message.len;
         }
 
-        key = wire_type | (field_desc->number << 3);
-        ret = encode_varint(&frame->buf, key);
+        ret = encode_key(&frame->buf, field_desc, wire_type);
         if (ret != CPB_ERR_OK)
             return ret;
     }
@@ -459,6 +833,394 @@ cpb_err_t cpb_encoder_add_field(struct cpb_encoder *encoder,
     return CPB_ERR_OK;
 }
 
+/**
+ * Passes final bytes that do not fit into the staging buffer directly to the
+ * sink, after flushing the staging buffer. Only possible if no reserved length
+ * is open, as the bytes must be final.
+ * @param encoder Encoder
+ * @param data Bytes to pass
+ * @param len Number of bytes
+ * @return Returns CPB_ERR_OK if successful, CPB_ERR_END_OF_BUF if the bytes
+ * cannot bypass the staging buffer or the error code of the sink.
+ */
+static cpb_err_t pass_direct(struct cpb_encoder *encoder,
+                             const void *data, size_t len)
+{
+    cpb_err_t ret;
+
+    ret = flush(encoder);
+    if (ret != CPB_ERR_OK)
+        return ret;
+
+    ret = encoder->sink(encoder->sink_arg, data, len);
+    if (ret != CPB_ERR_OK)
+        return ret;
+    encoder->stack[encoder->depth - 1].flushed += len;
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Checks whether bytes can be passed directly to the sink, see pass_direct().
+ * @param encoder Encoder
+ * @return Returns 1 if bytes can be passed directly, 0 otherwise.
+ */
+static cpb_bool_t can_pass_direct(struct cpb_encoder *encoder)
+{
+    int i;
+
+    if (!encoder->sink || encoder->packed || encoder->pin != NO_PIN)
+        return 0;
+
+    for (i = 1; i < encoder->depth; i++)
+        if (encoder->stack[i].reserved)
+            return 0;
+
+    return 1;
+}
+
+/**
+ * Passes a string, bytes or message field that does not fit into the staging
+ * buffer directly to the sink.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor of field to encode
+ * @param value Field value
+ * @return Returns CPB_ERR_OK if successful, CPB_ERR_END_OF_BUF if the field
+ * cannot bypass the staging buffer or the error code of the sink.
+ */
+static cpb_err_t add_direct(struct cpb_encoder *encoder,
+                            const struct cpb_field_desc *field_desc,
+                            union cpb_value *value)
+{
+    cpb_err_t ret;
+    struct cpb_encoder_stack_frame *frame;
+    const void *data;
+    size_t len;
+    u8_t *pos;
+
+    switch (field_desc->opts.typ) {
+    case CPB_STRING:
+        data = value->string.str;
+        len = value->string.len;
+        break;
+    case CPB_BYTES:
+        data = value->bytes.data;
+        len = value->bytes.len;
+        break;
+    case CPB_MESSAGE:
+        data = value->message.data;
+        len = value->message.len;
+        break;
+    default:
+        return CPB_ERR_END_OF_BUF;
+    }
+
+    if (!can_pass_direct(encoder))
+        return CPB_ERR_END_OF_BUF;
+
+    /* Get current frame */
+    frame = &encoder->stack[encoder->depth - 1];
+
+    /* Write key and length, then pass the payload on */
+    pos = frame->buf.pos;
+    ret = encode_key(&frame->buf, field_desc, WT_STRING);
+    if (ret == CPB_ERR_OK)
+        ret = encode_varint(&frame->buf, len);
+    if (ret != CPB_ERR_OK) {
+        frame->buf.pos = pos;
+        return ret;
+    }
+
+    return pass_direct(encoder, data, len);
+}
+
+/**
+ * Encodes a field.
+ * @note This method should not normally be used. Use the cpb_encoder_add_xxx()
+ * methods to directly add a field of a given type.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor of field to encode
+ * @param value Field value
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_encoder_add_field(struct cpb_encoder *encoder,
+                                  const struct cpb_field_desc *field_desc,
+                                  union cpb_value *value)
+{
+    cpb_err_t ret;
+    struct cpb_encoder_stack_frame *frame;
+    u8_t *pos;
+
+    CPB_ASSERT(encoder->depth > 0, "Fields can only be added inside a message");
+
+    /* Get current frame */
+    frame = &encoder->stack[encoder->depth - 1];
+
+    pos = frame->buf.pos;
+    ret = add_field(encoder, field_desc, value);
+    while (ret == CPB_ERR_END_OF_BUF && encoder->sink) {
+        /* Drop the partially encoded field, flush and try again */
+        frame->buf.pos = pos;
+        ret = make_room(encoder);
+        if (ret == CPB_ERR_END_OF_BUF)
+            return add_direct(encoder, field_desc, value);
+        if (ret != CPB_ERR_OK)
+            return ret;
+        pos = frame->buf.pos;
+        ret = add_field(encoder, field_desc, value);
+    }
+
+    /* Drop a partially encoded field, the encoder remains usable */
+    if (ret == CPB_ERR_END_OF_BUF)
+        frame->buf.pos = pos;
+
+    return ret;
+}
+
+/**
+ * Appends pre-encoded fields to the current message. The bytes are copied
+ * as they are and must hold complete fields, keys included, of the current
+ * message. Fragments that are the same in many messages can thus be encoded
+ * once, e.g. by encoding a nested message with a separate encoder, and then
+ * added with a single copy.
+ * @param encoder Encoder
+ * @param data Encoded fields
+ * @param len Length of encoded fields
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_END_OF_BUF if there
+ * was not enough space left in the memory buffer.
+ */
+cpb_err_t cpb_encoder_add_raw(struct cpb_encoder *encoder,
+                                const void *data, size_t len)
+{
+    cpb_err_t ret;
+    struct cpb_encoder_stack_frame *frame;
+
+    CPB_ASSERT(encoder->depth > 0, "Fields can only be added inside a message");
+    CPB_ASSERT(!encoder->packed, "Fields must not be added to packed fields");
+
+    ret = ensure(encoder, len);
+    if (ret == CPB_ERR_END_OF_BUF && can_pass_direct(encoder))
+        return pass_direct(encoder, data, len);
+    if (ret != CPB_ERR_OK)
+        return ret;
+
+    /* Get current frame */
+    frame = &encoder->stack[encoder->depth - 1];
+
+    if (len)
+        memcpy(frame->buf.pos, data, len);
+    frame->buf.pos += len;
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Returns the size of an array element of a packed repeated field, see
+ * cpb_packed_array_size() for the array element types.
+ * @param field_desc Field descriptor of packed repeated field
+ * @return Returns the element size.
+ */
+static size_t packed_elem_size(const struct cpb_field_desc *field_desc)
+{
+    switch (field_desc->opts.typ) {
+    case CPB_DOUBLE:
+    case CPB_FIXED64:
+    case CPB_SFIXED64:
+    case CPB_INT64:
+    case CPB_UINT64:
+    case CPB_SINT64:
+        return 8;
+    case CPB_BOOL:
+        return sizeof(cpb_bool_t);
+    case CPB_ENUM:
+        return sizeof(cpb_enum_t);
+    default:
+        return 4;
+    }
+}
+
+/**
+ * Encodes a packed repeated field that does not fit into the staging buffer.
+ * The key and length are written first, then the payload is encoded in runs
+ * of elements that fit and flushed to the sink in between.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor of packed repeated field
+ * @param array Array of values
+ * @param n Number of values
+ * @param len Payload size
+ * @return Returns CPB_ERR_OK if successful, CPB_ERR_END_OF_BUF if the
+ * staging buffer cannot hold a single element or the error code of the sink.
+ */
+static cpb_err_t add_packed_chunked(struct cpb_encoder *encoder,
+                                    const struct cpb_field_desc *field_desc,
+                                    const void *array, size_t n, size_t len)
+{
+    cpb_err_t ret;
+    struct cpb_encoder_stack_frame *frame;
+    const u8_t *elems = array;
+    size_t elem_size = packed_elem_size(field_desc);
+    size_t width = CPB_WIRE_TYPE(field_desc->opts.typ) == WT_64BIT ? 8 :
+                   CPB_WIRE_TYPE(field_desc->opts.typ) == WT_32BIT ? 4 : 0;
+    size_t left, size, count;
+    u8_t *pos;
+
+    ret = ensure(encoder, cpb_varint_size(WT_STRING | (field_desc->number << 3)) +
+                          cpb_varint_size(len));
+    if (ret != CPB_ERR_OK)
+        return ret;
+
+    frame = &encoder->stack[encoder->depth - 1];
+    ret = encode_key(&frame->buf, field_desc, WT_STRING);
+    if (ret != CPB_ERR_OK)
+        return ret;
+    frame->buf.pos += cpb_encode_varint(frame->buf.pos, len);
+
+    while (n > 0) {
+        /* Longest run of elements that fits */
+        left = cpb_buf_left(&frame->buf);
+        if (width) {
+            count = left / width;
+            if (count > n)
+                count = n;
+        } else {
+            size = 0;
+            for (count = 0; count < n; count++) {
+                size += cpb_packed_array_size(field_desc,
+                                              elems + count * elem_size, 1);
+                if (size > left)
+                    break;
+            }
+        }
+
+        if (count == 0) {
+            pos = frame->buf.pos;
+            ret = flush(encoder);
+            if (ret != CPB_ERR_OK)
+                return ret;
+            if (frame->buf.pos == pos)
+                return CPB_ERR_END_OF_BUF;
+            continue;
+        }
+
+        frame->buf.pos += cpb_encode_packed_array(frame->buf.pos, field_desc,
+                                                   elems, count);
+        elems += count * elem_size;
+        n -= count;
+    }
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Encodes a whole packed repeated field from an array of values. The size of
+ * the field is computed up front and the values are written in place, see
+ * cpb_packed_array_size() for the array element types. When encoding to a
+ * sink, a field larger than the staging buffer is flushed in pieces, unless
+ * it is inside a nested message of unknown length or after a checkpoint.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor of packed repeated field
+ * @param array Array of values
+ * @param n Number of values, nothing is encoded if 0
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_encoder_add_packed_array(struct cpb_encoder *encoder,
+                                         const struct cpb_field_desc *field_desc,
+                                         const void *array, size_t n)
+{
+    cpb_err_t ret;
+    struct cpb_encoder_stack_frame *frame;
+    size_t len;
+
+    CPB_ASSERT(encoder->depth > 0, "Fields can only be added inside a message");
+    CPB_ASSERT(CPB_IS_PACKED_REPEATED(field_desc),
+                "Field is not repeated packed");
+    CPB_ASSERT(!encoder->packed, "Packed repeated fields must not be nested");
+
+    /* Get current frame */
+    frame = &encoder->stack[encoder->depth - 1];
+
+    /* Check that field belongs to the current message */
+    if (!CPB_FIELD_IN_MSG(frame->msg_desc, field_desc))
+        return CPB_ERR_UNKNOWN_FIELD;
+
+    if (n == 0)
+        return CPB_ERR_OK;
+
+    len = cpb_packed_array_size(field_desc, array, n);
+    ret = ensure(encoder, cpb_varint_size(WT_STRING | (field_desc->number << 3)) +
+                          cpb_varint_size(len) + len);
+    if (ret == CPB_ERR_END_OF_BUF && can_pass_direct(encoder))
+        return add_packed_chunked(encoder, field_desc, array, n, len);
+    if (ret != CPB_ERR_OK)
+        return ret;
+
+    ret = encode_key(&frame->buf, field_desc, WT_STRING);
+    if (ret != CPB_ERR_OK)
+        return ret;
+    frame->buf.pos += cpb_encode_varint(frame->buf.pos, len);
+    frame->buf.pos += cpb_encode_packed_array(frame->buf.pos, field_desc,
+                                               array, n);
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Encodes a repeated field whose elements are produced by an iterator, so
+ * that they need not be collected in an array first. A packed repeated field
+ * is encoded with a reserved length, written once the iterator is exhausted,
+ * and is dropped as a whole if it does not fit. Other repeated fields are
+ * encoded element by element, elements that fit are kept. Message elements
+ * are produced as encoded messages.
+ * @note When encoding to a sink, a packed repeated field must fit into the
+ * staging buffer.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor of repeated field
+ * @param iter Iterator producing the elements
+ * @param arg User argument of the iterator
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_encoder_add_repeated(struct cpb_encoder *encoder,
+                                     const struct cpb_field_desc *field_desc,
+                                     cpb_encoder_iter_t iter, void *arg)
+{
+    cpb_err_t ret;
+    struct cpb_encoder_checkpoint checkpoint;
+    union cpb_value value;
+
+    CPB_ASSERT(field_desc->opts.label == CPB_REPEATED, "Field is not repeated");
+
+    /* Nothing is encoded for an empty field, not even a packed one */
+    if (!iter(arg, &value))
+        return CPB_ERR_OK;
+
+    if (!CPB_IS_PACKED_REPEATED(field_desc)) {
+        do {
+            ret = cpb_encoder_add_field(encoder, field_desc, &value);
+            if (ret != CPB_ERR_OK)
+                return ret;
+        } while (iter(arg, &value));
+        return CPB_ERR_OK;
+    }
+
+    cpb_encoder_checkpoint(encoder, &checkpoint);
+
+    ret = cpb_encoder_packed_repeated_start(encoder, field_desc);
+    while (ret == CPB_ERR_OK) {
+        ret = cpb_encoder_add_field(encoder, field_desc, &value);
+        if (ret == CPB_ERR_OK && !iter(arg, &value)) {
+            ret = cpb_encoder_packed_repeated_end(encoder);
+            break;
+        }
+    }
+
+    if (ret != CPB_ERR_OK)
+        cpb_encoder_rollback(encoder, &checkpoint);
+    else
+        cpb_encoder_commit(encoder, &checkpoint);
+
+    return ret;
+}
+
 /**
  * Encodes a field of type 'double'.
  * @param encoder Encoder
@@ -622,3 +1384,25 @@ cpb_err_t cpb_encoder_add_bytes(struct cpb_encoder *encoder,
     value.string.len = len;
     return cpb_encoder_add_field(encoder, field_desc, &value);
 }
+
+/**
+ * Encodes a field of type 'message' from an encoded message. Only the key and
+ * the length are encoded, the message is copied as it is.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor of field to encode
+ * @param data Encoded message
+ * @param len Length of encoded message
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_encoder_add_message(struct cpb_encoder *encoder,
+                                    const struct cpb_field_desc *field_desc,
+                                    const void *data, size_t len)
+{
+    union cpb_value value;
+
+    CPB_ASSERT(field_desc->opts.typ == CPB_MESSAGE, "Field is not a message");
+
+    value.message.data = (void *) data;
+    value.message.len = len;
+    return cpb_encoder_add_field(encoder, field_desc, &value);
+}
@@ -23,34 +23,84 @@
 
 /* Encoder utilities */
 
+/**
+ * Returns the number of bytes needed to encode a variable integer.
+ * @param varint Value to encode
+ * @return Returns the encoded size in bytes (1 to 10).
+ */
+size_t cpb_varint_size(u64_t varint)
+{
+#ifdef CPB_CLZ64
+    /* Significant bits rounded up to 7 bit groups, (bits * 9 + 64) / 64 */
+    return (size_t) ((64 - CPB_CLZ64(varint | 1)) * 9 + 64) >> 6;
+#else
+    size_t len = 1;
+
+    while (varint > 127) {
+        varint >>= 7;
+        len++;
+    }
+
+    return len;
+#endif
+}
+
 /**
  * Encodes a variable integer in base-128 format.
  * See http://code.google.com/apis/protocolbuffers/docs/encoding.html for more
  * information.
- * @param buf Memory buffer
+ * @note The caller must make sure that cpb_varint_size() bytes are available
+ * at buf, no bounds checking is done.
+ * @param buf Memory buffer or NULL to only compute the size
  * @param varint Value to encode
- * @return Returns CPB_ERR_OK if successful or CPB_ERR_END_OF_BUF if there
- * was not enough space left in the memory buffer.
+ * @return Returns the number of bytes encoded.
  */
 size_t cpb_encode_varint(u8_t *buf, u64_t varint)
 {
-    size_t len = 0;
+    size_t len = cpb_varint_size(varint);
 
-    do {
-        if (buf) {
-            if (varint > 127) {
-                *buf++ = 0x80 | (varint & 0x7F);
-            } else {
-                *buf++ = (varint & 0x7F);
-            }
-        }
-        varint >>= 7;
-        len++;
-    } while (varint);
+    if (!buf)
+        return len;
+
+    /* Emit the continuation bytes unrolled, falling through to the last one */
+    switch (len) {
+    case 10: *buf++ = (u8_t) (varint | 0x80); varint >>= 7;
+    case 9:  *buf++ = (u8_t) (varint | 0x80); varint >>= 7;
+    case 8:  *buf++ = (u8_t) (varint | 0x80); varint >>= 7;
+    case 7:  *buf++ = (u8_t) (varint | 0x80); varint >>= 7;
+    case 6:  *buf++ = (u8_t) (varint | 0x80); varint >>= 7;
+    case 5:  *buf++ = (u8_t) (varint | 0x80); varint >>= 7;
+    case 4:  *buf++ = (u8_t) (varint | 0x80); varint >>= 7;
+    case 3:  *buf++ = (u8_t) (varint | 0x80); varint >>= 7;
+    case 2:  *buf++ = (u8_t) (varint | 0x80); varint >>= 7;
+    default: *buf = (u8_t) varint;
+    }
 
     return len;
 }
 
+/**
+ * Encodes a variable integer padded to a given width. Padded varints are
+ * valid, which allows to keep the width of a length prefix written before the
+ * length was known.
+ * @param buf Memory buffer
+ * @param varint Value to encode
+ * @param width Number of bytes to encode, at least cpb_varint_size(varint)
+ * @return Returns the number of bytes encoded.
+ */
+size_t cpb_encode_varint_width(u8_t *buf, u64_t varint, size_t width)
+{
+    size_t i;
+
+    for (i = 0; i + 1 < width; i++) {
+        buf[i] = (u8_t) (varint & 0x7f) | 0x80;
+        varint >>= 7;
+    }
+    buf[i] = (u8_t) varint;
+
+    return width;
+}
+
 /**
  * Encodes a 32 bit integer.
  * @param buf Memory buffer
@@ -98,6 +148,236 @@ size_t cpb_encode_64bit(u8_t *buf, u64_t value)
     return len;
 }
 
+/** Zig-zag encodes a 32 bit integer */
+#define ZIGZAG32(_v_) ((u32_t) (((u32_t) (_v_) << 1) ^ (u32_t) ((_v_) >> 31)))
+
+/** Zig-zag encodes a 64 bit integer */
+#define ZIGZAG64(_v_) ((u64_t) (((u64_t) (_v_) << 1) ^ (u64_t) ((_v_) >> 63)))
+
+/**
+ * Returns the payload size of a packed repeated field. The array holds
+ * elements of the C type matching the field type: double, float, s32_t
+ * (int32, sint32, sfixed32), u32_t (uint32, fixed32), s64_t (int64, sint64,
+ * sfixed64), u64_t (uint64, fixed64), cpb_bool_t or cpb_enum_t.
+ * @param field_desc Field descriptor of packed repeated field
+ * @param array Array of values
+ * @param n Number of values
+ * @return Returns the payload size in bytes, excluding key and length.
+ */
+size_t cpb_packed_array_size(const struct cpb_field_desc *field_desc,
+                             const void *array, size_t n)
+{
+    size_t i, len = 0;
+
+    switch (field_desc->opts.typ) {
+    case CPB_DOUBLE:
+    case CPB_FIXED64:
+    case CPB_SFIXED64:
+        return n * 8;
+    case CPB_FLOAT:
+    case CPB_FIXED32:
+    case CPB_SFIXED32:
+        return n * 4;
+    case CPB_INT32:
+        for (i = 0; i < n; i++)
+            len += cpb_varint_size((u64_t) ((const s32_t *) array)[i]);
+        break;
+    case CPB_UINT32:
+        for (i = 0; i < n; i++)
+            len += cpb_varint_size(((const u32_t *) array)[i]);
+        break;
+    case CPB_SINT32:
+        for (i = 0; i < n; i++)
+            len += cpb_varint_size(ZIGZAG32(((const s32_t *) array)[i]));
+        break;
+    case CPB_INT64:
+        for (i = 0; i < n; i++)
+            len += cpb_varint_size((u64_t) ((const s64_t *) array)[i]);
+        break;
+    case CPB_UINT64:
+        for (i = 0; i < n; i++)
+            len += cpb_varint_size(((const u64_t *) array)[i]);
+        break;
+    case CPB_SINT64:
+        for (i = 0; i < n; i++)
+            len += cpb_varint_size(ZIGZAG64(((const s64_t *) array)[i]));
+        break;
+    case CPB_BOOL:
+        for (i = 0; i < n; i++)
+            len += cpb_varint_size((u64_t) ((const cpb_bool_t *) array)[i]);
+        break;
+    case CPB_ENUM:
+        for (i = 0; i < n; i++)
+            len += cpb_varint_size((u64_t) ((const cpb_enum_t *) array)[i]);
+        break;
+    default:
+        CPB_FAIL("Field type cannot be packed");
+        break;
+    }
+
+    return len;
+}
+
+/**
+ * Encodes the payload of a packed repeated field, see cpb_packed_array_size()
+ * for the array element types.
+ * @note The caller must make sure that cpb_packed_array_size() bytes are
+ * available at buf, no bounds checking is done.
+ * @param buf Memory buffer
+ * @param field_desc Field descriptor of packed repeated field
+ * @param array Array of values
+ * @param n Number of values
+ * @return Returns the number of bytes encoded.
+ */
+size_t cpb_encode_packed_array(u8_t *buf,
+                               const struct cpb_field_desc *field_desc,
+                               const void *array, size_t n)
+{
+    u8_t *pos = buf;
+    size_t i;
+
+    switch (field_desc->opts.typ) {
+    case CPB_DOUBLE:
+    case CPB_FIXED64:
+    case CPB_SFIXED64:
+#if CPB_LITTLE_ENDIAN
+        memcpy(pos, array, n * 8);
+        pos += n * 8;
+#else
+        for (i = 0; i < n; i++) {
+            u64_t value;
+            memcpy(&value, (const u8_t *) array + i * 8, 8);
+            pos += cpb_encode_64bit(pos, value);
+        }
+#endif
+        break;
+    case CPB_FLOAT:
+    case CPB_FIXED32:
+    case CPB_SFIXED32:
+#if CPB_LITTLE_ENDIAN
+        memcpy(pos, array, n * 4);
+        pos += n * 4;
+#else
+        for (i = 0; i < n; i++) {
+            u32_t value;
+            memcpy(&value, (const u8_t *) array + i * 4, 4);
+            pos += cpb_encode_32bit(pos, value);
+        }
+#endif
+        break;
+    case CPB_INT32:
+        for (i = 0; i < n; i++)
+            pos += cpb_encode_varint(pos, (u64_t) ((const s32_t *) array)[i]);
+        break;
+    case CPB_UINT32:
+        for (i = 0; i < n; i++)
+            pos += cpb_encode_varint(pos, ((const u32_t *) array)[i]);
+        break;
+    case CPB_SINT32:
+        for (i = 0; i < n; i++)
+            pos += cpb_encode_varint(pos, ZIGZAG32(((const s32_t *) array)[i]));
+        break;
+    case CPB_INT64:
+        for (i = 0; i < n; i++)
+            pos += cpb_encode_varint(pos, (u64_t) ((const s64_t *) array)[i]);
+        break;
+    case CPB_UINT64:
+        for (i = 0; i < n; i++)
+            pos += cpb_encode_varint(pos, ((const u64_t *) array)[i]);
+        break;
+    case CPB_SINT64:
+        for (i = 0; i < n; i++)
+            pos += cpb_encode_varint(pos, ZIGZAG64(((const s64_t *) array)[i]));
+        break;
+    case CPB_BOOL:
+        for (i = 0; i < n; i++)
+            pos += cpb_encode_varint(pos, (u64_t) ((const cpb_bool_t *) array)[i]);
+        break;
+    case CPB_ENUM:
+        for (i = 0; i < n; i++)
+            pos += cpb_encode_varint(pos, (u64_t) ((const cpb_enum_t *) array)[i]);
+        break;
+    default:
+        CPB_FAIL("Field type cannot be packed");
+        break;
+    }
+
+    return pos - buf;
+}
+
+/**
+ * Converts a field value to its wire representation.
+ * @param field_desc Field descriptor
+ * @param value Field value
+ * @param wire_value Wire value to convert into
+ * @return Returns the wire type of the field.
+ */
+enum wire_type cpb_value_to_wire(const struct cpb_field_desc *field_desc,
+                                 const union cpb_value *value,
+                                 union wire_value *wire_value)
+{
+    switch (field_desc->opts.typ) {
+    case CPB_DOUBLE:
+        memcpy(&wire_value->int64, &value->double_, sizeof(double));
+        return WT_64BIT;
+    case CPB_FLOAT:
+        memcpy(&wire_value->int32, &value->float_, sizeof(float));
+        return WT_32BIT;
+    case CPB_INT32:
+        wire_value->varint = value->int32;
+        return WT_VARINT;
+    case CPB_UINT32:
+        wire_value->varint = value->uint32;
+        return WT_VARINT;
+    case CPB_SINT32:
+        /* Zig-zag encoding */
+        wire_value->varint = (u32_t) ((value->int32 << 1) ^ (value->int32 >> 31));
+        return WT_VARINT;
+    case CPB_INT64:
+        wire_value->varint = value->int64;
+        return WT_VARINT;
+    case CPB_UINT64:
+        wire_value->varint = value->uint64;
+        return WT_VARINT;
+    case CPB_SINT64:
+        /* Zig-zag encoding */
+        wire_value->varint = (u64_t) ((value->int64 << 1) ^ (value->int64 >> 63));
+        return WT_VARINT;
+    case CPB_FIXED32:
+        wire_value->int32 = value->uint32;
+        return WT_32BIT;
+    case CPB_FIXED64:
+        wire_value->int64 = value->uint64;
+        return WT_64BIT;
+    case CPB_SFIXED32:
+        wire_value->int32 = value->int32;
+        return WT_32BIT;
+    case CPB_SFIXED64:
+        wire_value->int64 = value->int64;
+        return WT_64BIT;
+    case CPB_BOOL:
+        wire_value->varint = value->bool;
+        return WT_VARINT;
+    case CPB_ENUM:
+        wire_value->varint = value->enum_;
+        return WT_VARINT;
+    case CPB_STRING:
+        wire_value->string.data = value->string.str;
+        wire_value->string.len = value->string.len;
+        return WT_STRING;
+    case CPB_BYTES:
+        wire_value->string.data = value->bytes.data;
+        wire_value->string.len = value->bytes.len;
+        return WT_STRING;
+    case CPB_MESSAGE:
+        wire_value->string.data = value->message.data;
+        wire_value->string.len = value->message.len;
+        return WT_STRING;
+    default:
+        return WT_ERROR;
+    }
+}
+
 /* Encoder */
 
 /**
@@ -165,87 +445,16 @@ size_t cpb_encoder2_add_field(struct cpb_encoder2 *encoder,
     size_t len = 0;
     size_t size = 0;
     u64_t key;
-    enum wire_type wire_type = 0;
+    enum wire_type wire_type;
     union wire_value wire_value;
+#if CPB_FIELD_TAGS
+    const struct cpb_field_tag *tag;
+#endif
 
 /* TODO ASSERT that we are not repeat packing a non-numeric type */
 
     /* Encode wire value */
-    switch (field_desc->opts.typ) {
-    case CPB_DOUBLE:
-        wire_type = WT_64BIT;
-        memcpy(&wire_value.int64, &value->double_, sizeof(double));
-        break;
-    case CPB_FLOAT:
-        wire_type = WT_32BIT;
-        memcpy(&wire_value.int32, &value->float_, sizeof(float));
-        break;
-    case CPB_INT32:
-        wire_type = WT_VARINT;
-        wire_value.varint = value->int32;
-        break;
-    case CPB_UINT32:
-        wire_type = WT_VARINT;
-        wire_value.varint = value->uint32;
-        break;
-    case CPB_SINT32:
-        /* Zig-zag encoding */
-        wire_type = WT_VARINT;
-        wire_value.varint = (u32_t) ((value->int32 << 1) ^ (value->int32 >> 31));
-        break;
-    case CPB_INT64:
-        wire_type = WT_VARINT;
-        wire_value.varint = value->int64;
-        break;
-    case CPB_UINT64:
-        wire_type = WT_VARINT;
-        wire_value.varint = value->uint64;
-        break;
-    case CPB_SINT64:
-        /* Zig-zag encoding */
-        wire_type = WT_VARINT;
-        wire_value.varint = (u64_t) ((value->int64 << 1) ^ (value->int64 >> 63));
-        break;
-    case CPB_FIXED32:
-        wire_type = WT_32BIT;
-        wire_value.int32 = value->uint32;
-        break;
-    case CPB_FIXED64:
-        wire_type = WT_64BIT;
-        wire_value.int64 = value->uint64;
-        break;
-    case CPB_SFIXED32:
-        wire_type = WT_32BIT;
-        wire_value.int32 = value->int32;
-        break;
-    case CPB_SFIXED64:
-        wire_type = WT_64BIT;
-        wire_value.int64 = value->int64;
-        break;
-    case CPB_BOOL:
-        wire_type = WT_VARINT;
-        wire_value.varint = value->bool;
-        break;
-    case CPB_ENUM:
-        wire_type = WT_VARINT;
-        wire_value.varint = value->enum_;
-        break;
-    case CPB_STRING:
-        wire_type = WT_STRING;
-        wire_value.string.data = value->string.str;
-        wire_value.string.len = value->string.len;
-        break;
-    case CPB_BYTES:
-        wire_type = WT_STRING;
-        wire_value.string.data = value->bytes.data;
-        wire_value.string.len = value->bytes.len;
-        break;
-    case CPB_MESSAGE:
-        wire_type = WT_STRING;
-        wire_value.string.data = value->message.data;
-        wire_value.string.len = value->message.len;
-        break;
-    }
+    wire_type = cpb_value_to_wire(field_desc, value, &wire_value);
 
     /* Don't output wire key in packed mode */
     if (!encoder->packed) {
@@ -256,8 +465,20 @@ size_t cpb_encoder2_add_field(struct cpb_encoder2 *encoder,
             wire_value.string.len = value->message.len;
         }
 
-        key = wire_type | (field_desc->number << 3);
-        size = cpb_encode_varint(buf, key);
+        size = 0;
+#if CPB_FIELD_TAGS
+        /* Copy the pre-encoded tag if available */
+        tag = CPB_IS_PACKED_REPEATED(field_desc) ? &field_desc->packed_tag :
+                                                    &field_desc->tag;
+        if (tag->len) {
+            size = tag->len;
+            if (buf) memcpy(buf, tag->bytes, size);
+        }
+#endif
+        if (!size) {
+            key = wire_type | (field_desc->number << 3);
+            size = cpb_encode_varint(buf, key);
+        }
         len += size;
         if (buf) buf += size;
     }
@@ -306,3 +527,236 @@ size_t cpb_encoder2_add_field(struct cpb_encoder2 *encoder,
     return len;
 }
 
+
+/* Sizer */
+
+/**
+ * Initializes the sizer.
+ * @param sizer Sizer
+ * @param sizes Array receiving the sizes of nested messages or NULL
+ * @param num_sizes Number of entries in the array
+ */
+void cpb_sizer_init(struct cpb_sizer *sizer, size_t *sizes, size_t num_sizes)
+{
+    sizer->depth = 0;
+    sizer->sizes = sizes;
+    sizer->num_sizes = sizes ? num_sizes : 0;
+    sizer->count = 0;
+}
+
+/**
+ * Starts sizing a message.
+ * @param sizer Sizer
+ * @param msg_desc Root message descriptor
+ */
+void cpb_sizer_start(struct cpb_sizer *sizer,
+                      const struct cpb_msg_desc *msg_desc)
+{
+    struct cpb_sizer_stack_frame *frame = &sizer->stack[0];
+
+    cpb_encoder2_init(&sizer->encoder);
+    cpb_encoder2_start(&sizer->encoder, msg_desc);
+
+    sizer->depth = 1;
+    sizer->count = 0;
+
+    frame->len = 0;
+    frame->slot = 0;
+    frame->field_desc = NULL;
+    frame->msg_desc = msg_desc;
+}
+
+/**
+ * Finishes sizing a message.
+ * @param sizer Sizer
+ * @return Returns the exact encoded size of the message.
+ */
+size_t cpb_sizer_finish(struct cpb_sizer *sizer)
+{
+    return sizer->stack[0].len;
+}
+
+/**
+ * Returns the number of nested message sizes stored in the size cache. Only
+ * the sizes of the first nested messages are stored if the cache is too small.
+ * @param sizer Sizer
+ * @return Returns the number of valid entries in the size cache.
+ */
+size_t cpb_sizer_num_sizes(struct cpb_sizer *sizer)
+{
+    return sizer->count < sizer->num_sizes ? sizer->count : sizer->num_sizes;
+}
+
+/**
+ * Pushes a sizer stack frame.
+ * @param sizer Sizer
+ * @param field_desc Field descriptor
+ * @param msg_desc Message descriptor or NULL for packed repeated fields
+ * @return Returns CPB_ERR_OK if successful.
+ */
+static cpb_err_t push_sizer_frame(struct cpb_sizer *sizer,
+                                  const struct cpb_field_desc *field_desc,
+                                  const struct cpb_msg_desc *msg_desc)
+{
+    struct cpb_sizer_stack_frame *frame;
+
+    /* Check that field belongs to the current message */
+    if (!CPB_FIELD_IN_MSG(sizer->stack[sizer->depth - 1].msg_desc, field_desc))
+        return CPB_ERR_UNKNOWN_FIELD;
+
+    sizer->depth++;
+    CPB_ASSERT(sizer->depth <= CPB_MAX_DEPTH, "Message nesting too deep");
+
+    frame = &sizer->stack[sizer->depth - 1];
+    frame->len = 0;
+    frame->slot = msg_desc ? sizer->count++ : (size_t) -1;
+    frame->field_desc = field_desc;
+    frame->msg_desc = msg_desc;
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Pops a sizer stack frame and adds the length-delimited field to its parent.
+ * @param sizer Sizer
+ * @return Returns CPB_ERR_OK if successful.
+ */
+static cpb_err_t pop_sizer_frame(struct cpb_sizer *sizer)
+{
+    struct cpb_sizer_stack_frame *frame;
+    union cpb_value value;
+
+    frame = &sizer->stack[sizer->depth - 1];
+    sizer->depth--;
+    CPB_ASSERT(sizer->depth > 0, "Message nesting too shallow");
+
+    if (frame->slot < sizer->num_sizes)
+        sizer->sizes[frame->slot] = frame->len;
+
+    value.message.data = NULL;
+    value.message.len = frame->len;
+    sizer->stack[sizer->depth - 1].len +=
+        cpb_encoder2_add_field(&sizer->encoder, frame->field_desc, &value, NULL);
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Starts sizing a nested message.
+ * @param sizer Sizer
+ * @param field_desc Field descriptor holding the nested message
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_sizer_nested_start(struct cpb_sizer *sizer,
+                                   const struct cpb_field_desc *field_desc)
+{
+    CPB_ASSERT(field_desc->opts.typ == CPB_MESSAGE, "Field is not a message");
+    CPB_ASSERT(!sizer->encoder.packed, "Messages must not be nested in packed fields");
+
+    return push_sizer_frame(sizer, field_desc, field_desc->msg_desc);
+}
+
+/**
+ * Ends sizing a nested message.
+ * @param sizer Sizer
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_sizer_nested_end(struct cpb_sizer *sizer)
+{
+    return pop_sizer_frame(sizer);
+}
+
+/**
+ * Starts sizing a packed repeated field.
+ * @param sizer Sizer
+ * @param field_desc Field descriptor of packed repeated field
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_sizer_packed_repeated_start(struct cpb_sizer *sizer,
+                                            const struct cpb_field_desc *field_desc)
+{
+    cpb_err_t ret;
+
+    ret = push_sizer_frame(sizer, field_desc, NULL);
+    if (ret != CPB_ERR_OK)
+        return ret;
+
+    return cpb_encoder2_packed_repeated_start(&sizer->encoder, field_desc);
+}
+
+/**
+ * Ends sizing a packed repeated field.
+ * @param sizer Sizer
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_sizer_packed_repeated_end(struct cpb_sizer *sizer)
+{
+    cpb_encoder2_packed_repeated_end(&sizer->encoder);
+
+    return pop_sizer_frame(sizer);
+}
+
+/**
+ * Adds the size of a field.
+ * @param sizer Sizer
+ * @param field_desc Field descriptor of field
+ * @param value Field value
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_UNKNOWN_FIELD if the
+ * field does not belong to the current message.
+ */
+cpb_err_t cpb_sizer_add_field(struct cpb_sizer *sizer,
+                                const struct cpb_field_desc *field_desc,
+                                union cpb_value *value)
+{
+    struct cpb_sizer_stack_frame *frame = &sizer->stack[sizer->depth - 1];
+
+    if (!sizer->encoder.packed && !CPB_FIELD_IN_MSG(frame->msg_desc, field_desc))
+        return CPB_ERR_UNKNOWN_FIELD;
+
+    frame->len += cpb_encoder2_add_field(&sizer->encoder, field_desc, value, NULL);
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Adds the size of pre-encoded fields, see cpb_encoder_add_raw().
+ * @param sizer Sizer
+ * @param len Length of encoded fields
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_sizer_add_raw(struct cpb_sizer *sizer, size_t len)
+{
+    CPB_ASSERT(!sizer->encoder.packed, "Fields must not be added to packed fields");
+
+    sizer->stack[sizer->depth - 1].len += len;
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Adds the size of a complete packed repeated field, see
+ * cpb_encoder_add_packed_array().
+ * @param sizer Sizer
+ * @param field_desc Field descriptor of packed repeated field
+ * @param array Array of values
+ * @param n Number of values
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_UNKNOWN_FIELD if the
+ * field does not belong to the current message.
+ */
+cpb_err_t cpb_sizer_add_packed_array(struct cpb_sizer *sizer,
+                                       const struct cpb_field_desc *field_desc,
+                                       const void *array, size_t n)
+{
+    union cpb_value value;
+
+    CPB_ASSERT(CPB_IS_PACKED_REPEATED(field_desc), "Field is not repeated packed");
+    CPB_ASSERT(!sizer->encoder.packed, "Packed repeated fields must not be nested");
+
+    if (!n)
+        return CPB_ERR_OK;
+
+    value.message.data = NULL;
+    value.message.len = cpb_packed_array_size(field_desc, array, n);
+
+    return cpb_sizer_add_field(sizer, field_desc, &value);
+}
@@ -0,0 +1,276 @@
+/** @file merge.c
+ *
+ * Implementation of wire-level message merging.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cpb/cpb.h>
+#include <cpb/core/encoder2.h>
+#include <cpb/utils/merge.h>
+
+#include "private.h"
+
+
+/** Length-delimited field along a splice path */
+struct path_field {
+    size_t len_pos;             /**< Offset of the length prefix */
+    size_t body;                /**< Offset of the body */
+    size_t len;                 /**< Length of the body */
+    size_t width;               /**< Width of the new length prefix */
+};
+
+/**
+ * Encodes the key of a length-delimited field, copying the pre-encoded tag if
+ * available.
+ * @param buf Memory buffer or NULL to only compute the size
+ * @param field_desc Field descriptor
+ * @return Returns the size of the key.
+ */
+static size_t encode_key(u8_t *buf, const struct cpb_field_desc *field_desc)
+{
+#if CPB_FIELD_TAGS
+    if (field_desc->tag.len) {
+        if (buf)
+            memcpy(buf, field_desc->tag.bytes, field_desc->tag.len);
+        return field_desc->tag.len;
+    }
+#endif
+
+    return cpb_encode_varint(buf, WT_STRING | (field_desc->number << 3));
+}
+
+/**
+ * Finds the last occurrence of a length-delimited field in an encoded message.
+ * @param msg Encoded message
+ * @param start Offset of the first field to scan
+ * @param end Offset of the end of the fields to scan
+ * @param number Field number
+ * @param field Returns the location of the field
+ * @param found Returns whether the field was found
+ * @return Returns CPB_ERR_OK if successful, CPB_ERR_END_OF_BUF if the message
+ * is truncated or CPB_ERR_INVALID_WIRE_TYPE if it contains invalid data.
+ */
+static cpb_err_t find_field(const u8_t *msg, size_t start, size_t end,
+                            u32_t number, struct path_field *field,
+                            cpb_bool_t *found)
+{
+    struct cpb_buf buf;
+    cpb_err_t ret;
+    u64_t key;
+    u64_t len;
+
+    *found = 0;
+    buf.base = buf.pos = (u8_t *) msg + start;
+    buf.end = (u8_t *) msg + end;
+
+    while (buf.pos < buf.end) {
+        ret = cpb_decode_varint(&buf, &key);
+        if (ret != CPB_ERR_OK)
+            return ret;
+
+        if ((key & 0x07) != WT_STRING || (key >> 3) != number) {
+            ret = cpb_skip_field(&buf, key & 0x07, key >> 3);
+            if (ret != CPB_ERR_OK)
+                return ret;
+            continue;
+        }
+
+        field->len_pos = buf.pos - msg;
+        ret = cpb_decode_varint(&buf, &len);
+        if (ret != CPB_ERR_OK)
+            return ret;
+        if (len > cpb_buf_left(&buf))
+            return CPB_ERR_END_OF_BUF;
+        field->body = buf.pos - msg;
+        field->len = len;
+        *found = 1;
+        buf.pos += len;
+    }
+
+    return CPB_ERR_OK;
+}
+
+
+/* Merging */
+
+/**
+ * Concatenates encoded messages of the same type. By protocol buffers
+ * semantics, the result is the merge of all messages: singular scalar fields
+ * take the last value, singular messages are merged and repeated fields are
+ * appended.
+ * @note The first message may already be at the start of the data buffer, the
+ * other messages are then appended to it.
+ * @param iov Encoded messages
+ * @param iovcnt Number of encoded messages
+ * @param data Data buffer to write into
+ * @param len Length of data buffer
+ * @param used Returns the length of the merged message when not NULL.
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_END_OF_BUF if the data
+ * buffer is too small.
+ */
+cpb_err_t cpb_merge_concat(const struct cpb_iovec *iov, int iovcnt,
+                             void *data, size_t len, size_t *used)
+{
+    size_t total = 0;
+    size_t pos;
+    int i;
+
+    for (i = 0; i < iovcnt; i++)
+        total += iov[i].len;
+    if (total > len)
+        return CPB_ERR_END_OF_BUF;
+
+    /* Back to front, so the first message may already be in place */
+    pos = total;
+    for (i = iovcnt - 1; i >= 0; i--) {
+        pos -= iov[i].len;
+        if (iov[i].len)
+            memmove((u8_t *) data + pos, iov[i].base, iov[i].len);
+    }
+
+    if (used)
+        *used = total;
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Splices an encoded field value into a nested message of an encoded message.
+ * The path lists the message fields leading from the root message to the
+ * nested message, followed by the field to add. The value is appended as a
+ * new occurrence of the last field to the last occurrence of each message
+ * along the path, messages missing from the path are created. For a message
+ * field, this merges the value into a singular field and adds an element to a
+ * repeated field.
+ *
+ * The message is not decoded. Only the fields along the path are scanned and
+ * only their length prefixes are rewritten, everything else is moved as is.
+ * A length prefix keeps its width unless the new length needs more bytes.
+ * @note The data buffer may be the message buffer itself to splice in place.
+ * @param msg_desc Message descriptor of the root message
+ * @param msg Encoded root message
+ * @param msg_len Length of encoded root message
+ * @param path Fields from the root message to the field to add
+ * @param depth Number of fields in the path
+ * @param sub Encoded value of the field to add, without key and length
+ * @param sub_len Length of the encoded value
+ * @param data Data buffer to write into
+ * @param len Length of data buffer
+ * @param used Returns the length of the resulting message when not NULL.
+ * @return Returns CPB_ERR_OK if successful, CPB_ERR_UNKNOWN_FIELD if the path
+ * does not match the message types, CPB_ERR_END_OF_BUF if the data buffer is
+ * too small or the message is truncated or CPB_ERR_INVALID_WIRE_TYPE if the
+ * message contains invalid data.
+ */
+cpb_err_t cpb_merge_splice(const struct cpb_msg_desc *msg_desc,
+                             const void *msg, size_t msg_len,
+                             const struct cpb_field_desc * const *path, int depth,
+                             const void *sub, size_t sub_len,
+                             void *data, size_t len, size_t *used)
+{
+    struct path_field fields[CPB_MAX_DEPTH];
+    const u8_t *src = msg;
+    u8_t *dst = data;
+    u8_t *p;
+    size_t start = 0;
+    size_t end = msg_len;
+    size_t add, grow, shift, width, pos;
+    cpb_bool_t hit;
+    cpb_err_t ret;
+    int found = 0;
+    int i;
+
+    CPB_ASSERT(depth > 0 && depth <= CPB_MAX_DEPTH, "Invalid path depth");
+    CPB_ASSERT(path[depth - 1]->opts.typ == CPB_MESSAGE ||
+               path[depth - 1]->opts.typ == CPB_STRING ||
+               path[depth - 1]->opts.typ == CPB_BYTES,
+               "Field is not length-delimited");
+
+    /* Check that the path follows the message types */
+    for (i = 0; i < depth; i++) {
+        if (!CPB_FIELD_IN_MSG(msg_desc, path[i]))
+            return CPB_ERR_UNKNOWN_FIELD;
+        if (i < depth - 1) {
+            CPB_ASSERT(path[i]->opts.typ == CPB_MESSAGE, "Field is not a message");
+            msg_desc = path[i]->msg_desc;
+        }
+    }
+
+    /* Find the innermost message along the path */
+    for (i = 0; i < depth - 1; i++) {
+        ret = find_field(src, start, end, path[i]->number, &fields[i], &hit);
+        if (ret != CPB_ERR_OK)
+            return ret;
+        if (!hit)
+            break;
+        start = fields[i].body;
+        end = start + fields[i].len;
+        found++;
+    }
+
+    /* Size of the inserted field and the messages to create */
+    add = encode_key(NULL, path[depth - 1]) + cpb_varint_size(sub_len) + sub_len;
+    for (i = depth - 2; i >= found; i--) {
+        fields[i].len = add;
+        add += encode_key(NULL, path[i]) + cpb_varint_size(add);
+    }
+
+    /* New lengths of the messages found, from the inside out */
+    grow = add;
+    for (i = found - 1; i >= 0; i--) {
+        width = fields[i].body - fields[i].len_pos;
+        fields[i].len += grow;
+        fields[i].width = cpb_varint_size(fields[i].len);
+        if (fields[i].width < width)
+            fields[i].width = width;
+        grow += fields[i].width - width;
+    }
+
+    if (msg_len + grow > len)
+        return CPB_ERR_END_OF_BUF;
+
+    /*
+     * Write back to front. Every part moves towards the end, so the parts
+     * that have not been written yet are never overwritten.
+     */
+    memmove(dst + end + grow, src + end, msg_len - end);
+
+    shift = grow - add;
+    p = dst + end + shift;
+    for (i = found; i < depth - 1; i++) {
+        p += encode_key(p, path[i]);
+        p += cpb_encode_varint(p, fields[i].len);
+    }
+    p += encode_key(p, path[depth - 1]);
+    p += cpb_encode_varint(p, sub_len);
+    if (sub_len)
+        memcpy(p, sub, sub_len);
+
+    pos = end;
+    for (i = found - 1; i >= 0; i--) {
+        memmove(dst + fields[i].body + shift, src + fields[i].body,
+                pos - fields[i].body);
+        shift -= fields[i].width - (fields[i].body - fields[i].len_pos);
+        cpb_encode_varint_width(dst + fields[i].len_pos + shift, fields[i].len,
+                                fields[i].width);
+        pos = fields[i].len_pos;
+    }
+    if (dst != src)
+        memmove(dst, src, pos);
+
+    if (used)
+        *used = msg_len + grow;
+
+    return CPB_ERR_OK;
+}
@@ -19,165 +19,245 @@
 
 #include "private.h"
 
-static const struct cpb_struct_map_field *find_map_field(
-        const struct cpb_struct_map *map,
-        const struct cpb_field_desc *field_desc)
+#define FIELD_BASE(_field_, _base_, _index_) \
+    ((_base_) + (_field_)->ofs + ((_field_)->len * (_index_)))
+
+/**
+ * Returns the lookup table of a struct map, building it on first use.
+ * @param sdecoder Struct decoder
+ * @param map Struct map
+ * @return Returns the lookup table or NULL if all tables are in use or the
+ * map has too many fields to be indexed.
+ */
+static const struct cpb_struct_decoder_table *get_table(
+        struct cpb_struct_decoder *sdecoder,
+        const struct cpb_struct_map *map)
+{
+    struct cpb_struct_decoder_table *table;
+    const struct cpb_struct_map_field *field;
+    u32_t number;
+    int i;
+
+    for (i = 0; i < sdecoder->num_tables; i++)
+        if (sdecoder->tables[i].map == map)
+            return &sdecoder->tables[i];
+
+    if (sdecoder->num_tables == CPB_STRUCT_TABLES)
+        return NULL;
+
+    table = &sdecoder->tables[sdecoder->num_tables];
+    memset(table->index, 0, sizeof(table->index));
+    for (field = map->fields; field->field_desc; field++) {
+        if (field - map->fields >= 255)
+            return NULL;
+        number = field->field_desc->number;
+        if (number < CPB_STRUCT_TABLE_SIZE && !table->index[number])
+            table->index[number] = (u8_t) (field - map->fields + 1);
+    }
+    table->map = map;
+    sdecoder->num_tables++;
+
+    return table;
+}
+
+/**
+ * Finds the mapped field with the given number.
+ * @param frame Stack frame of the message
+ * @param number Field number
+ * @return Returns the mapped field or NULL if the field is not mapped.
+ */
+static const struct cpb_struct_map_field *lookup_field(
+        const struct cpb_struct_decoder_stack_frame *frame, u64_t number)
 {
     const struct cpb_struct_map_field *field;
 
-    for (field = map->fields; field->field_desc; field++)
-        if (field->field_desc == field_desc)
+    if (frame->table && number < CPB_STRUCT_TABLE_SIZE)
+        return frame->table->index[number] ?
+               &frame->map->fields[frame->table->index[number] - 1] : NULL;
+
+    for (field = frame->map->fields; field->field_desc; field++)
+        if (field->field_desc->number == number)
             return field;
+
     return NULL;
 }
 
-#define FIELD_BASE(_field_, _base_, _index_) \
-    ((_base_) + (_field_)->ofs + ((_field_)->len * (_index_)))
-
-static void unpack_field(struct cpb_struct_decoder *sdecoder,
-                         const struct cpb_struct_map_field *field,
-                         union cpb_value *value)
+/**
+ * Finds the descriptor of a field that is not mapped.
+ * @param msg_desc Message descriptor
+ * @param number Field number
+ * @return Returns the field descriptor or NULL if the field is unknown.
+ */
+static const struct cpb_field_desc *find_field_desc(
+        const struct cpb_msg_desc *msg_desc, u64_t number)
 {
-    size_t len;
-    struct cpb_struct_decoder_stack_frame *frame;
+    u32_t i;
 
-    frame = &sdecoder->stack[sdecoder->depth];
+    for (i = 0; i < msg_desc->num_fields; i++)
+        if (msg_desc->fields[i].number == number)
+            return &msg_desc->fields[i];
 
-    /* Reset field index if a new field is encountered */
-    if (field != frame->last_field)
+    return NULL;
+}
+
+/**
+ * Decodes a wire value.
+ * @param buf Memory buffer
+ * @param wire_type Wire type
+ * @param wire_value Returns the wire value
+ * @return Returns CPB_ERR_OK if successful, CPB_ERR_END_OF_BUF if the value
+ * is truncated or CPB_ERR_INVALID_WIRE_TYPE if the wire type is invalid.
+ */
+static cpb_err_t decode_wire_value(struct cpb_buf *buf, int wire_type,
+                                   union wire_value *wire_value)
+{
+    cpb_err_t ret;
+
+    switch (wire_type) {
+    case WT_VARINT:
+        return cpb_decode_varint(buf, &wire_value->varint);
+    case WT_64BIT:
+        return cpb_decode_64bit(buf, &wire_value->int64);
+    case WT_32BIT:
+        return cpb_decode_32bit(buf, &wire_value->int32);
+    case WT_STRING:
+        ret = cpb_decode_varint(buf, &wire_value->string.len);
+        if (ret != CPB_ERR_OK)
+            return ret;
+        if (wire_value->string.len > cpb_buf_left(buf))
+            return CPB_ERR_END_OF_BUF;
+        wire_value->string.data = buf->pos;
+        buf->pos += wire_value->string.len;
+        return CPB_ERR_OK;
+    default:
+        return CPB_ERR_INVALID_WIRE_TYPE;
+    }
+}
+
+/**
+ * Returns the struct member to decode the next occurrence of a mapped field
+ * into. Singular fields are overwritten. Repeated fields fill their elements
+ * in order and start over at the first element when another field came in
+ * between, elements beyond the mapped count are dropped.
+ * @param frame Stack frame of the message
+ * @param field Mapped field
+ * @param size Size of an element
+ * @return Returns the struct member or NULL if the field is full.
+ */
+static u8_t *next_element(struct cpb_struct_decoder_stack_frame *frame,
+                          const struct cpb_struct_map_field *field,
+                          size_t size)
+{
+    if (field != frame->last_field) {
         frame->field_index = 0;
-    frame->last_field = field;
+        frame->last_field = field;
+    }
 
-    if (field->count >= field->count)
+    if (field->field_desc->opts.label != CPB_REPEATED)
+        return frame->base + field->ofs;
+    if (frame->field_index >= field->count)
+        return NULL;
+
+    return frame->base + field->ofs + size * frame->field_index++;
+}
+
+/**
+ * Stores a field value into the struct.
+ * @param field Mapped field
+ * @param dst Struct member
+ * @param value Field value
+ */
+static void unpack_field(const struct cpb_struct_map_field *field, u8_t *dst,
+                         const union cpb_value *value)
+{
+    size_t len;
 
     switch (field->field_desc->opts.typ) {
     case CPB_DOUBLE:
         CPB_ASSERT(field->len == sizeof(double), "Field type mismatch");
-        *((double *) FIELD_BASE(field, frame->base, frame->field_index)) = value->double_;
-        frame->field_index++;
+        *((double *) dst) = value->double_;
         break;
     case CPB_FLOAT:
         CPB_ASSERT(field->len == sizeof(float), "Field type mismatch");
-        *((float *) FIELD_BASE(field, frame->base, frame->field_index)) = value->float_;
-        frame->field_index++;
+        *((float *) dst) = value->float_;
         break;
     case CPB_INT32:
     case CPB_SINT32:
     case CPB_SFIXED32:
         CPB_ASSERT(field->len == sizeof(s32_t), "Field type mismatch");
-        *((s32_t *) FIELD_BASE(field, frame->base, frame->field_index)) = value->int32;
-        frame->field_index++;
+        *((s32_t *) dst) = value->int32;
         break;
     case CPB_UINT32:
     case CPB_FIXED32:
         CPB_ASSERT(field->len == sizeof(u32_t), "Field type mismatch");
-        *((u32_t *) FIELD_BASE(field, frame->base, frame->field_index)) = value->uint32;
-        frame->field_index++;
+        *((u32_t *) dst) = value->uint32;
         break;
     case CPB_INT64:
     case CPB_SINT64:
     case CPB_SFIXED64:
         CPB_ASSERT(field->len == sizeof(s64_t), "Field type mismatch");
-        *((s64_t *) FIELD_BASE(field, frame->base, frame->field_index)) = value->int64;
-        frame->field_index++;
+        *((s64_t *) dst) = value->int64;
         break;
     case CPB_UINT64:
     case CPB_FIXED64:
         CPB_ASSERT(field->len == sizeof(u64_t), "Field type mismatch");
-        *((u64_t *) FIELD_BASE(field, frame->base, frame->field_index)) = value->uint64;
-        frame->field_index++;
+        *((u64_t *) dst) = value->uint64;
         break;
     case CPB_BOOL:
         CPB_ASSERT(field->len == sizeof(cpb_bool_t), "Field type mismatch");
-        *((cpb_bool_t *) FIELD_BASE(field, frame->base, frame->field_index)) = value->bool;
-        frame->field_index++;
+        *((cpb_bool_t *) dst) = value->bool;
         break;
     case CPB_ENUM:
         CPB_ASSERT(field->len == sizeof(cpb_enum_t), "Field type mismatch");
-        *((cpb_enum_t *) FIELD_BASE(field, frame->base, frame->field_index)) = value->enum_;
-        frame->field_index++;
+        *((cpb_enum_t *) dst) = value->enum_;
         break;
     case CPB_STRING:
-        len = field->len < value->string.len + 1 ? field->len : value->string.len + 1;
-        memcpy(FIELD_BASE(field, frame->base, frame->field_index), value->string.str, len);
-        ((char *) FIELD_BASE(field, frame->base, frame->field_index))[len - 1] = '\0';
-        frame->field_index++;
+        len = field->len - 1 < value->string.len ? field->len - 1 : value->string.len;
+        memcpy(dst, value->string.str, len);
+        ((char *) dst)[len] = '\0';
         break;
     case CPB_BYTES:
         len = field->len < value->bytes.len ? field->len : value->bytes.len;
-        memcpy(FIELD_BASE(field, frame->base, frame->field_index), value->bytes.data, len);
-        frame->field_index++;
-        break;
-    case CPB_MESSAGE:
-        printf("submessage\n");
+        memcpy(dst, value->bytes.data, len);
         break;
     }
-
 }
 
-static void sdecoder_msg_start_handler(struct cpb_decoder *decoder,
-                                    const struct cpb_msg_desc *msg_desc,
-                                    void *arg)
+/**
+ * Handles a decoded scalar, string or bytes field.
+ * @param sdecoder Struct decoder
+ * @param frame Stack frame of the message
+ * @param field Mapped field or NULL if the field is not mapped
+ * @param field_desc Field descriptor
+ * @param wire_value Wire value
+ */
+static void decode_field(struct cpb_struct_decoder *sdecoder,
+                         struct cpb_struct_decoder_stack_frame *frame,
+                         const struct cpb_struct_map_field *field,
+                         const struct cpb_field_desc *field_desc,
+                         const union wire_value *wire_value)
 {
-    struct cpb_struct_decoder *sdecoder = arg;
-    struct cpb_struct_decoder_stack_frame *frame, *last_frame;
-
-    printf("msg start\n");
-
-    sdecoder->depth++;
-    frame = &sdecoder->stack[sdecoder->depth];
-
-    if (sdecoder->depth > 0) {
-        last_frame = &sdecoder->stack[sdecoder->depth - 1];
-        frame->map = (const struct cpb_struct_map *) last_frame->last_field->len;
-        frame->base = last_frame->base + last_frame->last_field->ofs +
-            (frame->map->struct_size * last_frame->field_index);
-        frame->last_field = NULL;
-        frame->field_index = 0;
-        last_frame->field_index++;
+    union cpb_value value;
+    u8_t *dst;
+
+    cpb_wire_to_value(field_desc, wire_value, &value);
+
+    if (field) {
+        dst = next_element(frame, field, field->len);
+        if (dst) {
+            unpack_field(field, dst, &value);
+            if (frame->map->flags & CPB_STRUCT_MAP_PRESENCE)
+                CPB_STRUCT_SET_PRESENT(frame->map, frame->base,
+                                       field - frame->map->fields);
+        }
     }
 
-    CPB_ASSERT(frame->map->msg_desc == msg_desc, "Message type mismatch");
-
-    if (sdecoder->msg_start_handler)
-        sdecoder->msg_start_handler(sdecoder, msg_desc, sdecoder->arg);
-}
-
-static void sdecoder_msg_end_handler(struct cpb_decoder *decoder,
-                                  const struct cpb_msg_desc *msg_desc,
-                                  void *arg)
-{
-    struct cpb_struct_decoder *sdecoder = arg;
-    struct cpb_struct_decoder_stack_frame *frame;
-
-    printf("msg end\n");
-
-    sdecoder->depth--;
-    frame = &sdecoder->stack[sdecoder->depth];
-
-    if (sdecoder->msg_end_handler)
-        sdecoder->msg_end_handler(sdecoder, msg_desc, sdecoder->arg);
-}
-
-static void sdecoder_field_handler(struct cpb_decoder *decoder,
-                                const struct cpb_msg_desc *msg_desc,
-                                const struct cpb_field_desc *field_desc,
-                                union cpb_value *value, void *arg)
-{
-    struct cpb_struct_decoder *sdecoder = arg;
-    struct cpb_struct_decoder_stack_frame *frame = &sdecoder->stack[sdecoder->depth];
-    const struct cpb_struct_map_field *field;
-
-    field = find_map_field(frame->map, field_desc);
-    if (field)
-        unpack_field(sdecoder, field, value);
-
     if (sdecoder->field_handler)
-        sdecoder->field_handler(sdecoder, msg_desc, field_desc, value, sdecoder->arg);
+        sdecoder->field_handler(sdecoder, frame->map->msg_desc, field_desc,
+                                &value, sdecoder->arg);
 }
 
 
-
 /* Struct decoder */
 
 /**
@@ -186,19 +266,12 @@ static void sdecoder_field_handler(struct cpb_decoder *decoder,
  */
 void cpb_struct_decoder_init(struct cpb_struct_decoder *sdecoder)
 {
-    /* Initialize decoder */
-    cpb_decoder_init(&sdecoder->decoder);
-    cpb_decoder_arg(&sdecoder->decoder, sdecoder);
-    cpb_decoder_msg_handler(&sdecoder->decoder,
-            sdecoder_msg_start_handler, sdecoder_msg_end_handler);
-    cpb_decoder_field_handler(&sdecoder->decoder,
-            sdecoder_field_handler);
-
-    /* Initialize internals */
     sdecoder->arg = NULL;
     sdecoder->msg_start_handler = NULL;
     sdecoder->msg_end_handler = NULL;
     sdecoder->field_handler = NULL;
+    sdecoder->depth = 0;
+    sdecoder->num_tables = 0;
 }
 
 /**
@@ -226,7 +299,8 @@ void cpb_struct_decoder_msg_handler(struct cpb_struct_decoder *sdecoder,
 }
 
 /**
- * Sets the field handler.
+ * Sets the field handler. It is called for every known field, also for the
+ * fields that are not mapped.
  * @param sdecoder Struct decoder
  * @param field_handler Field handler
  */
@@ -237,27 +311,167 @@ void cpb_struct_decoder_field_handler(struct cpb_struct_decoder *sdecoder,
 }
 
 /**
- * Decodes a protocol buffer into a struct.
+ * Decodes a protocol buffer into a struct. The wire format is walked
+ * directly and mapped fields are written straight into the struct, found by
+ * number through a lookup table built once per struct map. Unknown fields,
+ * fields with unexpected wire types and nested messages that are not mapped
+ * are skipped. Repeated scalar fields are accepted packed and unpacked.
  * @param sdecoder Struct decoder
  * @param struct_map Struct map used for decoding
  * @param struct_base Base of the struct to decode into
  * @param data Data to decode
  * @param len Length of data to decode
  * @param used Returns the number of decoded bytes when not NULL.
- * @return Returns CPB_ERR_OK when data was successfully decoded.
+ * @return Returns CPB_ERR_OK when data was successfully decoded,
+ * CPB_ERR_END_OF_BUF if the data is truncated, CPB_ERR_INVALID_WIRE_TYPE
+ * if it contains invalid data or CPB_ERR_DEPTH if it nests messages more
+ * than CPB_MAX_DEPTH deep.
  */
 cpb_err_t cpb_struct_decoder_decode(struct cpb_struct_decoder *sdecoder,
                                       const struct cpb_struct_map *struct_map,
                                       void *struct_base,
                                       void *data, size_t len, size_t *used)
 {
-    sdecoder->depth = -1;
-    sdecoder->stack[0].map = struct_map;
-    sdecoder->stack[0].base = struct_base;
-    sdecoder->stack[0].last_field = NULL;
-    sdecoder->stack[0].field_index = 0;
+    struct cpb_struct_decoder_stack_frame *frame;
+    const struct cpb_struct_map_field *field;
+    const struct cpb_field_desc *field_desc;
+    union wire_value wire_value;
+    struct cpb_buf packed;
+    cpb_err_t ret;
+    u64_t key;
+    int wire_type;
+    u8_t *dst;
+
+    /* No frame refers to a table between decodes, start over when full */
+    if (sdecoder->num_tables == CPB_STRUCT_TABLES)
+        sdecoder->num_tables = 0;
+
+    sdecoder->depth = 0;
+    frame = &sdecoder->stack[0];
+    frame->map = struct_map;
+    frame->table = get_table(sdecoder, struct_map);
+    frame->base = struct_base;
+    cpb_buf_init(&frame->buf, data, len);
+    frame->last_field = NULL;
+    frame->field_index = 0;
+
+    if (sdecoder->msg_start_handler)
+        sdecoder->msg_start_handler(sdecoder, struct_map->msg_desc, sdecoder->arg);
+
+    for (;;) {
+        if (frame->buf.pos == frame->buf.end) {
+            if (sdecoder->msg_end_handler)
+                sdecoder->msg_end_handler(sdecoder, frame->map->msg_desc,
+                                          sdecoder->arg);
+            if (sdecoder->depth == 0)
+                break;
+            frame = &sdecoder->stack[--sdecoder->depth];
+            continue;
+        }
+
+        ret = cpb_decode_varint(&frame->buf, &key);
+        if (ret != CPB_ERR_OK)
+            return ret;
+        wire_type = key & 0x07;
+
+        field = lookup_field(frame, key >> 3);
+        if (field)
+            field_desc = field->field_desc;
+        else if (sdecoder->field_handler)
+            field_desc = find_field_desc(frame->map->msg_desc, key >> 3);
+        else
+            field_desc = NULL;
+
+        /* Skip unknown fields and fields with unexpected wire types */
+        if (!field_desc ||
+            (wire_type != CPB_WIRE_TYPE(field_desc->opts.typ) &&
+             !(wire_type == WT_STRING && field_desc->opts.label == CPB_REPEATED))) {
+            ret = cpb_skip_field(&frame->buf, wire_type, (u32_t) (key >> 3));
+            if (ret != CPB_ERR_OK)
+                return ret;
+            continue;
+        }
+
+        ret = decode_wire_value(&frame->buf, wire_type, &wire_value);
+        if (ret != CPB_ERR_OK)
+            return ret;
+
+        if (field_desc->opts.typ == CPB_MESSAGE) {
+            if (sdecoder->field_handler)
+                sdecoder->field_handler(sdecoder, frame->map->msg_desc,
+                                        field_desc, NULL, sdecoder->arg);
+            if (!field)
+                continue;
+            dst = next_element(frame, field,
+                               ((const struct cpb_struct_map *) field->len)->struct_size);
+            if (!dst)
+                continue;
+            if (sdecoder->depth + 1 == CPB_MAX_DEPTH)
+                return CPB_ERR_DEPTH;
+            if (frame->map->flags & CPB_STRUCT_MAP_PRESENCE)
+                CPB_STRUCT_SET_PRESENT(frame->map, frame->base,
+                                       field - frame->map->fields);
+
+            /* Descend into the nested message */
+            frame = &sdecoder->stack[++sdecoder->depth];
+            frame->map = (const struct cpb_struct_map *) field->len;
+            CPB_ASSERT(frame->map->msg_desc == field_desc->msg_desc,
+                       "Message type mismatch");
+            frame->table = get_table(sdecoder, frame->map);
+            frame->base = dst;
+            cpb_buf_init(&frame->buf, wire_value.string.data,
+                         wire_value.string.len);
+            frame->last_field = NULL;
+            frame->field_index = 0;
+
+            if (sdecoder->msg_start_handler)
+                sdecoder->msg_start_handler(sdecoder, frame->map->msg_desc,
+                                            sdecoder->arg);
+            continue;
+        }
+
+        if (wire_type != CPB_WIRE_TYPE(field_desc->opts.typ)) {
+            /* Packed repeated field */
+            cpb_buf_init(&packed, wire_value.string.data, wire_value.string.len);
+            while (packed.pos < packed.end) {
+                ret = decode_wire_value(&packed, CPB_WIRE_TYPE(field_desc->opts.typ),
+                                        &wire_value);
+                if (ret != CPB_ERR_OK)
+                    return ret;
+                decode_field(sdecoder, frame, field, field_desc, &wire_value);
+            }
+            continue;
+        }
+
+        decode_field(sdecoder, frame, field, field_desc, &wire_value);
+    }
+
+    if (used)
+        *used = cpb_buf_used(&sdecoder->stack[0].buf);
 
-    return cpb_decoder_decode(&sdecoder->decoder, struct_map->msg_desc, data, len, used);
+    return CPB_ERR_OK;
+}
+
+/**
+ * Applies a delta message from cpb_struct_diff_encode() to a struct. Fields
+ * missing from the delta are left unchanged, repeated fields are replaced
+ * from their first element on.
+ * @param struct_map Struct map used for decoding
+ * @param struct_base Base of the struct to update
+ * @param data Delta message
+ * @param len Length of delta message
+ * @return Returns CPB_ERR_OK when the delta was successfully applied.
+ */
+cpb_err_t cpb_struct_apply_delta(const struct cpb_struct_map *struct_map,
+                                   void *struct_base,
+                                   const void *data, size_t len)
+{
+    struct cpb_struct_decoder sdecoder;
+
+    cpb_struct_decoder_init(&sdecoder);
+
+    return cpb_struct_decoder_decode(&sdecoder, struct_map, struct_base,
+                                     (void *) data, len, NULL);
 }
 
 
@@ -283,11 +497,34 @@ const char *cpb_err_text(cpb_err_t err)
         return "Memory allocation failed";
     case CPB_ERR_NET_INIT:
         return "Network initialization failed";
+    case CPB_ERR_INVALID_WIRE_TYPE:
+        return "Invalid wire type";
+    case CPB_ERR_IO:
+        return "Output error";
+    case CPB_ERR_DEPTH:
+        return "Nesting too deep";
     default:
         return "Unknown";
     }
 }
 
+static void *default_alloc(void *ctx, size_t size)
+{
+    return malloc(size);
+}
+
+static void default_free(void *ctx, void *ptr)
+{
+    free(ptr);
+}
+
+/** Default allocator using malloc() and free() */
+const struct cpb_allocator cpb_default_allocator = {
+    default_alloc,
+    default_free,
+    NULL
+};
+
 /**
  * Initializes a memory buffer. Sets the position to the base address.
  * @param buf Memory buffer
@@ -21,11 +21,26 @@
 #include <cpb/cpb.h>
 
 
+/**
+ * Checks that a field belongs to a message, i.e. that the field descriptor
+ * lies within the message's field array. Always true if CPB_CHECK_FIELDS is
+ * disabled.
+ */
+#if CPB_CHECK_FIELDS
+#define CPB_FIELD_IN_MSG(msg_desc, field_desc)                             \
+    ((field_desc) >= (msg_desc)->fields &&                                 \
+     (field_desc) < &(msg_desc)->fields[(msg_desc)->num_fields])
+#else
+#define CPB_FIELD_IN_MSG(msg_desc, field_desc) 1
+#endif
+
 /** Protocol buffer wire types */
 enum wire_type {
     WT_VARINT = 0,
     WT_64BIT  = 1,
     WT_STRING = 2,
+    WT_START_GROUP = 3,
+    WT_END_GROUP = 4,
     WT_32BIT  = 5,
     WT_ERROR  = -1,
 };
@@ -47,4 +62,14 @@ size_t cpb_buf_used(struct cpb_buf *buf);
 
 size_t cpb_buf_left(struct cpb_buf *buf);
 
+cpb_err_t cpb_skip_field(struct cpb_buf *buf, int wire_type, u32_t number);
+
+enum wire_type cpb_value_to_wire(const struct cpb_field_desc *field_desc,
+                                 const union cpb_value *value,
+                                 union wire_value *wire_value);
+
+void cpb_wire_to_value(const struct cpb_field_desc *field_desc,
+                       const union wire_value *wire_value,
+                       union cpb_value *value);
+
 #endif /* __CPB_CORE_PRIVATE_H__ */
@@ -0,0 +1,826 @@
+/** @file rencoder.c
+ *
+ * Implementation of the protocol buffers back-to-front encoder.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cpb/cpb.h>
+#include <cpb/core/encoder2.h>
+
+#include "private.h"
+
+
+/** Returns the number of bytes written so far. */
+#define WRITTEN(_encoder_) ((_encoder_)->closed + \
+                            (size_t) ((_encoder_)->buf.end - (_encoder_)->buf.pos))
+
+/* Encoder utilities */
+
+/**
+ * Closes the current segment, recording the bytes written into it.
+ * @param encoder Encoder
+ */
+static void close_segment(struct cpb_rencoder *encoder)
+{
+    struct cpb_rencoder_seg *seg = encoder->segs;
+
+    if (!seg)
+        return;
+
+    seg->data = encoder->buf.pos;
+    seg->len = encoder->buf.end - encoder->buf.pos;
+    encoder->closed += seg->len;
+}
+
+/**
+ * Allocates a new segment in front of the current one.
+ * @param encoder Encoder
+ * @return Returns CPB_ERR_OK if successful, CPB_ERR_END_OF_BUF if encoding
+ * into a fixed buffer or CPB_ERR_MEM if the allocation failed.
+ */
+static cpb_err_t new_segment(struct cpb_rencoder *encoder)
+{
+    const struct cpb_allocator *allocator = encoder->allocator;
+    struct cpb_rencoder_seg *seg;
+
+    if (!allocator)
+        return CPB_ERR_END_OF_BUF;
+
+    /* Segment header and storage are allocated as one block */
+    seg = allocator->alloc(allocator->ctx, sizeof(*seg) + encoder->seg_size);
+    if (!seg)
+        return CPB_ERR_MEM;
+
+    close_segment(encoder);
+    seg->next = encoder->segs;
+    encoder->segs = seg;
+
+    cpb_buf_init(&encoder->buf, seg + 1, encoder->seg_size);
+    encoder->buf.pos = encoder->buf.end;
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Prepends a payload by reference. The payload becomes a segment of its own
+ * and the unused storage of the current segment continues in front of it.
+ * @param encoder Encoder
+ * @param data Payload, must stay valid until the message has been consumed
+ * @param len Payload length
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_MEM if the allocation
+ * failed.
+ */
+static cpb_err_t put_ref(struct cpb_rencoder *encoder,
+                         const void *data, size_t len)
+{
+    const struct cpb_allocator *allocator = encoder->allocator;
+    struct cpb_rencoder_seg *ref, *cont;
+
+    ref = allocator->alloc(allocator->ctx, sizeof(*ref));
+    if (!ref)
+        return CPB_ERR_MEM;
+    cont = allocator->alloc(allocator->ctx, sizeof(*cont));
+    if (!cont) {
+        allocator->free(allocator->ctx, ref);
+        return CPB_ERR_MEM;
+    }
+
+    close_segment(encoder);
+
+    ref->next = encoder->segs;
+    ref->data = (u8_t *) data;
+    ref->len = len;
+    encoder->closed += len;
+
+    cont->next = ref;
+    encoder->segs = cont;
+    encoder->buf.end = encoder->buf.pos;
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Prepends raw bytes, spilling into new segments in chained mode.
+ * @param encoder Encoder
+ * @param data Bytes to prepend
+ * @param len Number of bytes
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_END_OF_BUF if there
+ * was not enough space left in the memory buffer.
+ */
+static cpb_err_t put_bytes(struct cpb_rencoder *encoder,
+                           const void *data, size_t len)
+{
+    cpb_err_t ret;
+    size_t n;
+
+    if (!encoder->allocator && cpb_buf_used(&encoder->buf) < len)
+        return CPB_ERR_END_OF_BUF;
+
+    /* Fill the current segment with the tail of the data */
+    while (cpb_buf_used(&encoder->buf) < len) {
+        n = cpb_buf_used(&encoder->buf);
+        if (n) {
+            len -= n;
+            encoder->buf.pos -= n;
+            memcpy(encoder->buf.pos, (const u8_t *) data + len, n);
+        }
+        ret = new_segment(encoder);
+        if (ret != CPB_ERR_OK)
+            return ret;
+    }
+
+    if (len) {
+        encoder->buf.pos -= len;
+        memcpy(encoder->buf.pos, data, len);
+    }
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Prepends a variable integer in base-128 format.
+ * @param encoder Encoder
+ * @param varint Value to encode
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_END_OF_BUF if there
+ * was not enough space left in the memory buffer.
+ */
+static cpb_err_t put_varint(struct cpb_rencoder *encoder, u64_t varint)
+{
+    size_t len = cpb_varint_size(varint);
+    u8_t tmp[10];
+
+    if (cpb_buf_used(&encoder->buf) < len) {
+        cpb_encode_varint(tmp, varint);
+        return put_bytes(encoder, tmp, len);
+    }
+
+    encoder->buf.pos -= len;
+    cpb_encode_varint(encoder->buf.pos, varint);
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Prepends a 32 bit integer.
+ * @param encoder Encoder
+ * @param value Value to encode
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_END_OF_BUF if there
+ * was not enough space left in the memory buffer.
+ */
+static cpb_err_t put_32bit(struct cpb_rencoder *encoder, u32_t value)
+{
+    u8_t tmp[4];
+
+    if (cpb_buf_used(&encoder->buf) < 4) {
+        cpb_encode_32bit(tmp, value);
+        return put_bytes(encoder, tmp, 4);
+    }
+
+    encoder->buf.pos -= 4;
+    cpb_encode_32bit(encoder->buf.pos, value);
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Prepends a 64 bit integer.
+ * @param encoder Encoder
+ * @param value Value to encode
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_END_OF_BUF if there
+ * was not enough space left in the memory buffer.
+ */
+static cpb_err_t put_64bit(struct cpb_rencoder *encoder, u64_t value)
+{
+    u8_t tmp[8];
+
+    if (cpb_buf_used(&encoder->buf) < 8) {
+        cpb_encode_64bit(tmp, value);
+        return put_bytes(encoder, tmp, 8);
+    }
+
+    encoder->buf.pos -= 8;
+    cpb_encode_64bit(encoder->buf.pos, value);
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Prepends a field key, copying the pre-encoded tag if available.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor
+ * @param wire_type Wire type
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_END_OF_BUF if there
+ * was not enough space left in the memory buffer.
+ */
+static cpb_err_t put_key(struct cpb_rencoder *encoder,
+                         const struct cpb_field_desc *field_desc,
+                         enum wire_type wire_type)
+{
+#if CPB_FIELD_TAGS
+    const struct cpb_field_tag *tag;
+
+    tag = CPB_IS_PACKED_REPEATED(field_desc) ? &field_desc->packed_tag :
+                                                &field_desc->tag;
+    if (tag->len)
+        return put_bytes(encoder, tag->bytes, tag->len);
+#endif
+
+    return put_varint(encoder, wire_type | (field_desc->number << 3));
+}
+
+/**
+ * Prepends the key and length of a length-delimited field whose body has
+ * been written since the given mark.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor
+ * @param mark Bytes written before the body
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_END_OF_BUF if there
+ * was not enough space left in the memory buffer.
+ */
+static cpb_err_t put_delimited(struct cpb_rencoder *encoder,
+                               const struct cpb_field_desc *field_desc,
+                               size_t mark)
+{
+    cpb_err_t ret;
+
+    ret = put_varint(encoder, WRITTEN(encoder) - mark);
+    if (ret != CPB_ERR_OK)
+        return ret;
+    return put_key(encoder, field_desc, WT_STRING);
+}
+
+/**
+ * Pushes the encoder stack.
+ * @param encoder Encoder
+ * @return Returns the top stack frame.
+ */
+static struct cpb_rencoder_stack_frame *push_stack_frame(struct cpb_rencoder *encoder)
+{
+    encoder->depth++;
+    CPB_ASSERT(encoder->depth <= CPB_MAX_DEPTH, "Message nesting too deep");
+    return &encoder->stack[encoder->depth - 1];
+}
+
+/**
+ * Pops the encoder stack.
+ * @param encoder Encoder
+ * @return Returns the popped stack frame.
+ */
+static struct cpb_rencoder_stack_frame *pop_stack_frame(struct cpb_rencoder *encoder)
+{
+    CPB_ASSERT(encoder->depth > 1, "Message nesting too shallow");
+    encoder->depth--;
+    return &encoder->stack[encoder->depth];
+}
+
+/**
+ * Resets the encoder stack to the root message.
+ * @param encoder Encoder
+ * @param msg_desc Root message descriptor
+ */
+static void start_root(struct cpb_rencoder *encoder,
+                       const struct cpb_msg_desc *msg_desc)
+{
+    struct cpb_rencoder_stack_frame *frame = &encoder->stack[0];
+
+    encoder->depth = 1;
+    encoder->packed = 0;
+
+    frame->mark = 0;
+    frame->field_desc = NULL;
+    frame->msg_desc = msg_desc;
+}
+
+/* Encoder */
+
+/**
+ * Initializes the encoder.
+ * @param encoder Encoder
+ */
+void cpb_rencoder_init(struct cpb_rencoder *encoder)
+{
+    encoder->depth = 0;
+    encoder->allocator = NULL;
+    encoder->segs = NULL;
+    encoder->closed = 0;
+    encoder->ref_threshold = 0;
+}
+
+/**
+ * Starts encoding a message. The message is written to the end of the data
+ * buffer, see cpb_rencoder_data().
+ * @param encoder Encoder
+ * @param msg_desc Root message descriptor
+ * @param data Data buffer to encode into
+ * @param len Length of data buffer
+ */
+void cpb_rencoder_start(struct cpb_rencoder *encoder,
+                         const struct cpb_msg_desc *msg_desc,
+                         void *data, size_t len)
+{
+    cpb_rencoder_release(encoder);
+    encoder->allocator = NULL;
+
+    cpb_buf_init(&encoder->buf, data, len);
+    encoder->buf.pos = encoder->buf.end;
+
+    start_root(encoder, msg_desc);
+}
+
+/**
+ * Starts encoding a message into a chain of segments, which are allocated
+ * as the message grows. Use cpb_rencoder_iov() or cpb_rencoder_flatten() to
+ * access the result and cpb_rencoder_release() to free the segments.
+ * @param encoder Encoder
+ * @param msg_desc Root message descriptor
+ * @param allocator Segment allocator or NULL to use malloc()
+ * @param seg_size Storage size of each segment
+ */
+void cpb_rencoder_start_chain(struct cpb_rencoder *encoder,
+                               const struct cpb_msg_desc *msg_desc,
+                               const struct cpb_allocator *allocator,
+                               size_t seg_size)
+{
+    CPB_ASSERT(seg_size > 0, "Segment size must not be zero");
+
+    cpb_rencoder_release(encoder);
+    encoder->allocator = allocator ? allocator : &cpb_default_allocator;
+    encoder->seg_size = seg_size;
+
+    start_root(encoder, msg_desc);
+}
+
+/**
+ * Sets the size from which string, bytes and pre-encoded payloads are
+ * referenced instead of copied in chained mode. Referenced payloads show up
+ * as segments of their own in cpb_rencoder_iov() and must stay valid until
+ * the message has been consumed.
+ * @param encoder Encoder
+ * @param threshold Minimum payload size, 0 to always copy
+ */
+void cpb_rencoder_ref_threshold(struct cpb_rencoder *encoder,
+                                 size_t threshold)
+{
+    encoder->ref_threshold = threshold;
+}
+
+/**
+ * Releases all segments allocated in chained mode.
+ * @param encoder Encoder
+ */
+void cpb_rencoder_release(struct cpb_rencoder *encoder)
+{
+    struct cpb_rencoder_seg *seg, *next;
+
+    for (seg = encoder->segs; seg; seg = next) {
+        next = seg->next;
+        encoder->allocator->free(encoder->allocator->ctx, seg);
+    }
+
+    encoder->segs = NULL;
+    encoder->closed = 0;
+    encoder->buf.base = encoder->buf.pos = encoder->buf.end = NULL;
+}
+
+/**
+ * Finishes encoding a message.
+ * @param encoder Encoder
+ * @return Returns the total size of the encoded message.
+ */
+size_t cpb_rencoder_finish(struct cpb_rencoder *encoder)
+{
+    return WRITTEN(encoder);
+}
+
+/**
+ * Returns the start of the encoded message, which ends at the end of the
+ * data buffer passed to cpb_rencoder_start().
+ * @param encoder Encoder
+ * @return Returns the first byte of the encoded message or NULL if the
+ * message spans multiple segments.
+ */
+void *cpb_rencoder_data(struct cpb_rencoder *encoder)
+{
+    if (encoder->closed)
+        return NULL;
+
+    return encoder->buf.pos;
+}
+
+/**
+ * Exposes the encoded message as a list of memory segments in message order.
+ * @param encoder Encoder
+ * @param iov Array to fill with segments
+ * @param iovcnt Number of entries in the array
+ * @return Returns the number of segments of the message, which may be larger
+ * than iovcnt.
+ */
+int cpb_rencoder_iov(struct cpb_rencoder *encoder,
+                      struct cpb_iovec *iov, int iovcnt)
+{
+    struct cpb_rencoder_seg *seg;
+    int n = 0;
+
+    if (encoder->buf.pos != encoder->buf.end) {
+        if (n < iovcnt) {
+            iov[n].base = encoder->buf.pos;
+            iov[n].len = encoder->buf.end - encoder->buf.pos;
+        }
+        n++;
+    }
+
+    for (seg = encoder->segs ? encoder->segs->next : NULL; seg; seg = seg->next) {
+        if (seg->len == 0)
+            continue;
+        if (n < iovcnt) {
+            iov[n].base = seg->data;
+            iov[n].len = seg->len;
+        }
+        n++;
+    }
+
+    return n;
+}
+
+/**
+ * Copies the encoded message into a contiguous buffer.
+ * @param encoder Encoder
+ * @param data Buffer to copy into
+ * @param len Length of buffer
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_END_OF_BUF if the
+ * buffer is smaller than the message.
+ */
+cpb_err_t cpb_rencoder_flatten(struct cpb_rencoder *encoder,
+                                 void *data, size_t len)
+{
+    struct cpb_rencoder_seg *seg;
+    u8_t *pos = data;
+
+    if (len < WRITTEN(encoder))
+        return CPB_ERR_END_OF_BUF;
+
+    len = encoder->buf.end - encoder->buf.pos;
+    if (len) {
+        memcpy(pos, encoder->buf.pos, len);
+        pos += len;
+    }
+
+    for (seg = encoder->segs ? encoder->segs->next : NULL; seg; seg = seg->next) {
+        if (seg->len == 0)
+            continue;
+        memcpy(pos, seg->data, seg->len);
+        pos += seg->len;
+    }
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Starts encoding a nested message. The fields of the nested message must be
+ * added in reverse order as well.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor holding the nested message
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_rencoder_nested_start(struct cpb_rencoder *encoder,
+                                      const struct cpb_field_desc *field_desc)
+{
+    struct cpb_rencoder_stack_frame *frame, *new_frame;
+
+    CPB_ASSERT(field_desc->opts.typ == CPB_MESSAGE, "Field is not a message");
+    CPB_ASSERT(!encoder->packed, "Messages must not be nested in packed fields");
+
+    /* Check that field belongs to the current message */
+    frame = &encoder->stack[encoder->depth - 1];
+    if (!CPB_FIELD_IN_MSG(frame->msg_desc, field_desc))
+        return CPB_ERR_UNKNOWN_FIELD;
+
+    /* Create a new frame */
+    new_frame = push_stack_frame(encoder);
+    new_frame->mark = WRITTEN(encoder);
+    new_frame->field_desc = field_desc;
+    new_frame->msg_desc = field_desc->msg_desc;
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Ends encoding a nested message.
+ * @param encoder Encoder
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_rencoder_nested_end(struct cpb_rencoder *encoder)
+{
+    struct cpb_rencoder_stack_frame *frame;
+
+    CPB_ASSERT(!encoder->packed, "Packed repeated field must be ended first");
+
+    frame = pop_stack_frame(encoder);
+
+    return put_delimited(encoder, frame->field_desc, frame->mark);
+}
+
+/**
+ * Starts encoding a packed repeated field. The values must be added in
+ * reverse order.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor of packed repeated field
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_rencoder_packed_repeated_start(struct cpb_rencoder *encoder,
+                                               const struct cpb_field_desc *field_desc)
+{
+    struct cpb_rencoder_stack_frame *frame, *new_frame;
+
+    CPB_ASSERT(CPB_IS_PACKED_REPEATED(field_desc),
+                "Field is not repeated packed");
+
+    CPB_ASSERT(!encoder->packed, "Packed repeated fields must not be nested");
+
+    /* Check that field belongs to the current message */
+    frame = &encoder->stack[encoder->depth - 1];
+    if (!CPB_FIELD_IN_MSG(frame->msg_desc, field_desc))
+        return CPB_ERR_UNKNOWN_FIELD;
+
+    /* Create a new frame */
+    new_frame = push_stack_frame(encoder);
+    new_frame->mark = WRITTEN(encoder);
+    new_frame->field_desc = field_desc;
+    new_frame->msg_desc = NULL;
+
+    /* Enter packed repeated mode */
+    encoder->packed = 1;
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Ends encoding a packed repeated field.
+ * @param encoder Encoder
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_rencoder_packed_repeated_end(struct cpb_rencoder *encoder)
+{
+    struct cpb_rencoder_stack_frame *frame;
+
+    CPB_ASSERT(encoder->packed, "Not in packed repeated mode");
+
+    frame = pop_stack_frame(encoder);
+
+    /* Leave packed repeated mode */
+    encoder->packed = 0;
+
+    return put_delimited(encoder, frame->field_desc, frame->mark);
+}
+
+/**
+ * Encodes a field.
+ * @note This method should not normally be used. Use the
+ * cpb_rencoder_add_xxx() methods to directly add a field of a given type.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor of field to encode
+ * @param value Field value
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_rencoder_add_field(struct cpb_rencoder *encoder,
+                                   const struct cpb_field_desc *field_desc,
+                                   union cpb_value *value)
+{
+    cpb_err_t ret;
+    struct cpb_rencoder_stack_frame *frame;
+    enum wire_type wire_type;
+    union wire_value wire_value;
+
+    CPB_ASSERT(encoder->depth > 0, "Fields can only be added inside a message");
+
+    /* Get current frame */
+    frame = &encoder->stack[encoder->depth - 1];
+
+    if (encoder->packed) {
+        /* Check that packed repeated field is not interleaved with other fields */
+        CPB_ASSERT(field_desc == frame->field_desc,
+                    "Packed repeated fields must not be interleaved with other"
+                    "fields");
+        if (field_desc != frame->field_desc)
+            return CPB_ERR_INVALID_FIELD;
+    } else {
+        /* Check that field belongs to the current message */
+        if (!CPB_FIELD_IN_MSG(frame->msg_desc, field_desc))
+            return CPB_ERR_UNKNOWN_FIELD;
+    }
+
+    wire_type = cpb_value_to_wire(field_desc, value, &wire_value);
+
+    /* Override wire value if this is an already encoded packed repeated field */
+    if (!encoder->packed && CPB_IS_PACKED_REPEATED(field_desc)) {
+        wire_type = WT_STRING;
+        wire_value.string.data = value->message.data;
+        wire_value.string.len = value->message.len;
+    }
+
+    switch (wire_type) {
+    case WT_VARINT:
+        ret = put_varint(encoder, wire_value.varint);
+        break;
+    case WT_64BIT:
+        ret = put_64bit(encoder, wire_value.int64);
+        break;
+    case WT_STRING:
+        if (encoder->allocator && encoder->ref_threshold &&
+            wire_value.string.len >= encoder->ref_threshold)
+            ret = put_ref(encoder, wire_value.string.data, wire_value.string.len);
+        else
+            ret = put_bytes(encoder, wire_value.string.data, wire_value.string.len);
+        if (ret == CPB_ERR_OK)
+            ret = put_varint(encoder, wire_value.string.len);
+        break;
+    case WT_32BIT:
+        ret = put_32bit(encoder, wire_value.int32);
+        break;
+    default:
+        return CPB_ERR_INVALID_FIELD;
+    }
+    if (ret != CPB_ERR_OK)
+        return ret;
+
+    /* Do not encode field key for packed repeated fields */
+    if (encoder->packed)
+        return CPB_ERR_OK;
+
+    return put_key(encoder, field_desc, wire_type);
+}
+
+/**
+ * Encodes a field of type 'double'.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor of field to encode
+ * @param double_ Value
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_rencoder_add_double(struct cpb_rencoder *encoder,
+                                    const struct cpb_field_desc *field_desc,
+                                    double double_)
+{
+    union cpb_value value;
+    value.double_ = double_;
+    return cpb_rencoder_add_field(encoder, field_desc, &value);
+}
+
+/**
+ * Encodes a field of type 'float'.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor of field to encode
+ * @param float_ Value
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_rencoder_add_float(struct cpb_rencoder *encoder,
+                                   const struct cpb_field_desc *field_desc,
+                                   float float_)
+{
+    union cpb_value value;
+    value.float_ = float_;
+    return cpb_rencoder_add_field(encoder, field_desc, &value);
+}
+
+/**
+ * Encodes a field of type 'int32'.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor of field to encode
+ * @param int32 Value
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_rencoder_add_int32(struct cpb_rencoder *encoder,
+                                   const struct cpb_field_desc *field_desc,
+                                   s32_t int32)
+{
+    union cpb_value value;
+    value.int32 = int32;
+    return cpb_rencoder_add_field(encoder, field_desc, &value);
+}
+
+/**
+ * Encodes a field of type 'uint32'.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor of field to encode
+ * @param uint32 Value
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_rencoder_add_uint32(struct cpb_rencoder *encoder,
+                                    const struct cpb_field_desc *field_desc,
+                                    u32_t uint32)
+{
+    union cpb_value value;
+    value.uint32 = uint32;
+    return cpb_rencoder_add_field(encoder, field_desc, &value);
+}
+
+/**
+ * Encodes a field of type 'int64'.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor of field to encode
+ * @param int64 Value
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_rencoder_add_int64(struct cpb_rencoder *encoder,
+                                   const struct cpb_field_desc *field_desc,
+                                   s64_t int64)
+{
+    union cpb_value value;
+    value.int64 = int64;
+    return cpb_rencoder_add_field(encoder, field_desc, &value);
+}
+
+/**
+ * Encodes a field of type 'uint64'.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor of field to encode
+ * @param uint64 Value
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_rencoder_add_uint64(struct cpb_rencoder *encoder,
+                                    const struct cpb_field_desc *field_desc,
+                                    u64_t uint64)
+{
+    union cpb_value value;
+    value.uint64 = uint64;
+    return cpb_rencoder_add_field(encoder, field_desc, &value);
+}
+
+/**
+ * Encodes a field of type 'bool'.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor of field to encode
+ * @param bool Value
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_rencoder_add_bool(struct cpb_rencoder *encoder,
+                                  const struct cpb_field_desc *field_desc,
+                                  cpb_bool_t bool)
+{
+    union cpb_value value;
+    value.bool = bool;
+    return cpb_rencoder_add_field(encoder, field_desc, &value);
+}
+
+/**
+ * Encodes a field of type 'enum'.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor of field to encode
+ * @param enum_ Value
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_rencoder_add_enum(struct cpb_rencoder *encoder,
+                                  const struct cpb_field_desc *field_desc,
+                                  cpb_enum_t enum_)
+{
+    union cpb_value value;
+    value.enum_ = enum_;
+    return cpb_rencoder_add_field(encoder, field_desc, &value);
+}
+
+/**
+ * Encodes a field of type 'string'.
+ * @note The string must be null-termiated.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor of field to encode
+ * @param str Value
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_rencoder_add_string(struct cpb_rencoder *encoder,
+                                    const struct cpb_field_desc *field_desc,
+                                    char *str)
+{
+    union cpb_value value;
+    value.string.str = str;
+    value.string.len = strlen(str);
+    return cpb_rencoder_add_field(encoder, field_desc, &value);
+}
+
+/**
+ * Encodes a field of type 'bytes'.
+ * @param encoder Encoder
+ * @param field_desc Field descriptor of field to encode
+ * @param data Bytes to encode
+ * @param len Number of bytes to encode
+ * @return Returns CPB_ERR_OK if successful.
+ */
+cpb_err_t cpb_rencoder_add_bytes(struct cpb_rencoder *encoder,
+                                   const struct cpb_field_desc *field_desc,
+                                   u8_t *data, size_t len)
+{
+    union cpb_value value;
+    value.bytes.data = data;
+    value.bytes.len = len;
+    return cpb_rencoder_add_field(encoder, field_desc, &value);
+}
@@ -0,0 +1,1237 @@
+/** @file struct_encoder.c
+ *
+ * Implementation of the protocol buffers struct encoder.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cpb/cpb.h>
+#include <cpb/core/encoder2.h>
+#include <cpb/utils/struct_encoder.h>
+
+#include "private.h"
+
+#if CPB_THREADS
+#include <pthread.h>
+#endif
+
+
+#define FIELD_BASE(_field_, _base_, _index_) \
+    ((_base_) + (_field_)->ofs + ((_field_)->len * (_index_)))
+
+/* Number of records claimed at once by a batch worker */
+#define BATCH_CHUNK 64
+
+/* Batch workers claim records with an atomic counter where available */
+#if CPB_THREADS && !defined(__GNUC__)
+#define BATCH_LOCK 1
+#else
+#define BATCH_LOCK 0
+#endif
+
+#define IS_DIRTY(_cache_, _index_) \
+    ((_cache_)->dirty[(_index_) / 32] & (1u << ((_index_) % 32)))
+
+/** Nested message sizes, passed from the sizing to the encoding pass */
+struct size_cache {
+    size_t sizes[CPB_STRUCT_SIZE_CACHE];
+    size_t next;                /**< Index of the next nested message */
+};
+
+/** Range of elements of a message field encoded by one thread */
+struct range {
+    const struct cpb_struct_map_field *field;
+    const u8_t *base;           /**< Base of the struct */
+    size_t first;               /**< Index of the first element */
+    size_t count;               /**< Number of elements */
+    size_t *sizes;              /**< Sizes of the elements */
+    u8_t *buf;                  /**< Memory buffer or NULL to only size */
+    size_t len;                 /**< Returns the number of bytes encoded */
+};
+
+/** Ranges of all parallel fields of a struct handled by one thread */
+struct worker {
+    struct range *ranges;       /**< Ranges of all threads, field by field */
+    size_t num_ranges;          /**< Number of ranges */
+    int index;                  /**< Index of the thread */
+    int num_threads;            /**< Number of threads */
+};
+
+/** Batch of records, shared by the batch workers */
+struct batch {
+    const struct cpb_struct_map *map;
+    const u8_t *structs;        /**< Array of structs */
+    size_t count;               /**< Number of structs */
+    struct cpb_iovec *spans;    /**< Encoded messages, sized in the first pass */
+    cpb_bool_t encode;          /**< Encoding pass */
+    cpb_bool_t delimited;       /**< Records are prefixed with their length */
+    size_t next;                /**< Index of the next unclaimed record */
+#if BATCH_LOCK
+    pthread_mutex_t lock;       /**< Protects next */
+#endif
+};
+
+static size_t encode_struct(const struct cpb_struct_map *map,
+                            const u8_t *base, u8_t *buf,
+                            struct size_cache *cache);
+
+/**
+ * Loads an element of a mapped field into a field value.
+ * @param field Struct map field
+ * @param base Base of the struct
+ * @param index Element index
+ * @param value Field value to load into
+ */
+static void load_value(const struct cpb_struct_map_field *field,
+                       const u8_t *base, size_t index,
+                       union cpb_value *value)
+{
+    const u8_t *elem = FIELD_BASE(field, base, index);
+    const u8_t *end;
+
+    switch (field->field_desc->opts.typ) {
+    case CPB_DOUBLE:
+        CPB_ASSERT(field->len == sizeof(double), "Field type mismatch");
+        value->double_ = *((const double *) elem);
+        break;
+    case CPB_FLOAT:
+        CPB_ASSERT(field->len == sizeof(float), "Field type mismatch");
+        value->float_ = *((const float *) elem);
+        break;
+    case CPB_INT32:
+    case CPB_SINT32:
+    case CPB_SFIXED32:
+        CPB_ASSERT(field->len == sizeof(s32_t), "Field type mismatch");
+        value->int32 = *((const s32_t *) elem);
+        break;
+    case CPB_UINT32:
+    case CPB_FIXED32:
+        CPB_ASSERT(field->len == sizeof(u32_t), "Field type mismatch");
+        value->uint32 = *((const u32_t *) elem);
+        break;
+    case CPB_INT64:
+    case CPB_SINT64:
+    case CPB_SFIXED64:
+        CPB_ASSERT(field->len == sizeof(s64_t), "Field type mismatch");
+        value->int64 = *((const s64_t *) elem);
+        break;
+    case CPB_UINT64:
+    case CPB_FIXED64:
+        CPB_ASSERT(field->len == sizeof(u64_t), "Field type mismatch");
+        value->uint64 = *((const u64_t *) elem);
+        break;
+    case CPB_BOOL:
+        CPB_ASSERT(field->len == sizeof(cpb_bool_t), "Field type mismatch");
+        value->bool = *((const cpb_bool_t *) elem);
+        break;
+    case CPB_ENUM:
+        CPB_ASSERT(field->len == sizeof(cpb_enum_t), "Field type mismatch");
+        value->enum_ = *((const cpb_enum_t *) elem);
+        break;
+    case CPB_STRING:
+        /* Strings are null-terminated unless they fill the whole array */
+        end = memchr(elem, '\0', field->len);
+        value->string.str = (char *) elem;
+        value->string.len = end ? (size_t) (end - elem) : field->len;
+        break;
+    case CPB_BYTES:
+        value->bytes.data = (u8_t *) elem;
+        value->bytes.len = field->len;
+        break;
+    default:
+        CPB_FAIL("Unsupported field type");
+        break;
+    }
+}
+
+#if CPB_FIELD_DEFAULTS
+/**
+ * Checks whether a singular optional field holds its default value. A bytes
+ * array holds its default value when it starts with the default bytes and
+ * the rest of the array is zero, an array without a default is all zero.
+ * Explicit bytes defaults whose length is not set in the field descriptor,
+ * as generated, are never matched.
+ * @param field Struct map field
+ * @param base Base of the struct
+ * @return Returns 1 if the field holds its default value, 0 otherwise.
+ */
+static cpb_bool_t is_default(const struct cpb_struct_map_field *field,
+                             const u8_t *base)
+{
+    const union cpb_value *def = &field->field_desc->def;
+    union cpb_value value;
+    size_t len;
+    size_t i;
+
+    if (field->field_desc->opts.label != CPB_OPTIONAL || field->count != 1 ||
+        field->field_desc->opts.typ == CPB_MESSAGE)
+        return 0;
+
+    load_value(field, base, 0, &value);
+
+    switch (field->field_desc->opts.typ) {
+    case CPB_DOUBLE:
+        return value.double_ == def->double_;
+    case CPB_FLOAT:
+        return value.float_ == def->float_;
+    case CPB_INT32:
+    case CPB_SINT32:
+    case CPB_SFIXED32:
+        return value.int32 == def->int32;
+    case CPB_UINT32:
+    case CPB_FIXED32:
+        return value.uint32 == def->uint32;
+    case CPB_INT64:
+    case CPB_SINT64:
+    case CPB_SFIXED64:
+        return value.int64 == def->int64;
+    case CPB_UINT64:
+    case CPB_FIXED64:
+        return value.uint64 == def->uint64;
+    case CPB_BOOL:
+        return value.bool == def->bool;
+    case CPB_ENUM:
+        return value.enum_ == def->enum_;
+    case CPB_STRING:
+        len = def->string.str ? strlen(def->string.str) : 0;
+        return value.string.len == len &&
+               memcmp(value.string.str, def->string.str, len) == 0;
+    case CPB_BYTES:
+        len = 0;
+        if (field->field_desc->opts.flags & CPB_HAS_DEFAULT) {
+            len = def->bytes.len;
+            if (!len)
+                return 0;
+        }
+        if (value.bytes.len < len ||
+            (len && memcmp(value.bytes.data, def->bytes.data, len) != 0))
+            return 0;
+        for (i = len; i < value.bytes.len; i++)
+            if (value.bytes.data[i])
+                return 0;
+        return 1;
+    default:
+        return 0;
+    }
+}
+#endif
+
+/**
+ * Checks whether a mapped field is left out when encoding, because it is not
+ * present or holds its default value, depending on the struct map flags.
+ * @param map Struct map
+ * @param field Struct map field
+ * @param base Base of the struct
+ * @return Returns 1 if the field is left out, 0 otherwise.
+ */
+static cpb_bool_t omit_field(const struct cpb_struct_map *map,
+                             const struct cpb_struct_map_field *field,
+                             const u8_t *base)
+{
+    if ((map->flags & CPB_STRUCT_MAP_PRESENCE) &&
+        !CPB_STRUCT_IS_PRESENT(map, base, field - map->fields))
+        return 1;
+
+#if CPB_FIELD_DEFAULTS
+    if ((map->flags & CPB_STRUCT_MAP_SKIP_DEFAULTS) && is_default(field, base))
+        return 1;
+#endif
+
+    return 0;
+}
+
+/**
+ * Encodes a field key, copying the pre-encoded tag if available.
+ * @param buf Memory buffer or NULL to only compute the size
+ * @param field_desc Field descriptor
+ * @param wire_type Wire type
+ * @return Returns the size of the key.
+ */
+static size_t encode_key(u8_t *buf, const struct cpb_field_desc *field_desc,
+                         enum wire_type wire_type)
+{
+#if CPB_FIELD_TAGS
+    const struct cpb_field_tag *tag;
+
+    tag = CPB_IS_PACKED_REPEATED(field_desc) ? &field_desc->packed_tag :
+                                                &field_desc->tag;
+    if (tag->len) {
+        if (buf)
+            memcpy(buf, tag->bytes, tag->len);
+        return tag->len;
+    }
+#endif
+
+    return cpb_encode_varint(buf, wire_type | (field_desc->number << 3));
+}
+
+/**
+ * Returns the encoded size of a nested message. In the sizing pass (buf is
+ * NULL), the size is computed and stored in the cache. In the encoding pass,
+ * the stored size is returned. Nested messages are numbered in the same order
+ * in both passes, those beyond the cache capacity are sized again.
+ * @param map Struct map of the nested message
+ * @param base Base of the nested struct
+ * @param buf Memory buffer or NULL in the sizing pass
+ * @param cache Size cache or NULL
+ * @return Returns the encoded size of the nested message.
+ */
+static size_t nested_size(const struct cpb_struct_map *map,
+                          const u8_t *base, u8_t *buf,
+                          struct size_cache *cache)
+{
+    size_t slot;
+    size_t size;
+
+    if (!cache)
+        return encode_struct(map, base, NULL, NULL);
+
+    slot = cache->next++;
+    if (buf && slot < CPB_STRUCT_SIZE_CACHE)
+        return cache->sizes[slot];
+
+    size = encode_struct(map, base, NULL, buf ? NULL : cache);
+    if (!buf && slot < CPB_STRUCT_SIZE_CACHE)
+        cache->sizes[slot] = size;
+
+    return size;
+}
+
+/**
+ * Encodes all elements of a mapped field.
+ * @param encoder Encoder
+ * @param field Struct map field
+ * @param base Base of the struct
+ * @param buf Memory buffer or NULL to only compute the size
+ * @param cache Size cache or NULL
+ * @return Returns the number of bytes encoded.
+ */
+static size_t encode_field(struct cpb_encoder2 *encoder,
+                           const struct cpb_struct_map_field *field,
+                           const u8_t *base, u8_t *buf,
+                           struct size_cache *cache)
+{
+    const struct cpb_field_desc *field_desc = field->field_desc;
+    const struct cpb_struct_map *map;
+    const u8_t *elem;
+    union cpb_value value;
+    size_t len = 0;
+    size_t size;
+    size_t i;
+
+#define POS (buf ? buf + len : NULL)
+
+    if (field_desc->opts.typ == CPB_MESSAGE) {
+        /* Prefix each message with its exact size and encode it in place */
+        map = (const struct cpb_struct_map *) field->len;
+        for (i = 0; i < field->count; i++) {
+            elem = base + field->ofs + map->struct_size * i;
+            size = nested_size(map, elem, buf, cache);
+            len += encode_key(POS, field_desc, WT_STRING);
+            len += cpb_encode_varint(POS, size);
+            if (buf)
+                encode_struct(map, elem, buf + len, cache);
+            len += size;
+        }
+    } else if (CPB_IS_PACKED_REPEATED(field_desc)) {
+        if (!field->count)
+            return 0;
+        size = cpb_packed_array_size(field_desc, base + field->ofs, field->count);
+        len += encode_key(POS, field_desc, WT_STRING);
+        len += cpb_encode_varint(POS, size);
+        if (buf)
+            cpb_encode_packed_array(buf + len, field_desc,
+                                    base + field->ofs, field->count);
+        len += size;
+    } else {
+        for (i = 0; i < field->count; i++) {
+            load_value(field, base, i, &value);
+            len += cpb_encoder2_add_field(encoder, field_desc, &value, POS);
+        }
+    }
+
+#undef POS
+
+    return len;
+}
+
+/**
+ * Encodes a struct as a message.
+ * @param map Struct map
+ * @param base Base of the struct
+ * @param buf Memory buffer or NULL to only compute the size
+ * @param cache Size cache or NULL
+ * @return Returns the number of bytes encoded.
+ */
+static size_t encode_struct(const struct cpb_struct_map *map,
+                            const u8_t *base, u8_t *buf,
+                            struct size_cache *cache)
+{
+    struct cpb_encoder2 encoder;
+    const struct cpb_struct_map_field *field;
+    size_t len = 0;
+
+    cpb_encoder2_init(&encoder);
+    cpb_encoder2_start(&encoder, map->msg_desc);
+
+    for (field = map->fields; field->field_desc; field++)
+        if (!omit_field(map, field, base))
+            len += encode_field(&encoder, field, base, buf ? buf + len : NULL,
+                                cache);
+
+    return len;
+}
+
+/**
+ * Fills the size cache with the sizes of the nested messages of a struct,
+ * in the order of the sizing pass, without sizing the struct itself. Used to
+ * encode a struct whose size is already known.
+ * @param map Struct map
+ * @param base Base of the struct
+ * @param cache Size cache
+ */
+static void size_nested(const struct cpb_struct_map *map, const u8_t *base,
+                        struct size_cache *cache)
+{
+    const struct cpb_struct_map_field *field;
+    const struct cpb_struct_map *nested;
+    size_t i;
+
+    for (field = map->fields; field->field_desc; field++) {
+        if (field->field_desc->opts.typ != CPB_MESSAGE ||
+            omit_field(map, field, base))
+            continue;
+        nested = (const struct cpb_struct_map *) field->len;
+        for (i = 0; i < field->count; i++)
+            nested_size(nested, base + field->ofs + nested->struct_size * i,
+                        NULL, cache);
+    }
+}
+
+/**
+ * Sizes or encodes a range of elements of a message field. The sizing pass
+ * keeps the size of each element, so the encoding pass only sizes the nested
+ * messages within the elements.
+ * @param range Range of elements
+ */
+static void encode_range(struct range *range)
+{
+    const struct cpb_struct_map *map;
+    const u8_t *elem;
+    struct size_cache cache;
+    u8_t *buf = range->buf;
+    size_t len = 0;
+    size_t size;
+    size_t i;
+
+    map = (const struct cpb_struct_map *) range->field->len;
+    for (i = 0; i < range->count; i++) {
+        elem = range->base + range->field->ofs +
+               map->struct_size * (range->first + i);
+        if (!buf) {
+            size = encode_struct(map, elem, NULL, NULL);
+            range->sizes[i] = size;
+        } else {
+            size = range->sizes[i];
+            cache.next = 0;
+            size_nested(map, elem, &cache);
+        }
+        len += encode_key(buf ? buf + len : NULL, range->field->field_desc,
+                          WT_STRING);
+        len += cpb_encode_varint(buf ? buf + len : NULL, size);
+        if (buf) {
+            cache.next = 0;
+            encode_struct(map, elem, buf + len, &cache);
+        }
+        len += size;
+    }
+
+    range->len = len;
+}
+
+/**
+ * Sizes or encodes the ranges of a thread, one range of each parallel field.
+ * @param arg Worker
+ * @return Returns NULL.
+ */
+static void *run_worker(void *arg)
+{
+    struct worker *worker = arg;
+    size_t i;
+
+    for (i = worker->index; i < worker->num_ranges; i += worker->num_threads)
+        encode_range(&worker->ranges[i]);
+
+    return NULL;
+}
+
+/**
+ * Claims the next chunk of records of a batch.
+ * @param batch Batch
+ * @param first Returns the index of the first record
+ * @param count Returns the number of records
+ * @return Returns 1 if records were claimed, 0 if all records are claimed.
+ */
+static cpb_bool_t claim_records(struct batch *batch, size_t *first, size_t *count)
+{
+#if CPB_THREADS && !BATCH_LOCK
+    *first = __sync_fetch_and_add(&batch->next, BATCH_CHUNK);
+#else
+#if BATCH_LOCK
+    pthread_mutex_lock(&batch->lock);
+#endif
+    *first = batch->next;
+    batch->next += BATCH_CHUNK;
+#if BATCH_LOCK
+    pthread_mutex_unlock(&batch->lock);
+#endif
+#endif
+
+    if (*first >= batch->count)
+        return 0;
+
+    *count = batch->count - *first;
+    if (*count > BATCH_CHUNK)
+        *count = BATCH_CHUNK;
+
+    return 1;
+}
+
+/**
+ * Sizes or encodes records of a batch until all records are claimed. Each
+ * record is written to its span, its length prefix right before it. The
+ * encoding pass takes the record size from the span and only sizes the
+ * nested messages.
+ * @param arg Batch
+ * @return Returns NULL.
+ */
+static void *run_batch_worker(void *arg)
+{
+    struct batch *batch = arg;
+    const u8_t *elem;
+    struct size_cache cache;
+    struct cpb_iovec *span;
+    size_t first, count;
+    size_t i;
+
+    while (claim_records(batch, &first, &count)) {
+        for (i = first; i < first + count; i++) {
+            elem = batch->structs + batch->map->struct_size * i;
+            span = &batch->spans[i];
+            if (!batch->encode) {
+                span->len = encode_struct(batch->map, elem, NULL, NULL);
+                continue;
+            }
+            cache.next = 0;
+            size_nested(batch->map, elem, &cache);
+            cache.next = 0;
+            encode_struct(batch->map, elem, span->base, &cache);
+            if (batch->delimited)
+                cpb_encode_varint((u8_t *) span->base -
+                                  cpb_varint_size(span->len), span->len);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Runs a function in several threads, the first one in the calling thread.
+ * A function whose thread cannot be created is run in the calling thread as
+ * well.
+ * @param fn Function to run
+ * @param args Arguments of the threads
+ * @param arg_size Size of an argument, 0 to pass the same argument to all
+ * @param num_threads Number of threads
+ */
+static void run_threads(void *(*fn)(void *), void *args, size_t arg_size,
+                        int num_threads)
+{
+#if CPB_THREADS
+    pthread_t threads[CPB_MAX_THREADS];
+    cpb_bool_t started[CPB_MAX_THREADS];
+    int i;
+
+    for (i = 1; i < num_threads; i++)
+        started[i] = pthread_create(&threads[i], NULL, fn,
+                                    (u8_t *) args + arg_size * i) == 0;
+
+    fn(args);
+
+    for (i = 1; i < num_threads; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else
+            fn((u8_t *) args + arg_size * i);
+    }
+#else
+    int i;
+
+    for (i = 0; i < num_threads; i++)
+        fn((u8_t *) args + arg_size * i);
+#endif
+}
+
+/**
+ * Returns the number of threads encoding the elements of a mapped field.
+ * @param map Struct map
+ * @param field Struct map field
+ * @param base Base of the struct
+ * @param num_threads Number of threads available
+ * @return Returns the number of threads, at least CPB_PARALLEL_MIN_ELEMENTS
+ * elements each, or 0 if the field is encoded by the calling thread.
+ */
+static int field_threads(const struct cpb_struct_map *map,
+                         const struct cpb_struct_map_field *field,
+                         const u8_t *base, int num_threads)
+{
+    size_t threads = field->count / CPB_PARALLEL_MIN_ELEMENTS;
+
+    if (field->field_desc->opts.typ != CPB_MESSAGE || threads < 2 ||
+        omit_field(map, field, base))
+        return 0;
+
+    return threads < (size_t) num_threads ? (int) threads : num_threads;
+}
+
+/**
+ * Returns the exact encoded size of a mapped field.
+ * @param map Struct map
+ * @param field Struct map field
+ * @param base Base of the struct
+ * @return Returns the number of bytes encode_field_at() encodes.
+ */
+static size_t field_size(const struct cpb_struct_map *map,
+                         const struct cpb_struct_map_field *field,
+                         const u8_t *base)
+{
+    struct cpb_encoder2 encoder;
+
+    if (omit_field(map, field, base))
+        return 0;
+
+    cpb_encoder2_init(&encoder);
+    cpb_encoder2_start(&encoder, map->msg_desc);
+
+    return encode_field(&encoder, field, base, NULL, NULL);
+}
+
+/**
+ * Encodes a mapped field of known size in place.
+ * @param map Struct map
+ * @param field Struct map field
+ * @param base Base of the struct
+ * @param buf Memory buffer
+ */
+static void encode_field_at(const struct cpb_struct_map *map,
+                            const struct cpb_struct_map_field *field,
+                            const u8_t *base, u8_t *buf)
+{
+    struct cpb_encoder2 encoder;
+    struct size_cache cache;
+
+    if (omit_field(map, field, base))
+        return;
+
+    cpb_encoder2_init(&encoder);
+    cpb_encoder2_start(&encoder, map->msg_desc);
+    cache.next = 0;
+    encode_field(&encoder, field, base, NULL, &cache);
+    cache.next = 0;
+    encode_field(&encoder, field, base, buf, &cache);
+}
+
+static cpb_bool_t struct_differs(const struct cpb_struct_map *map,
+                                 const u8_t *old_base, const u8_t *new_base);
+
+/**
+ * Checks whether a mapped field differs between two structs. Strings are
+ * compared up to their null character, nested messages field by field.
+ * @param field Struct map field
+ * @param old_base Base of the old struct
+ * @param new_base Base of the new struct
+ * @return Returns 1 if the field differs, 0 otherwise.
+ */
+static cpb_bool_t field_differs(const struct cpb_struct_map_field *field,
+                                const u8_t *old_base, const u8_t *new_base)
+{
+    const struct cpb_struct_map *map;
+    size_t i;
+
+    switch (field->field_desc->opts.typ) {
+    case CPB_MESSAGE:
+        map = (const struct cpb_struct_map *) field->len;
+        for (i = 0; i < field->count; i++)
+            if (struct_differs(map, old_base + field->ofs + map->struct_size * i,
+                               new_base + field->ofs + map->struct_size * i))
+                return 1;
+        return 0;
+    case CPB_STRING:
+        for (i = 0; i < field->count; i++)
+            if (strncmp((const char *) FIELD_BASE(field, old_base, i),
+                        (const char *) FIELD_BASE(field, new_base, i),
+                        field->len) != 0)
+                return 1;
+        return 0;
+    default:
+        return memcmp(old_base + field->ofs, new_base + field->ofs,
+                      field->len * field->count) != 0;
+    }
+}
+
+/**
+ * Checks whether two structs differ in any mapped field. Fields absent from
+ * both structs are not compared.
+ * @param map Struct map
+ * @param old_base Base of the old struct
+ * @param new_base Base of the new struct
+ * @return Returns 1 if the structs differ, 0 otherwise.
+ */
+static cpb_bool_t struct_differs(const struct cpb_struct_map *map,
+                                 const u8_t *old_base, const u8_t *new_base)
+{
+    const struct cpb_struct_map_field *field;
+    cpb_bool_t present;
+
+    for (field = map->fields; field->field_desc; field++) {
+        if (map->flags & CPB_STRUCT_MAP_PRESENCE) {
+            present = CPB_STRUCT_IS_PRESENT(map, new_base, field - map->fields);
+            if (present != CPB_STRUCT_IS_PRESENT(map, old_base,
+                                                 field - map->fields))
+                return 1;
+            if (!present)
+                continue;
+        }
+        if (field_differs(field, old_base, new_base))
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Encodes the fields of a struct that differ from an old struct. Singular
+ * nested messages are compared field by field, other fields are encoded as a
+ * whole if any of their elements differ. Fields are encoded even if their new
+ * value is the default value, fields that became present as a whole.
+ * @param map Struct map
+ * @param old_base Base of the old struct
+ * @param new_base Base of the new struct
+ * @param buf Memory buffer or NULL to only compute the size
+ * @param cleared Set to 1 if a field present in the old struct is absent
+ * from the new struct
+ * @return Returns the number of bytes encoded.
+ */
+static size_t diff_struct(const struct cpb_struct_map *map,
+                          const u8_t *old_base, const u8_t *new_base,
+                          u8_t *buf, cpb_bool_t *cleared)
+{
+    struct cpb_encoder2 encoder;
+    const struct cpb_struct_map_field *field;
+    const struct cpb_struct_map *nested;
+    size_t len = 0;
+    size_t size;
+    int index;
+
+#define POS (buf ? buf + len : NULL)
+
+    cpb_encoder2_init(&encoder);
+    cpb_encoder2_start(&encoder, map->msg_desc);
+
+    for (field = map->fields; field->field_desc; field++) {
+        if (map->flags & CPB_STRUCT_MAP_PRESENCE) {
+            index = field - map->fields;
+            if (!CPB_STRUCT_IS_PRESENT(map, new_base, index)) {
+                if (CPB_STRUCT_IS_PRESENT(map, old_base, index))
+                    *cleared = 1;
+                continue;
+            }
+            if (!CPB_STRUCT_IS_PRESENT(map, old_base, index)) {
+                len += encode_field(&encoder, field, new_base, POS, NULL);
+                continue;
+            }
+        }
+        if (!field_differs(field, old_base, new_base))
+            continue;
+
+        if (field->field_desc->opts.typ == CPB_MESSAGE &&
+            field->field_desc->opts.label != CPB_REPEATED && field->count == 1) {
+            nested = (const struct cpb_struct_map *) field->len;
+            size = diff_struct(nested, old_base + field->ofs,
+                               new_base + field->ofs, NULL, cleared);
+            len += encode_key(POS, field->field_desc, WT_STRING);
+            len += cpb_encode_varint(POS, size);
+            if (buf)
+                diff_struct(nested, old_base + field->ofs,
+                            new_base + field->ofs, buf + len, cleared);
+            len += size;
+        } else {
+            len += encode_field(&encoder, field, new_base, POS, NULL);
+        }
+    }
+
+#undef POS
+
+    return len;
+}
+
+
+/* Struct encoder */
+
+/**
+ * Computes the exact encoded size of a struct.
+ * @param struct_map Struct map used for encoding
+ * @param struct_base Base of the struct to encode
+ * @return Returns the number of bytes cpb_struct_encode() will encode.
+ */
+size_t cpb_encoded_size(const struct cpb_struct_map *struct_map,
+                        const void *struct_base)
+{
+    return encode_struct(struct_map, struct_base, NULL, NULL);
+}
+
+/**
+ * Encodes a struct into a protocol buffer. The exact encoded size is computed
+ * first, so nested messages are written in place behind their final length
+ * prefix and no byte is moved after it has been written. The sizes of the
+ * first CPB_STRUCT_SIZE_CACHE nested messages are kept from the sizing pass.
+ * @note All 'count' elements of a mapped field are encoded. Strings end at the
+ * first null character or at the end of their array, bytes fields are always
+ * encoded with their full array length.
+ * @param struct_map Struct map used for encoding
+ * @param struct_base Base of the struct to encode
+ * @param data Data buffer to encode into
+ * @param len Length of data buffer
+ * @param used Returns the number of encoded bytes when not NULL.
+ * @return Returns CPB_ERR_OK when the struct was successfully encoded or
+ * CPB_ERR_END_OF_BUF if the data buffer is too small.
+ */
+cpb_err_t cpb_struct_encode(const struct cpb_struct_map *struct_map,
+                              const void *struct_base,
+                              void *data, size_t len, size_t *used)
+{
+    struct size_cache cache;
+    size_t size;
+
+    cache.next = 0;
+    size = encode_struct(struct_map, struct_base, NULL, &cache);
+    if (size > len)
+        return CPB_ERR_END_OF_BUF;
+
+    cache.next = 0;
+    encode_struct(struct_map, struct_base, data, &cache);
+
+    if (used)
+        *used = size;
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Encodes the differences between two structs as a delta message. Fields
+ * that are equal in both structs are left out and singular nested messages
+ * only hold their fields that differ. Since singular fields of a merged
+ * message take the last value, merging the delta into the encoded old struct
+ * gives the encoded new struct. Repeated fields are encoded with all their
+ * elements, cpb_struct_apply_delta() replaces them element by element.
+ * Fields changed to their default value are encoded, even with
+ * CPB_STRUCT_MAP_SKIP_DEFAULTS.
+ * @note Identical structs give an empty delta. A merged delta cannot remove a
+ * field, so a field present in the old struct must not be absent from the new
+ * one with CPB_STRUCT_MAP_PRESENCE.
+ * @param struct_map Struct map used for encoding
+ * @param old_base Base of the old struct
+ * @param new_base Base of the new struct
+ * @param data Data buffer to encode into
+ * @param len Length of data buffer
+ * @param used Returns the number of encoded bytes when not NULL.
+ * @return Returns CPB_ERR_OK when the delta was successfully encoded,
+ * CPB_ERR_INVALID_FIELD if a field present in the old struct is absent from
+ * the new struct or CPB_ERR_END_OF_BUF if the data buffer is too small.
+ */
+cpb_err_t cpb_struct_diff_encode(const struct cpb_struct_map *struct_map,
+                                   const void *old_base, const void *new_base,
+                                   void *data, size_t len, size_t *used)
+{
+    cpb_bool_t cleared = 0;
+    size_t size;
+
+    size = diff_struct(struct_map, old_base, new_base, NULL, &cleared);
+    if (cleared)
+        return CPB_ERR_INVALID_FIELD;
+    if (size > len)
+        return CPB_ERR_END_OF_BUF;
+
+    diff_struct(struct_map, old_base, new_base, data, &cleared);
+
+    if (used)
+        *used = size;
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Encodes a struct into a protocol buffer, spreading the elements of repeated
+ * message fields over several threads. The elements of each such field are
+ * split into contiguous ranges, one per thread. The threads size their range
+ * of every field first, which gives each range its offset, then encode it at
+ * its final offset, so the result is the same as with cpb_struct_encode().
+ * Other fields and nested messages within the elements are encoded by the
+ * calling thread and the thread of the element respectively.
+ * @note Threads are created twice per call, for the sizing and the encoding
+ * pass of all fields, and only for fields with at least
+ * CPB_PARALLEL_MIN_ELEMENTS elements per thread. The element sizes are kept
+ * between the passes in scratch memory from the allocator; without it the
+ * struct is encoded by the calling thread alone. The struct must not be
+ * modified while it is encoded.
+ * @param struct_map Struct map used for encoding
+ * @param struct_base Base of the struct to encode
+ * @param data Data buffer to encode into
+ * @param len Length of data buffer
+ * @param used Returns the number of encoded bytes when not NULL.
+ * @param num_threads Number of threads, up to CPB_MAX_THREADS
+ * @param allocator Allocator of the scratch memory, NULL for the default
+ * allocator
+ * @return Returns CPB_ERR_OK when the struct was successfully encoded or
+ * CPB_ERR_END_OF_BUF if the data buffer is too small.
+ */
+cpb_err_t cpb_struct_encode_parallel(const struct cpb_struct_map *struct_map,
+                                       const void *struct_base,
+                                       void *data, size_t len, size_t *used,
+                                       int num_threads,
+                                       const struct cpb_allocator *allocator)
+{
+    struct cpb_encoder2 encoder;
+    const struct cpb_struct_map_field *field;
+    struct worker workers[CPB_MAX_THREADS];
+    struct size_cache cache;
+    struct range *ranges, *range;
+    size_t *sizes;
+    u8_t *buf = data;
+    size_t num_ranges = 0;
+    size_t num_sizes = 0;
+    size_t pos = 0;
+    size_t size;
+    int max_threads = 0;
+    int threads;
+    int i;
+    cpb_err_t ret = CPB_ERR_OK;
+
+    CPB_ASSERT(num_threads > 0 && num_threads <= CPB_MAX_THREADS,
+               "Invalid number of threads");
+
+    if (!allocator)
+        allocator = &cpb_default_allocator;
+
+    for (field = struct_map->fields; field->field_desc; field++) {
+        threads = field_threads(struct_map, field, struct_base, num_threads);
+        if (!threads)
+            continue;
+        if (threads > max_threads)
+            max_threads = threads;
+        num_ranges++;
+        num_sizes += field->count;
+    }
+    if (!num_ranges)
+        return cpb_struct_encode(struct_map, struct_base, data, len, used);
+
+    /* One slot per thread for each field, then the element sizes */
+    num_ranges *= max_threads;
+    ranges = allocator->alloc(allocator->ctx, num_ranges * sizeof(*ranges) +
+                                              num_sizes * sizeof(*sizes));
+    if (!ranges)
+        return cpb_struct_encode(struct_map, struct_base, data, len, used);
+    sizes = (size_t *) (ranges + num_ranges);
+
+    range = ranges;
+    for (field = struct_map->fields; field->field_desc; field++) {
+        threads = field_threads(struct_map, field, struct_base, num_threads);
+        if (!threads)
+            continue;
+        for (i = 0; i < max_threads; i++, range++) {
+            range->field = field;
+            range->base = struct_base;
+            range->first = i < threads ? field->count * i / threads : 0;
+            range->count = i < threads ?
+                           field->count * (i + 1) / threads - range->first : 0;
+            range->sizes = sizes + range->first;
+            range->buf = NULL;
+        }
+        sizes += field->count;
+    }
+
+    for (i = 0; i < max_threads; i++) {
+        workers[i].ranges = ranges;
+        workers[i].num_ranges = num_ranges;
+        workers[i].index = i;
+        workers[i].num_threads = max_threads;
+    }
+    run_threads(run_worker, workers, sizeof(*workers), max_threads);
+
+    /* Other fields are encoded in between the ranges, at their final offset */
+    cpb_encoder2_init(&encoder);
+    cpb_encoder2_start(&encoder, struct_map->msg_desc);
+
+    range = ranges;
+    for (field = struct_map->fields; field->field_desc; field++) {
+        if (field_threads(struct_map, field, struct_base, num_threads)) {
+            for (i = 0; i < max_threads; i++, range++) {
+                range->buf = buf + pos;
+                pos += range->len;
+            }
+            if (pos > len) {
+                ret = CPB_ERR_END_OF_BUF;
+                break;
+            }
+            continue;
+        }
+        if (omit_field(struct_map, field, struct_base))
+            continue;
+        cache.next = 0;
+        size = encode_field(&encoder, field, struct_base, NULL, &cache);
+        if (size > len - pos) {
+            ret = CPB_ERR_END_OF_BUF;
+            break;
+        }
+        cache.next = 0;
+        encode_field(&encoder, field, struct_base, buf + pos, &cache);
+        pos += size;
+    }
+
+    if (ret == CPB_ERR_OK)
+        run_threads(run_worker, workers, sizeof(*workers), max_threads);
+
+    allocator->free(allocator->ctx, ranges);
+
+    if (ret == CPB_ERR_OK && used)
+        *used = pos;
+
+    return ret;
+}
+
+/**
+ * Encodes an array of structs as a batch of records, spreading the records
+ * over several threads. The records are sized first, which gives each record
+ * its exact offset in the data buffer, then encoded straight to their final
+ * position. Threads claim chunks of records as they go, so the work is
+ * balanced even when record sizes vary.
+ * @note Records are either length-delimited, forming a stream of delimited
+ * messages, or plain messages following each other. The spans locate the
+ * messages without their length prefix in both cases.
+ * @param struct_map Struct map used for encoding
+ * @param structs Array of structs to encode
+ * @param count Number of structs
+ * @param delimited Prefix each record with its length
+ * @param data Data buffer to encode into
+ * @param len Length of data buffer
+ * @param spans Returns the location of each encoded message
+ * @param used Returns the number of encoded bytes when not NULL.
+ * @param num_threads Number of threads, up to CPB_MAX_THREADS
+ * @return Returns CPB_ERR_OK when the structs were successfully encoded or
+ * CPB_ERR_END_OF_BUF if the data buffer is too small.
+ */
+cpb_err_t cpb_struct_encode_batch(const struct cpb_struct_map *struct_map,
+                                    const void *structs, size_t count,
+                                    cpb_bool_t delimited,
+                                    void *data, size_t len,
+                                    struct cpb_iovec *spans, size_t *used,
+                                    int num_threads)
+{
+    struct batch batch;
+    size_t pos = 0;
+    size_t i;
+
+    CPB_ASSERT(num_threads > 0 && num_threads <= CPB_MAX_THREADS,
+               "Invalid number of threads");
+
+    /* No more threads than chunks of records */
+    if ((size_t) num_threads > (count + BATCH_CHUNK - 1) / BATCH_CHUNK)
+        num_threads = count ? (int) ((count + BATCH_CHUNK - 1) / BATCH_CHUNK) : 1;
+
+    batch.map = struct_map;
+    batch.structs = structs;
+    batch.count = count;
+    batch.spans = spans;
+    batch.delimited = delimited;
+#if BATCH_LOCK
+    pthread_mutex_init(&batch.lock, NULL);
+#endif
+
+    batch.encode = 0;
+    batch.next = 0;
+    run_threads(run_batch_worker, &batch, 0, num_threads);
+
+    /* Assign the offsets */
+    for (i = 0; i < count; i++) {
+        if (delimited)
+            pos += cpb_varint_size(spans[i].len);
+        spans[i].base = (u8_t *) data + pos;
+        pos += spans[i].len;
+    }
+
+    if (pos <= len) {
+        batch.encode = 1;
+        batch.next = 0;
+        run_threads(run_batch_worker, &batch, 0, num_threads);
+    }
+
+#if BATCH_LOCK
+    pthread_mutex_destroy(&batch.lock);
+#endif
+
+    if (pos > len)
+        return CPB_ERR_END_OF_BUF;
+
+    if (used)
+        *used = pos;
+
+    return CPB_ERR_OK;
+}
+
+
+/* Struct encoding cache */
+
+/**
+ * Initializes a struct encoding cache. All fields are dirty, so the first
+ * cpb_struct_cache_encode() encodes the whole struct. A struct map with more
+ * than CPB_MAX_CACHED_FIELDS fields is not tracked field by field, the whole
+ * struct is encoded every time then.
+ * @param cache Struct encoding cache
+ * @param struct_map Struct map used for encoding
+ * @param data Data buffer holding the encoded message
+ * @param len Length of data buffer
+ */
+void cpb_struct_cache_init(struct cpb_struct_cache *cache,
+                           const struct cpb_struct_map *struct_map,
+                           void *data, size_t len)
+{
+    const struct cpb_struct_map_field *field;
+    int i;
+
+    cache->map = struct_map;
+    cache->data = data;
+    cache->len = len;
+    cache->used = 0;
+
+    cache->num_fields = 0;
+    for (field = struct_map->fields; field->field_desc; field++)
+        cache->num_fields++;
+    cache->whole = cache->num_fields > CPB_MAX_CACHED_FIELDS;
+    if (cache->whole)
+        cache->num_fields = 0;
+
+    for (i = 0; i <= cache->num_fields; i++)
+        cache->ofs[i] = 0;
+    memset(cache->dirty, 0xff, sizeof(cache->dirty));
+}
+
+/**
+ * Marks a field as changed, it is re-encoded by the next
+ * cpb_struct_cache_encode().
+ * @param cache Struct encoding cache
+ * @param field_desc Field descriptor of the changed field
+ */
+void cpb_struct_cache_mark_dirty(struct cpb_struct_cache *cache,
+                                 const struct cpb_field_desc *field_desc)
+{
+    int i;
+
+    for (i = 0; i < cache->num_fields; i++)
+        if (cache->map->fields[i].field_desc == field_desc)
+            cache->dirty[i / 32] |= 1u << (i % 32);
+}
+
+/**
+ * Marks a field as changed by its index in the struct map, without looking
+ * up its field descriptor.
+ * @param cache Struct encoding cache
+ * @param index Index of the changed field in the struct map
+ */
+void cpb_struct_cache_mark_dirty_index(struct cpb_struct_cache *cache,
+                                       int index)
+{
+    if (index >= 0 && index < cache->num_fields)
+        cache->dirty[index / 32] |= 1u << (index % 32);
+}
+
+/**
+ * Brings the encoded message of a struct up to date. Only dirty fields are
+ * encoded again. When their sizes are unchanged, they are overwritten in
+ * place. Otherwise the clean fields are moved to their new offsets first,
+ * the ones moving towards the front in order and the others in reverse
+ * order, so no field overwrites another field that has yet to move.
+ * @note Changes to fields that are not marked dirty are not encoded, unless
+ * the whole struct is encoded because the struct map has too many fields.
+ * @param cache Struct encoding cache
+ * @param struct_base Base of the struct to encode
+ * @param used Returns the length of the encoded message when not NULL.
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_END_OF_BUF if the data
+ * buffer is too small, the encoded message is left unchanged then.
+ */
+cpb_err_t cpb_struct_cache_encode(struct cpb_struct_cache *cache,
+                                    const void *struct_base, size_t *used)
+{
+    const struct cpb_struct_map_field *fields = cache->map->fields;
+    size_t ofs[CPB_MAX_CACHED_FIELDS + 1];
+    size_t size;
+    cpb_bool_t moved = 0;
+    cpb_err_t ret;
+    int i;
+
+    if (cache->whole) {
+        ret = cpb_struct_encode(cache->map, struct_base, cache->data,
+                                cache->len, &cache->used);
+        if (ret == CPB_ERR_OK && used)
+            *used = cache->used;
+        return ret;
+    }
+
+    /* New offsets of the fields */
+    ofs[0] = 0;
+    for (i = 0; i < cache->num_fields; i++) {
+        if (IS_DIRTY(cache, i))
+            size = field_size(cache->map, &fields[i], struct_base);
+        else
+            size = cache->ofs[i + 1] - cache->ofs[i];
+        ofs[i + 1] = ofs[i] + size;
+        if (ofs[i + 1] != cache->ofs[i + 1])
+            moved = 1;
+    }
+    if (ofs[cache->num_fields] > cache->len)
+        return CPB_ERR_END_OF_BUF;
+
+    if (moved) {
+        for (i = 0; i < cache->num_fields; i++)
+            if (!IS_DIRTY(cache, i) && ofs[i] < cache->ofs[i])
+                memmove(cache->data + ofs[i], cache->data + cache->ofs[i],
+                        ofs[i + 1] - ofs[i]);
+        for (i = cache->num_fields - 1; i >= 0; i--)
+            if (!IS_DIRTY(cache, i) && ofs[i] > cache->ofs[i])
+                memmove(cache->data + ofs[i], cache->data + cache->ofs[i],
+                        ofs[i + 1] - ofs[i]);
+        memcpy(cache->ofs, ofs, (cache->num_fields + 1) * sizeof(ofs[0]));
+    }
+
+    for (i = 0; i < cache->num_fields; i++)
+        if (IS_DIRTY(cache, i))
+            encode_field_at(cache->map, &fields[i], struct_base,
+                            cache->data + ofs[i]);
+
+    memset(cache->dirty, 0, sizeof(cache->dirty));
+    cache->used = ofs[cache->num_fields];
+
+    if (used)
+        *used = cache->used;
+
+    return CPB_ERR_OK;
+}
@@ -0,0 +1,329 @@
+/** @file template.c
+ *
+ * Implementation of message templates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cpb/cpb.h>
+#include <cpb/core/encoder2.h>
+#include <cpb/utils/template.h>
+
+#include "private.h"
+
+
+/**
+ * Encodes a field value without key.
+ * @param buf Memory buffer or NULL to only compute the size
+ * @param field_desc Field descriptor
+ * @param value Field value
+ * @return Returns the number of bytes encoded.
+ */
+static size_t encode_value(u8_t *buf, const struct cpb_field_desc *field_desc,
+                           const union cpb_value *value)
+{
+    union wire_value wire_value;
+    size_t size;
+
+    switch (cpb_value_to_wire(field_desc, value, &wire_value)) {
+    case WT_VARINT:
+        return cpb_encode_varint(buf, wire_value.varint);
+    case WT_64BIT:
+        return cpb_encode_64bit(buf, wire_value.int64);
+    case WT_32BIT:
+        return cpb_encode_32bit(buf, wire_value.int32);
+    case WT_STRING:
+        size = cpb_encode_varint(buf, wire_value.string.len);
+        if (buf && wire_value.string.len)
+            memcpy(buf + size, wire_value.string.data, wire_value.string.len);
+        return size + wire_value.string.len;
+    default:
+        CPB_FAIL("Unsupported field type");
+        return 0;
+    }
+}
+
+/**
+ * Scans the fields of an encoded message for placeholders, descending into
+ * nested messages.
+ * @param tmpl Template
+ * @param msg_desc Message descriptor
+ * @param start Offset of the first field
+ * @param end Offset of the end of the message
+ * @param fields Placeholder fields
+ * @param num_fields Number of placeholder fields
+ * @return Returns CPB_ERR_OK if successful, CPB_ERR_MEM if there are too many
+ * placeholders or nested messages holding them, CPB_ERR_END_OF_BUF if the
+ * message is truncated or CPB_ERR_INVALID_WIRE_TYPE if it contains invalid
+ * data.
+ */
+static cpb_err_t scan_message(struct cpb_template *tmpl,
+                              const struct cpb_msg_desc *msg_desc,
+                              size_t start, size_t end,
+                              const struct cpb_field_desc * const *fields,
+                              int num_fields)
+{
+    const struct cpb_field_desc *field_desc;
+    struct cpb_template_len *nested;
+    struct cpb_template_slot *slot;
+    struct cpb_buf buf;
+    cpb_err_t ret;
+    u64_t key;
+    u64_t len;
+    size_t ofs;
+    int num_slots, num_lens;
+    int i;
+
+    buf.base = buf.pos = (u8_t *) tmpl->data + start;
+    buf.end = (u8_t *) tmpl->data + end;
+
+    while (buf.pos < buf.end) {
+        ret = cpb_decode_varint(&buf, &key);
+        if (ret != CPB_ERR_OK)
+            return ret;
+        ofs = buf.pos - tmpl->data;
+
+        /* Find the field, fields of other wire types are skipped */
+        field_desc = NULL;
+        for (i = 0; i < msg_desc->num_fields; i++)
+            if (msg_desc->fields[i].number == (key >> 3)) {
+                field_desc = &msg_desc->fields[i];
+                break;
+            }
+        if (field_desc && CPB_WIRE_TYPE(field_desc->opts.typ) != (key & 0x07))
+            field_desc = NULL;
+
+        if (field_desc && field_desc->opts.typ == CPB_MESSAGE) {
+            ret = cpb_decode_varint(&buf, &len);
+            if (ret != CPB_ERR_OK)
+                return ret;
+            if (len > cpb_buf_left(&buf))
+                return CPB_ERR_END_OF_BUF;
+
+            /* Record the length prefix, it is dropped if not needed */
+            num_slots = tmpl->num_slots;
+            num_lens = tmpl->num_lens;
+            if (num_lens < CPB_MAX_TEMPLATE_LENS) {
+                nested = &tmpl->lens[tmpl->num_lens++];
+                nested->ofs = ofs;
+                nested->width = (buf.pos - tmpl->data) - ofs;
+                nested->end = (buf.pos - tmpl->data) + len;
+            }
+
+            ret = scan_message(tmpl, field_desc->msg_desc,
+                               buf.pos - tmpl->data,
+                               (buf.pos - tmpl->data) + len,
+                               fields, num_fields);
+            if (ret != CPB_ERR_OK)
+                return ret;
+
+            if (tmpl->num_slots == num_slots)
+                tmpl->num_lens = num_lens;
+            else if (num_lens == CPB_MAX_TEMPLATE_LENS)
+                return CPB_ERR_MEM;
+
+            buf.pos += len;
+            continue;
+        }
+
+        ret = cpb_skip_field(&buf, key & 0x07, key >> 3);
+        if (ret != CPB_ERR_OK)
+            return ret;
+
+        if (!field_desc)
+            continue;
+        for (i = 0; i < num_fields; i++)
+            if (fields[i] == field_desc)
+                break;
+        if (i == num_fields)
+            continue;
+
+        if (tmpl->num_slots == CPB_MAX_TEMPLATE_SLOTS)
+            return CPB_ERR_MEM;
+        slot = &tmpl->slots[tmpl->num_slots++];
+        slot->field_desc = field_desc;
+        slot->ofs = ofs;
+        slot->width = (buf.pos - tmpl->data) - ofs;
+    }
+
+    return CPB_ERR_OK;
+}
+
+/**
+ * Computes the layout of a stamped message.
+ * @param tmpl Template
+ * @param values Placeholder values
+ * @param widths Returns the widths of the encoded values
+ * @param lens Returns the new lengths of the nested messages
+ * @param len_widths Returns the widths of the new length prefixes
+ * @return Returns the size of the stamped message.
+ */
+static size_t layout(const struct cpb_template *tmpl,
+                     const union cpb_value *values,
+                     size_t *widths, size_t *lens, size_t *len_widths)
+{
+    const struct cpb_template_slot *slot;
+    const struct cpb_template_len *nested;
+    size_t size = tmpl->len;
+    size_t body;
+    int i, j, k;
+
+    for (i = 0; i < tmpl->num_slots; i++) {
+        slot = &tmpl->slots[i];
+        widths[i] = encode_value(NULL, slot->field_desc, &values[i]);
+        size = size + widths[i] - slot->width;
+    }
+
+    /* Nested messages follow their parent, so inner lengths come first */
+    for (j = tmpl->num_lens - 1; j >= 0; j--) {
+        nested = &tmpl->lens[j];
+        body = nested->ofs + nested->width;
+        lens[j] = nested->end - body;
+        for (i = 0; i < tmpl->num_slots; i++)
+            if (tmpl->slots[i].ofs >= body && tmpl->slots[i].ofs < nested->end)
+                lens[j] = lens[j] + widths[i] - tmpl->slots[i].width;
+        for (k = j + 1; k < tmpl->num_lens && tmpl->lens[k].ofs < nested->end; k++)
+            lens[j] = lens[j] + len_widths[k] - tmpl->lens[k].width;
+        len_widths[j] = cpb_varint_size(lens[j]);
+        size = size + len_widths[j] - nested->width;
+    }
+
+    return size;
+}
+
+
+/* Template */
+
+/**
+ * Creates a template from an encoded message. Every occurrence of one of the
+ * placeholder fields becomes a slot, numbered in order of occurrence, also
+ * within nested messages. Message fields cannot be placeholders.
+ * @note The template refers to the encoded message, which must be kept
+ * unchanged while the template is used.
+ * @param tmpl Template
+ * @param msg_desc Message descriptor
+ * @param data Encoded message
+ * @param len Length of encoded message
+ * @param fields Placeholder fields
+ * @param num_fields Number of placeholder fields
+ * @return Returns CPB_ERR_OK if successful, CPB_ERR_MEM if there are more
+ * than CPB_MAX_TEMPLATE_SLOTS placeholders or more than CPB_MAX_TEMPLATE_LENS
+ * nested messages holding them, CPB_ERR_END_OF_BUF if the message is
+ * truncated or CPB_ERR_INVALID_WIRE_TYPE if it contains invalid data.
+ */
+cpb_err_t cpb_template_create(struct cpb_template *tmpl,
+                                const struct cpb_msg_desc *msg_desc,
+                                const void *data, size_t len,
+                                const struct cpb_field_desc * const *fields,
+                                int num_fields)
+{
+    tmpl->msg_desc = msg_desc;
+    tmpl->data = data;
+    tmpl->len = len;
+    tmpl->num_slots = 0;
+    tmpl->num_lens = 0;
+
+    return scan_message(tmpl, msg_desc, 0, len, fields, num_fields);
+}
+
+/**
+ * Computes the size of a message stamped from a template.
+ * @param tmpl Template
+ * @param values Values of all slots
+ * @return Returns the size of the stamped message.
+ */
+size_t cpb_template_size(const struct cpb_template *tmpl,
+                         const union cpb_value *values)
+{
+    size_t widths[CPB_MAX_TEMPLATE_SLOTS];
+    size_t lens[CPB_MAX_TEMPLATE_LENS];
+    size_t len_widths[CPB_MAX_TEMPLATE_LENS];
+
+    return layout(tmpl, values, widths, lens, len_widths);
+}
+
+/**
+ * Stamps a message from a template. If all values encode to the width of the
+ * template's values, the template is copied and the values are written in
+ * place. Otherwise the template is copied in pieces around the slots and the
+ * length prefixes of the nested messages holding them.
+ * @param tmpl Template
+ * @param values Values of all slots
+ * @param data Data buffer to encode into
+ * @param len Length of data buffer
+ * @param used Returns the size of the stamped message when not NULL.
+ * @return Returns CPB_ERR_OK if successful or CPB_ERR_END_OF_BUF if the data
+ * buffer is too small.
+ */
+cpb_err_t cpb_template_stamp(const struct cpb_template *tmpl,
+                               const union cpb_value *values,
+                               void *data, size_t len, size_t *used)
+{
+    size_t widths[CPB_MAX_TEMPLATE_SLOTS];
+    size_t lens[CPB_MAX_TEMPLATE_LENS];
+    size_t len_widths[CPB_MAX_TEMPLATE_LENS];
+    const struct cpb_template_slot *slot;
+    const struct cpb_template_len *nested;
+    u8_t *out = data;
+    size_t size, pos, n;
+    cpb_bool_t same = 1;
+    int i, j;
+
+    size = layout(tmpl, values, widths, lens, len_widths);
+    if (size > len)
+        return CPB_ERR_END_OF_BUF;
+
+    for (i = 0; i < tmpl->num_slots; i++)
+        if (widths[i] != tmpl->slots[i].width)
+            same = 0;
+    for (j = 0; j < tmpl->num_lens; j++)
+        if (len_widths[j] != tmpl->lens[j].width)
+            same = 0;
+
+    if (same) {
+        memcpy(out, tmpl->data, tmpl->len);
+        for (i = 0; i < tmpl->num_slots; i++)
+            encode_value(out + tmpl->slots[i].ofs, tmpl->slots[i].field_desc,
+                         &values[i]);
+    } else {
+        /* Copy up to each length prefix and slot, in order of their offsets */
+        pos = 0;
+        i = j = 0;
+        while (i < tmpl->num_slots || j < tmpl->num_lens) {
+            if (j < tmpl->num_lens &&
+                (i == tmpl->num_slots || tmpl->lens[j].ofs < tmpl->slots[i].ofs)) {
+                nested = &tmpl->lens[j];
+                n = nested->ofs - pos;
+                memcpy(out, tmpl->data + pos, n);
+                out += n;
+                out += cpb_encode_varint(out, lens[j]);
+                pos = nested->ofs + nested->width;
+                j++;
+            } else {
+                slot = &tmpl->slots[i];
+                n = slot->ofs - pos;
+                memcpy(out, tmpl->data + pos, n);
+                out += n;
+                out += encode_value(out, slot->field_desc, &values[i]);
+                pos = slot->ofs + slot->width;
+                i++;
+            }
+        }
+        memcpy(out, tmpl->data + pos, tmpl->len - pos);
+    }
+
+    if (used)
+        *used = size;
+
+    return CPB_ERR_OK;
+}
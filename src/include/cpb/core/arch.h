@@ -75,5 +75,16 @@ typedef signed char   s8_t;
   typedef apr_int64_t s64_t;
 #endif
 
+/* Little endian byte order allows copying fixed width values verbatim */
+#if !defined(CPB_LITTLE_ENDIAN) && defined(__BYTE_ORDER__) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  #define CPB_LITTLE_ENDIAN 1
+#endif
+
+/* Count leading zero bits of a non-zero 64 bit integer */
+#if defined(__GNUC__) && !defined(CPB_CLZ64)
+  #define CPB_CLZ64(x) __builtin_clzll(x)
+#endif
+
 
 #endif /* __CPB_CORE_ARCH_H__ */
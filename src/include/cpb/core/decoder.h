@@ -63,6 +63,7 @@ typedef void (*cpb_decoder_field_handler_t)
 struct cpb_decoder_stack_frame {
     struct cpb_buf buf;
     const struct cpb_msg_desc *msg_desc;
+    const struct cpb_field_desc *hint; /**< Last field decoded in this frame */
 };
 
 /** Protocol buffer decoder */
@@ -74,6 +75,8 @@ struct cpb_decoder {
     struct cpb_decoder_stack_frame stack[CPB_MAX_DEPTH];
     int depth;
     int packed;
+    u8_t *scratch;
+    size_t scratch_len;
 };
 
 void cpb_decoder_init(struct cpb_decoder *decoder);
@@ -87,12 +90,19 @@ void cpb_decoder_msg_handler(struct cpb_decoder *decoder,
 void cpb_decoder_field_handler(struct cpb_decoder *decoder,
                               cpb_decoder_field_handler_t field_handler);
 
+void cpb_decoder_scratch(struct cpb_decoder *decoder, void *data, size_t len);
+
 void cpb_decoder_use_debug_handlers(struct cpb_decoder *decoder);
 
 cpb_err_t cpb_decoder_decode(struct cpb_decoder *decoder,
                                const struct cpb_msg_desc *msg_desc,
                                void *data, size_t len, size_t *used);
 
+cpb_err_t cpb_decoder_decode_iov(struct cpb_decoder *decoder,
+                                   const struct cpb_msg_desc *msg_desc,
+                                   const struct cpb_iovec *iov, int iovcnt,
+                                   size_t *used);
+
 cpb_err_t cpb_decode_varint(struct cpb_buf *buf, u64_t *varint);
 
 cpb_err_t cpb_decode_32bit(struct cpb_buf *buf, u32_t *value);
@@ -20,11 +20,31 @@
 
 #include <cpb/cpb.h>
 
+/**
+ * Encoder output sink, called with encoded bytes that can no longer change.
+ * @param arg User argument
+ * @param data Encoded bytes
+ * @param len Number of bytes
+ * @return Returns CPB_ERR_OK if successful, encoding is aborted otherwise.
+ */
+typedef cpb_err_t (*cpb_encoder_sink_t)(void *arg, const void *data, size_t len);
+
+/**
+ * Iterator producing the elements of a repeated field on demand.
+ * @param arg User argument
+ * @param value Returns the next element
+ * @return Returns 1 if an element was produced, 0 once all are produced.
+ */
+typedef cpb_bool_t (*cpb_encoder_iter_t)(void *arg, union cpb_value *value);
+
 /** Encoder stack frame */
 struct cpb_encoder_stack_frame {
     struct cpb_buf buf;
     const struct cpb_field_desc *field_desc;
     const struct cpb_msg_desc *msg_desc;
+    cpb_bool_t reserved;        /**< Key and length are reserved in the parent */
+    size_t len;                 /**< Announced length if not reserved */
+    size_t flushed;             /**< Bytes of the frame passed to the sink */
 };
 
 /** Protocol buffer encoder */
@@ -32,6 +52,21 @@ struct cpb_encoder {
     struct cpb_encoder_stack_frame stack[CPB_MAX_DEPTH];
     int depth;
     cpb_bool_t packed;
+    cpb_encoder_sink_t sink;    /**< Output sink, NULL if encoding to memory */
+    void *sink_arg;             /**< User argument of the sink */
+    const size_t *hints;        /**< Nested message sizes, see cpb_sizer */
+    size_t num_hints;           /**< Number of nested message sizes */
+    size_t hint;                /**< Index of the next nested message size */
+    size_t pin;                 /**< Output offset not to flush beyond */
+};
+
+/** Encoder checkpoint, see cpb_encoder_checkpoint() */
+struct cpb_encoder_checkpoint {
+    int depth;                  /**< Depth of the encoder */
+    cpb_bool_t packed;          /**< Packed repeated mode */
+    size_t hint;                /**< Index of the next nested message size */
+    size_t ofs;                 /**< Output offset of the current frame */
+    size_t pin;                 /**< Pin of the encoder before the checkpoint */
 };
 
 void cpb_encoder_init(struct cpb_encoder *encoder);
@@ -40,11 +75,36 @@ void cpb_encoder_start(struct cpb_encoder *encoder,
                         const struct cpb_msg_desc *msg_desc,
                         void *data, size_t len);
 
+void cpb_encoder_start_sink(struct cpb_encoder *encoder,
+                             const struct cpb_msg_desc *msg_desc,
+                             void *data, size_t len,
+                             cpb_encoder_sink_t sink, void *arg);
+
+void cpb_encoder_size_hints(struct cpb_encoder *encoder,
+                             const size_t *sizes, size_t num_sizes);
+
+cpb_err_t cpb_encoder_flush(struct cpb_encoder *encoder);
+
+cpb_err_t cpb_encoder_file_sink(void *arg, const void *data, size_t len);
+
 size_t cpb_encoder_finish(struct cpb_encoder *encoder);
 
+void cpb_encoder_checkpoint(struct cpb_encoder *encoder,
+                             struct cpb_encoder_checkpoint *checkpoint);
+
+void cpb_encoder_rollback(struct cpb_encoder *encoder,
+                           const struct cpb_encoder_checkpoint *checkpoint);
+
+void cpb_encoder_commit(struct cpb_encoder *encoder,
+                         const struct cpb_encoder_checkpoint *checkpoint);
+
 cpb_err_t cpb_encoder_nested_start(struct cpb_encoder *encoder,
                                      const struct cpb_field_desc *field_desc);
 
+cpb_err_t cpb_encoder_nested_start_len(struct cpb_encoder *encoder,
+                                         const struct cpb_field_desc *field_desc,
+                                         size_t len);
+
 cpb_err_t cpb_encoder_nested_end(struct cpb_encoder *encoder);
 
 cpb_err_t cpb_encoder_packed_repeated_start(struct cpb_encoder *encoder,
@@ -56,6 +116,17 @@ cpb_err_t cpb_encoder_add_field(struct cpb_encoder *encoder,
                                   const struct cpb_field_desc *field_desc,
                                   union cpb_value *value);
 
+cpb_err_t cpb_encoder_add_raw(struct cpb_encoder *encoder,
+                                const void *data, size_t len);
+
+cpb_err_t cpb_encoder_add_packed_array(struct cpb_encoder *encoder,
+                                         const struct cpb_field_desc *field_desc,
+                                         const void *array, size_t n);
+
+cpb_err_t cpb_encoder_add_repeated(struct cpb_encoder *encoder,
+                                     const struct cpb_field_desc *field_desc,
+                                     cpb_encoder_iter_t iter, void *arg);
+
 cpb_err_t cpb_encoder_add_double(struct cpb_encoder *encoder,
                                    const struct cpb_field_desc *field_desc,
                                    double double_);
@@ -96,5 +167,8 @@ cpb_err_t cpb_encoder_add_bytes(struct cpb_encoder *encoder,
                                   const struct cpb_field_desc *field_desc,
                                   u8_t *data, size_t len);
 
+cpb_err_t cpb_encoder_add_message(struct cpb_encoder *encoder,
+                                    const struct cpb_field_desc *field_desc,
+                                    const void *data, size_t len);
 
 #endif /* __CPB_CORE_ENCODER_H__ */
@@ -25,12 +25,46 @@ struct cpb_encoder2 {
     cpb_bool_t packed;
 };
 
+/** Sizer stack frame */
+struct cpb_sizer_stack_frame {
+    size_t len;                 /**< Encoded size of the frame so far */
+    size_t slot;                /**< Index into the size cache */
+    const struct cpb_field_desc *field_desc;
+    const struct cpb_msg_desc *msg_desc;
+};
+
+/**
+ * Protocol buffer sizer. Computes the exact encoded size of a message from
+ * the same sequence of calls that is made to the encoder. The sizes of
+ * nested messages are stored in order of their cpb_sizer_nested_start()
+ * calls, see cpb_encoder_size_hints().
+ */
+struct cpb_sizer {
+    struct cpb_encoder2 encoder;
+    struct cpb_sizer_stack_frame stack[CPB_MAX_DEPTH];
+    int depth;
+    size_t *sizes;              /**< Nested message size cache */
+    size_t num_sizes;           /**< Number of entries in the size cache */
+    size_t count;               /**< Number of nested messages started */
+};
+
+size_t cpb_varint_size(u64_t varint);
+
 size_t cpb_encode_varint(u8_t *buf, u64_t varint);
 
+size_t cpb_encode_varint_width(u8_t *buf, u64_t varint, size_t width);
+
 size_t cpb_encode_32bit(u8_t *buf, u32_t value);
 
 size_t cpb_encode_64bit(u8_t *buf, u64_t value);
 
+size_t cpb_packed_array_size(const struct cpb_field_desc *field_desc,
+                             const void *array, size_t n);
+
+size_t cpb_encode_packed_array(u8_t *buf,
+                               const struct cpb_field_desc *field_desc,
+                               const void *array, size_t n);
+
 void cpb_encoder2_init(struct cpb_encoder2 *encoder);
 
 void cpb_encoder2_start(struct cpb_encoder2 *encoder,
@@ -46,4 +80,33 @@ size_t cpb_encoder2_add_field(struct cpb_encoder2 *encoder,
                                union cpb_value *value,
                                u8_t* buf);
 
+void cpb_sizer_init(struct cpb_sizer *sizer, size_t *sizes, size_t num_sizes);
+
+void cpb_sizer_start(struct cpb_sizer *sizer,
+                      const struct cpb_msg_desc *msg_desc);
+
+size_t cpb_sizer_finish(struct cpb_sizer *sizer);
+
+size_t cpb_sizer_num_sizes(struct cpb_sizer *sizer);
+
+cpb_err_t cpb_sizer_nested_start(struct cpb_sizer *sizer,
+                                   const struct cpb_field_desc *field_desc);
+
+cpb_err_t cpb_sizer_nested_end(struct cpb_sizer *sizer);
+
+cpb_err_t cpb_sizer_packed_repeated_start(struct cpb_sizer *sizer,
+                                            const struct cpb_field_desc *field_desc);
+
+cpb_err_t cpb_sizer_packed_repeated_end(struct cpb_sizer *sizer);
+
+cpb_err_t cpb_sizer_add_field(struct cpb_sizer *sizer,
+                                const struct cpb_field_desc *field_desc,
+                                union cpb_value *value);
+
+cpb_err_t cpb_sizer_add_raw(struct cpb_sizer *sizer, size_t len);
+
+cpb_err_t cpb_sizer_add_packed_array(struct cpb_sizer *sizer,
+                                       const struct cpb_field_desc *field_desc,
+                                       const void *array, size_t n);
+
 #endif /* __CPB_CORE_ENCODER2_H__ */
@@ -21,6 +21,8 @@
 #include <cpb/cpb.h>
 
 
+extern const struct cpb_allocator cpb_default_allocator;
+
 const char *cpb_err_text(cpb_err_t err);
 
 #endif /* __CPB_CORE_MISC_H__ */
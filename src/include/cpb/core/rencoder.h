@@ -0,0 +1,135 @@
+/** @file rencoder.h
+ *
+ * Simple C protocol buffers (cpb) back-to-front encoder interface.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CPB_CORE_RENCODER_H__
+#define __CPB_CORE_RENCODER_H__
+
+#include <cpb/cpb.h>
+
+/** Back-to-front encoder stack frame */
+struct cpb_rencoder_stack_frame {
+    size_t mark;                /**< Bytes written when the frame was opened */
+    const struct cpb_field_desc *field_desc;
+    const struct cpb_msg_desc *msg_desc;
+};
+
+/** Output segment of a back-to-front encoder in chained mode */
+struct cpb_rencoder_seg {
+    struct cpb_rencoder_seg *next; /**< Next segment towards the message end */
+    u8_t *data;                 /**< First byte of the segment */
+    size_t len;                 /**< Number of bytes in the segment */
+};
+
+/**
+ * Protocol buffer back-to-front encoder. Fields are written from the end of
+ * the buffer towards its front, so they must be added in reverse order. The
+ * length of a nested message or packed repeated field is known by the time
+ * its prefix is written, hence no byte is moved after it has been written.
+ */
+struct cpb_rencoder {
+    struct cpb_buf buf;
+    struct cpb_rencoder_stack_frame stack[CPB_MAX_DEPTH];
+    int depth;
+    cpb_bool_t packed;
+    const struct cpb_allocator *allocator; /**< Allocator, NULL if fixed buffer */
+    size_t seg_size;            /**< Size of newly allocated segments */
+    struct cpb_rencoder_seg *segs; /**< Current (front-most) segment */
+    size_t closed;              /**< Bytes in segments behind the current one */
+    size_t ref_threshold;       /**< Minimum payload size referenced in place */
+};
+
+void cpb_rencoder_init(struct cpb_rencoder *encoder);
+
+void cpb_rencoder_start(struct cpb_rencoder *encoder,
+                         const struct cpb_msg_desc *msg_desc,
+                         void *data, size_t len);
+
+void cpb_rencoder_start_chain(struct cpb_rencoder *encoder,
+                               const struct cpb_msg_desc *msg_desc,
+                               const struct cpb_allocator *allocator,
+                               size_t seg_size);
+
+void cpb_rencoder_ref_threshold(struct cpb_rencoder *encoder,
+                                 size_t threshold);
+
+void cpb_rencoder_release(struct cpb_rencoder *encoder);
+
+size_t cpb_rencoder_finish(struct cpb_rencoder *encoder);
+
+void *cpb_rencoder_data(struct cpb_rencoder *encoder);
+
+int cpb_rencoder_iov(struct cpb_rencoder *encoder,
+                      struct cpb_iovec *iov, int iovcnt);
+
+cpb_err_t cpb_rencoder_flatten(struct cpb_rencoder *encoder,
+                                 void *data, size_t len);
+
+cpb_err_t cpb_rencoder_nested_start(struct cpb_rencoder *encoder,
+                                      const struct cpb_field_desc *field_desc);
+
+cpb_err_t cpb_rencoder_nested_end(struct cpb_rencoder *encoder);
+
+cpb_err_t cpb_rencoder_packed_repeated_start(struct cpb_rencoder *encoder,
+                                               const struct cpb_field_desc *field_desc);
+
+cpb_err_t cpb_rencoder_packed_repeated_end(struct cpb_rencoder *encoder);
+
+cpb_err_t cpb_rencoder_add_field(struct cpb_rencoder *encoder,
+                                   const struct cpb_field_desc *field_desc,
+                                   union cpb_value *value);
+
+cpb_err_t cpb_rencoder_add_double(struct cpb_rencoder *encoder,
+                                    const struct cpb_field_desc *field_desc,
+                                    double double_);
+
+cpb_err_t cpb_rencoder_add_float(struct cpb_rencoder *encoder,
+                                   const struct cpb_field_desc *field_desc,
+                                   float float_);
+
+cpb_err_t cpb_rencoder_add_int32(struct cpb_rencoder *encoder,
+                                   const struct cpb_field_desc *field_desc,
+                                   s32_t int32);
+
+cpb_err_t cpb_rencoder_add_uint32(struct cpb_rencoder *encoder,
+                                    const struct cpb_field_desc *field_desc,
+                                    u32_t uint32);
+
+cpb_err_t cpb_rencoder_add_int64(struct cpb_rencoder *encoder,
+                                   const struct cpb_field_desc *field_desc,
+                                   s64_t int64);
+
+cpb_err_t cpb_rencoder_add_uint64(struct cpb_rencoder *encoder,
+                                    const struct cpb_field_desc *field_desc,
+                                    u64_t uint64);
+
+cpb_err_t cpb_rencoder_add_bool(struct cpb_rencoder *encoder,
+                                  const struct cpb_field_desc *field_desc,
+                                  cpb_bool_t bool);
+
+cpb_err_t cpb_rencoder_add_enum(struct cpb_rencoder *encoder,
+                                  const struct cpb_field_desc *field_desc,
+                                  cpb_enum_t enum_);
+
+cpb_err_t cpb_rencoder_add_string(struct cpb_rencoder *encoder,
+                                    const struct cpb_field_desc *field_desc,
+                                    char *str);
+
+cpb_err_t cpb_rencoder_add_bytes(struct cpb_rencoder *encoder,
+                                   const struct cpb_field_desc *field_desc,
+                                   u8_t *data, size_t len);
+
+#endif /* __CPB_CORE_RENCODER_H__ */
@@ -25,11 +25,61 @@
 #define CPB_MAX_DEPTH 32
 #endif
 
+/* Number of nested message sizes cached by the struct encoder */
+#ifndef CPB_STRUCT_SIZE_CACHE
+#define CPB_STRUCT_SIZE_CACHE 64
+#endif
+
+/* Field numbers below this are looked up by table in the struct decoder */
+#ifndef CPB_STRUCT_TABLE_SIZE
+#define CPB_STRUCT_TABLE_SIZE 64
+#endif
+
+/* Number of struct map lookup tables kept by the struct decoder */
+#ifndef CPB_STRUCT_TABLES
+#define CPB_STRUCT_TABLES 8
+#endif
+
+/* Maximum number of fields in a struct map with an encoding cache */
+#ifndef CPB_MAX_CACHED_FIELDS
+#define CPB_MAX_CACHED_FIELDS 64
+#endif
+
+/* Maximum number of placeholders in a message template */
+#ifndef CPB_MAX_TEMPLATE_SLOTS
+#define CPB_MAX_TEMPLATE_SLOTS 16
+#endif
+
+/* Maximum number of nested messages holding placeholders in a template */
+#ifndef CPB_MAX_TEMPLATE_LENS
+#define CPB_MAX_TEMPLATE_LENS 16
+#endif
+
+/* Maximum number of threads used by the parallel struct encoder */
+#ifndef CPB_MAX_THREADS
+#define CPB_MAX_THREADS 64
+#endif
+
+/* Minimum number of elements of a repeated message field per encoding thread */
+#ifndef CPB_PARALLEL_MIN_ELEMENTS
+#define CPB_PARALLEL_MIN_ELEMENTS 4
+#endif
+
 /* Maximum number of required fields in a message */
 #ifndef CPB_MAX_REQUIRED_FIELDS
 #define CPB_MAX_REQUIRED_FIELDS 16
 #endif
 
+/* Check that encoded fields belong to the current message */
+#ifndef CPB_CHECK_FIELDS
+#define CPB_CHECK_FIELDS 1
+#endif
+
+/* Use POSIX threads, work is done in the calling thread otherwise */
+#ifndef CPB_THREADS
+#define CPB_THREADS 1
+#endif
+
 /* Provide field names as strings */
 #ifndef CPB_FIELD_NAMES
 #define CPB_FIELD_NAMES 1
@@ -40,6 +90,11 @@
 #define CPB_FIELD_DEFAULTS 1
 #endif
 
+/* Provide pre-encoded field tags */
+#ifndef CPB_FIELD_TAGS
+#define CPB_FIELD_TAGS 1
+#endif
+
 /* Provide message names as strings */
 #ifndef CPB_MESSAGE_NAMES
 #define CPB_MESSAGE_NAMES 1
@@ -65,6 +120,11 @@ typedef enum {
     CPB_ERR_MEM,               /**< Memory allocation failed */
     /* Socket service error codes */
     CPB_ERR_NET_INIT,          /**< Network initialization failed */
+    /* Decoding error codes */
+    CPB_ERR_INVALID_WIRE_TYPE, /**< Invalid or unbalanced wire type in data */
+    /* Output error codes */
+    CPB_ERR_IO,                /**< Writing to the output failed */
+    CPB_ERR_DEPTH,             /**< Messages nested more than CPB_MAX_DEPTH deep */
 } cpb_err_t;
 
 /* Field labels */
@@ -135,6 +195,39 @@ union cpb_value {
     int null;
 };
 
+/** Pre-encoded field tag (varint encoded field key) */
+struct cpb_field_tag {
+    u8_t len;                   /**< Tag length, 0 if not provided */
+    u8_t bytes[5];              /**< Tag bytes */
+};
+
+/** Returns the wire type of a field value type as a constant expression */
+#define CPB_WIRE_TYPE(typ)                                                 \
+    ((typ) == CPB_DOUBLE || (typ) == CPB_FIXED64 ||                        \
+     (typ) == CPB_SFIXED64 ? 1 :                                           \
+     (typ) == CPB_FLOAT || (typ) == CPB_FIXED32 ||                         \
+     (typ) == CPB_SFIXED32 ? 5 :                                           \
+     (typ) == CPB_STRING || (typ) == CPB_BYTES ||                          \
+     (typ) == CPB_MESSAGE ? 2 : 0)
+
+/** Builds a field tag initializer from a field key */
+#define CPB_KEY_TAG(key)                                                   \
+    { (key) < (1UL << 7) ? 1 : (key) < (1UL << 14) ? 2 :                   \
+      (key) < (1UL << 21) ? 3 : (key) < (1UL << 28) ? 4 : 5,               \
+      { ((key) & 0x7f) | ((key) >= (1UL << 7) ? 0x80 : 0),                 \
+        (((key) >> 7) & 0x7f) | ((key) >= (1UL << 14) ? 0x80 : 0),         \
+        (((key) >> 14) & 0x7f) | ((key) >= (1UL << 21) ? 0x80 : 0),        \
+        (((key) >> 21) & 0x7f) | ((key) >= (1UL << 28) ? 0x80 : 0),        \
+        (((key) >> 28) & 0x7f) } }
+
+/** Builds the tag initializer of a field with the given number and type */
+#define CPB_TAG(number, typ)                                               \
+    CPB_KEY_TAG(((u32_t) (number) << 3) | CPB_WIRE_TYPE(typ))
+
+/** Builds the tag initializer of a packed repeated field */
+#define CPB_PACKED_TAG(number)                                             \
+    CPB_KEY_TAG(((u32_t) (number) << 3) | 2)
+
 /* Forward declaration */
 struct cpb_msg_desc;
 
@@ -149,6 +242,10 @@ struct cpb_field_desc {
 #if CPB_FIELD_DEFAULTS
     union cpb_value def;       /**< Field default value */
 #endif
+#if CPB_FIELD_TAGS
+    struct cpb_field_tag tag;  /**< Field tag */
+    struct cpb_field_tag packed_tag; /**< Field tag if packed repeated */
+#endif
 };
 
 /** Checks if a field is 'packed repeated' */
@@ -201,4 +298,17 @@ struct cpb_buf {
     u8_t *end;      /**< Buffers end address (first invalid byte) */
 };
 
+/** Memory segment, layout compatible with POSIX struct iovec */
+struct cpb_iovec {
+    void *base;     /**< Segment base address */
+    size_t len;     /**< Segment length */
+};
+
+/** Memory allocator, e.g. wrapping malloc() or an arena */
+struct cpb_allocator {
+    void *(*alloc)(void *ctx, size_t size); /**< Allocates memory, NULL if out of memory */
+    void (*free)(void *ctx, void *ptr); /**< Releases memory, may be a no-op for arenas */
+    void *ctx;      /**< Allocator context */
+};
+
 #endif /* __CPB_CORE_TYPES_H__ */
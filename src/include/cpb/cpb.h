@@ -199,8 +199,14 @@
 #include <cpb/core/types.h>
 #include <cpb/core/decoder.h>
 #include <cpb/core/encoder.h>
+#include <cpb/core/rencoder.h>
 #include <cpb/core/misc.h>
 #include <cpb/utils/struct_decoder.h>
 #include <cpb/utils/struct_map.h>
+#include <cpb/utils/struct_encoder.h>
+#include <cpb/utils/merge.h>
+#include <cpb/utils/template.h>
+#include <cpb/utils/batch.h>
+#include <cpb/utils/canonical.h>
 
 #endif /* __CPB_H__ */
@@ -0,0 +1,56 @@
+/** @file batch.h
+ *
+ * Simple C protocol buffers (cpb) batch encoder interface.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CPB_UTILS_BATCH_H__
+#define __CPB_UTILS_BATCH_H__
+
+#include <cpb/cpb.h>
+
+
+/**
+ * Batch encoder. Encodes length-delimited messages (records) back to back
+ * into one data buffer.
+ */
+struct cpb_batch {
+    struct cpb_encoder encoder; /**< Encoder of the current record */
+    u8_t *data;                 /**< Data buffer */
+    size_t len;                 /**< Length of data buffer */
+    size_t used;                /**< End of the last finished record */
+    size_t *offsets;            /**< Record offsets, NULL if not recorded */
+    size_t max_records;         /**< Number of record offsets */
+    size_t num_records;         /**< Number of finished records */
+    size_t width;               /**< Width of the reserved length prefix */
+    cpb_bool_t open;            /**< A record is being encoded */
+};
+
+void cpb_batch_init(struct cpb_batch *batch, void *data, size_t len,
+                    size_t *offsets, size_t max_records);
+
+cpb_err_t cpb_batch_start(struct cpb_batch *batch,
+                            const struct cpb_msg_desc *msg_desc,
+                            size_t size_hint);
+
+cpb_err_t cpb_batch_finish(struct cpb_batch *batch);
+
+void cpb_batch_abort(struct cpb_batch *batch);
+
+size_t cpb_batch_used(struct cpb_batch *batch);
+
+size_t cpb_batch_num_records(struct cpb_batch *batch);
+
+
+#endif /* __CPB_UTILS_BATCH_H__ */
@@ -0,0 +1,32 @@
+/** @file canonical.h
+ *
+ * Simple C protocol buffers (cpb) canonical encoding interface.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CPB_UTILS_CANONICAL_H__
+#define __CPB_UTILS_CANONICAL_H__
+
+#include <cpb/cpb.h>
+
+
+cpb_err_t cpb_canonical_encode(const struct cpb_msg_desc *msg_desc,
+                                 const void *msg, size_t msg_len,
+                                 void *data, size_t len, size_t *used,
+                                 u64_t *hash);
+
+u64_t cpb_canonical_hash(const void *data, size_t len);
+
+
+#endif /* __CPB_UTILS_CANONICAL_H__ */
@@ -0,0 +1,34 @@
+/** @file merge.h
+ *
+ * Simple C protocol buffers (cpb) wire-level message merging interface.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CPB_UTILS_MERGE_H__
+#define __CPB_UTILS_MERGE_H__
+
+#include <cpb/cpb.h>
+
+
+cpb_err_t cpb_merge_concat(const struct cpb_iovec *iov, int iovcnt,
+                             void *data, size_t len, size_t *used);
+
+cpb_err_t cpb_merge_splice(const struct cpb_msg_desc *msg_desc,
+                             const void *msg, size_t msg_len,
+                             const struct cpb_field_desc * const *path, int depth,
+                             const void *sub, size_t sub_len,
+                             void *data, size_t len, size_t *used);
+
+
+#endif /* __CPB_UTILS_MERGE_H__ */
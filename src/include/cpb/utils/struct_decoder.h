@@ -59,22 +59,31 @@ typedef void (*cpb_struct_decoder_field_handler_t)
      union cpb_value *value, void *arg);
 
 
+/** Number-indexed lookup table of a struct map */
+struct cpb_struct_decoder_table {
+    const struct cpb_struct_map *map;
+    u8_t index[CPB_STRUCT_TABLE_SIZE]; /**< Mapped field index + 1 by field number, 0 if not mapped */
+};
+
 struct cpb_struct_decoder_stack_frame {
     const struct cpb_struct_map *map;
-    void *base;
+    const struct cpb_struct_decoder_table *table; /**< Lookup table or NULL */
+    u8_t *base;
+    struct cpb_buf buf;         /**< Message data left to decode */
     const struct cpb_struct_map_field *last_field;
-    int field_index;
+    size_t field_index;
 };
 
 /** Protocol buffer struct decoder */
 struct cpb_struct_decoder {
-    struct cpb_decoder decoder;
     void *arg;
     cpb_struct_decoder_msg_start_handler_t msg_start_handler;
     cpb_struct_decoder_msg_end_handler_t msg_end_handler;
     cpb_struct_decoder_field_handler_t field_handler;
     struct cpb_struct_decoder_stack_frame stack[CPB_MAX_DEPTH];
     int depth;
+    struct cpb_struct_decoder_table tables[CPB_STRUCT_TABLES];
+    int num_tables;
 };
 
 void cpb_struct_decoder_init(struct cpb_struct_decoder *sdecoder);
@@ -93,5 +102,9 @@ cpb_err_t cpb_struct_decoder_decode(struct cpb_struct_decoder *sdecoder,
                                       void *struct_base,
                                       void *data, size_t len, size_t *used);
 
+cpb_err_t cpb_struct_apply_delta(const struct cpb_struct_map *struct_map,
+                                   void *struct_base,
+                                   const void *data, size_t len);
+
 
 #endif /* __CPB_UTILS_STRUCT_DECODER_H__ */
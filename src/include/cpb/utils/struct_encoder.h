@@ -0,0 +1,76 @@
+/** @file struct_encoder.h
+ *
+ * Simple C protocol buffers (cpb) struct encoder interface.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CPB_UTILS_STRUCT_ENCODER_H__
+#define __CPB_UTILS_STRUCT_ENCODER_H__
+
+#include <cpb/cpb.h>
+
+
+/**
+ * Struct encoding cache. Holds the encoded message of a struct with the
+ * location of each mapped field, so that only changed fields are re-encoded.
+ */
+struct cpb_struct_cache {
+    const struct cpb_struct_map *map;
+    u8_t *data;                 /**< Encoded message */
+    size_t len;                 /**< Length of data buffer */
+    size_t used;                /**< Length of encoded message */
+    size_t ofs[CPB_MAX_CACHED_FIELDS + 1]; /**< Offsets of the mapped fields */
+    u32_t dirty[(CPB_MAX_CACHED_FIELDS + 31) / 32]; /**< Fields to re-encode */
+    int num_fields;             /**< Number of mapped fields */
+    cpb_bool_t whole;           /**< Too many fields, encoded whole */
+};
+
+size_t cpb_encoded_size(const struct cpb_struct_map *struct_map,
+                        const void *struct_base);
+
+cpb_err_t cpb_struct_encode(const struct cpb_struct_map *struct_map,
+                              const void *struct_base,
+                              void *data, size_t len, size_t *used);
+
+cpb_err_t cpb_struct_diff_encode(const struct cpb_struct_map *struct_map,
+                                   const void *old_base, const void *new_base,
+                                   void *data, size_t len, size_t *used);
+
+cpb_err_t cpb_struct_encode_parallel(const struct cpb_struct_map *struct_map,
+                                       const void *struct_base,
+                                       void *data, size_t len, size_t *used,
+                                       int num_threads,
+                                       const struct cpb_allocator *allocator);
+
+cpb_err_t cpb_struct_encode_batch(const struct cpb_struct_map *struct_map,
+                                    const void *structs, size_t count,
+                                    cpb_bool_t delimited,
+                                    void *data, size_t len,
+                                    struct cpb_iovec *spans, size_t *used,
+                                    int num_threads);
+
+void cpb_struct_cache_init(struct cpb_struct_cache *cache,
+                           const struct cpb_struct_map *struct_map,
+                           void *data, size_t len);
+
+void cpb_struct_cache_mark_dirty(struct cpb_struct_cache *cache,
+                                 const struct cpb_field_desc *field_desc);
+
+void cpb_struct_cache_mark_dirty_index(struct cpb_struct_cache *cache,
+                                       int index);
+
+cpb_err_t cpb_struct_cache_encode(struct cpb_struct_cache *cache,
+                                    const void *struct_base, size_t *used);
+
+#endif /* __CPB_UTILS_STRUCT_ENCODER_H__ */
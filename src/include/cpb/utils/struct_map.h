@@ -18,13 +18,37 @@
 #ifndef __CPB_UTILS_STRUCT_MAP_H__
 #define __CPB_UTILS_STRUCT_MAP_H__
 
+#include <stddef.h>
+
 #include <cpb/cpb.h>
 
 
+/* Struct map flags */
+#define CPB_STRUCT_MAP_PRESENCE         (1 << 0) /**< Struct has presence bits */
+#define CPB_STRUCT_MAP_SKIP_DEFAULTS    (1 << 1) /**< Omit default values */
+
 #define CPB_STRUCT_MAP_BEGIN(_name_, _msg_desc_, _struct_)                 \
+    CPB_STRUCT_MAP_BEGIN_FLAGS(_name_, _msg_desc_, _struct_, 0)
+
+#define CPB_STRUCT_MAP_BEGIN_FLAGS(_name_, _msg_desc_, _struct_, _flags_)  \
+const struct cpb_struct_map _name_ = {                                     \
+    .msg_desc = _msg_desc_,                                                 \
+    .struct_size = sizeof(_struct_),                                        \
+    .flags = _flags_,                                                       \
+    .fields = {
+
+/*
+ * Begins a struct map for a struct holding presence bits, an array of u32_t
+ * with one bit per mapped field, in the order of the map. The struct decoder
+ * sets the bit of every decoded field, struct encoding only encodes the
+ * fields whose bit is set.
+ */
+#define CPB_STRUCT_MAP_BEGIN_PRESENCE(_name_, _msg_desc_, _struct_, _presence_, _flags_) \
 const struct cpb_struct_map _name_ = {                                     \
     .msg_desc = _msg_desc_,                                                 \
     .struct_size = sizeof(_struct_),                                        \
+    .flags = (_flags_) | CPB_STRUCT_MAP_PRESENCE,                           \
+    .presence = offsetof(_struct_, _presence_),                             \
     .fields = {
 
 #define CPB_STRUCT_MAP_DOUBLE(_field_desc_, _struct_, _field_, _count_)    \
@@ -64,7 +88,7 @@ const struct cpb_struct_map _name_ = {                                     \
 #define CPB_STRUCT_MAP_FIELD(_field_desc_, _struct_, _field_, _len_, _count_) \
         {                                                                   \
             .field_desc = _field_desc_,                                     \
-            .ofs = (unsigned int) &((_struct_ *) 0)->_field_,               \
+            .ofs = offsetof(_struct_, _field_),                             \
             .len = _len_,                                                   \
             .count = _count_,                                               \
         },
@@ -87,7 +111,23 @@ struct cpb_struct_map_field {
 struct cpb_struct_map {
     const struct cpb_msg_desc *msg_desc;
     size_t struct_size;
+    unsigned int flags;         /**< Struct map flags */
+    unsigned int presence;      /**< Offset of the presence bits */
     const struct cpb_struct_map_field fields[];
 };
 
+/** Returns the presence bits of a struct */
+#define CPB_STRUCT_PRESENCE(_map_, _base_)                                 \
+    ((u32_t *) ((u8_t *) (_base_) + (_map_)->presence))
+
+/** Checks whether the mapped field with the given index is present */
+#define CPB_STRUCT_IS_PRESENT(_map_, _base_, _index_)                      \
+    ((CPB_STRUCT_PRESENCE(_map_, _base_)[(_index_) / 32] >>                \
+      ((_index_) % 32)) & 1)
+
+/** Marks the mapped field with the given index as present */
+#define CPB_STRUCT_SET_PRESENT(_map_, _base_, _index_)                     \
+    (CPB_STRUCT_PRESENCE(_map_, _base_)[(_index_) / 32] |=                 \
+     (u32_t) 1 << ((_index_) % 32))
+
 #endif /* __CPB_UTILS_STRUCT_MAP_H__ */
@@ -0,0 +1,66 @@
+/** @file template.h
+ *
+ * Simple C protocol buffers (cpb) message template interface.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CPB_UTILS_TEMPLATE_H__
+#define __CPB_UTILS_TEMPLATE_H__
+
+#include <cpb/cpb.h>
+
+
+/** Placeholder field of a message template */
+struct cpb_template_slot {
+    const struct cpb_field_desc *field_desc;
+    size_t ofs;                 /**< Offset of the encoded value */
+    size_t width;               /**< Width of the encoded value */
+};
+
+/** Length prefix of a nested message holding placeholders */
+struct cpb_template_len {
+    size_t ofs;                 /**< Offset of the length prefix */
+    size_t width;               /**< Width of the length prefix */
+    size_t end;                 /**< Offset of the end of the message */
+};
+
+/**
+ * Protocol buffer message template. Refers to an encoded message whose
+ * placeholder fields are replaced by new values when stamping messages.
+ */
+struct cpb_template {
+    const struct cpb_msg_desc *msg_desc;
+    const u8_t *data;           /**< Encoded message */
+    size_t len;                 /**< Length of encoded message */
+    struct cpb_template_slot slots[CPB_MAX_TEMPLATE_SLOTS];
+    int num_slots;
+    struct cpb_template_len lens[CPB_MAX_TEMPLATE_LENS];
+    int num_lens;
+};
+
+cpb_err_t cpb_template_create(struct cpb_template *tmpl,
+                                const struct cpb_msg_desc *msg_desc,
+                                const void *data, size_t len,
+                                const struct cpb_field_desc * const *fields,
+                                int num_fields);
+
+size_t cpb_template_size(const struct cpb_template *tmpl,
+                         const union cpb_value *values);
+
+cpb_err_t cpb_template_stamp(const struct cpb_template *tmpl,
+                               const union cpb_value *values,
+                               void *data, size_t len, size_t *used);
+
+
+#endif /* __CPB_UTILS_TEMPLATE_H__ */
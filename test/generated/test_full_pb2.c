@@ -17,6 +17,9 @@ const struct cpb_field_desc cpb_fields_foo_submess[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int32 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(4, CPB_INT32),
 #endif
     },
 };
@@ -34,6 +37,9 @@ const struct cpb_field_desc cpb_fields_foo_testfieldno15[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(15, CPB_STRING),
 #endif
     },
 };
@@ -51,6 +57,9 @@ const struct cpb_field_desc cpb_fields_foo_testfieldno16[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(16, CPB_STRING),
 #endif
     },
 };
@@ -68,6 +77,9 @@ const struct cpb_field_desc cpb_fields_foo_testfieldno2047[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(2047, CPB_STRING),
 #endif
     },
 };
@@ -85,6 +97,9 @@ const struct cpb_field_desc cpb_fields_foo_testfieldno2048[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(2048, CPB_STRING),
 #endif
     },
 };
@@ -102,6 +117,9 @@ const struct cpb_field_desc cpb_fields_foo_testfieldno262143[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(262143, CPB_STRING),
 #endif
     },
 };
@@ -119,6 +137,9 @@ const struct cpb_field_desc cpb_fields_foo_testfieldno262144[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(262144, CPB_STRING),
 #endif
     },
 };
@@ -136,6 +157,9 @@ const struct cpb_field_desc cpb_fields_foo_testfieldno33554431[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(33554431, CPB_STRING),
 #endif
     },
 };
@@ -153,6 +177,9 @@ const struct cpb_field_desc cpb_fields_foo_testfieldno33554432[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(33554432, CPB_STRING),
 #endif
     },
 };
@@ -170,6 +197,9 @@ const struct cpb_field_desc cpb_fields_foo_testmess[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_INT32),
 #endif
     },
     {
@@ -183,6 +213,9 @@ const struct cpb_field_desc cpb_fields_foo_testmess[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(2, CPB_SINT32),
 #endif
     },
     {
@@ -196,6 +229,9 @@ const struct cpb_field_desc cpb_fields_foo_testmess[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(3, CPB_SFIXED32),
 #endif
     },
     {
@@ -209,6 +245,9 @@ const struct cpb_field_desc cpb_fields_foo_testmess[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(4, CPB_INT64),
 #endif
     },
     {
@@ -222,6 +261,9 @@ const struct cpb_field_desc cpb_fields_foo_testmess[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(5, CPB_SINT64),
 #endif
     },
     {
@@ -235,6 +277,9 @@ const struct cpb_field_desc cpb_fields_foo_testmess[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(6, CPB_SFIXED64),
 #endif
     },
     {
@@ -248,6 +293,9 @@ const struct cpb_field_desc cpb_fields_foo_testmess[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(7, CPB_UINT32),
 #endif
     },
     {
@@ -261,6 +309,9 @@ const struct cpb_field_desc cpb_fields_foo_testmess[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(8, CPB_FIXED32),
 #endif
     },
     {
@@ -274,6 +325,9 @@ const struct cpb_field_desc cpb_fields_foo_testmess[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(9, CPB_UINT64),
 #endif
     },
     {
@@ -287,6 +341,9 @@ const struct cpb_field_desc cpb_fields_foo_testmess[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(10, CPB_FIXED64),
 #endif
     },
     {
@@ -300,6 +357,9 @@ const struct cpb_field_desc cpb_fields_foo_testmess[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(11, CPB_FLOAT),
 #endif
     },
     {
@@ -313,6 +373,9 @@ const struct cpb_field_desc cpb_fields_foo_testmess[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(12, CPB_DOUBLE),
 #endif
     },
     {
@@ -326,6 +389,9 @@ const struct cpb_field_desc cpb_fields_foo_testmess[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(13, CPB_BOOL),
 #endif
     },
     {
@@ -339,6 +405,9 @@ const struct cpb_field_desc cpb_fields_foo_testmess[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(14, CPB_ENUM),
 #endif
     },
     {
@@ -352,6 +421,9 @@ const struct cpb_field_desc cpb_fields_foo_testmess[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(15, CPB_ENUM),
 #endif
     },
     {
@@ -365,6 +437,9 @@ const struct cpb_field_desc cpb_fields_foo_testmess[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(16, CPB_STRING),
 #endif
     },
     {
@@ -378,6 +453,9 @@ const struct cpb_field_desc cpb_fields_foo_testmess[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(17, CPB_BYTES),
 #endif
     },
     {
@@ -391,6 +469,9 @@ const struct cpb_field_desc cpb_fields_foo_testmess[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(18, CPB_MESSAGE),
 #endif
     },
 };
@@ -408,6 +489,10 @@ const struct cpb_field_desc cpb_fields_foo_testmesspacked[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_INT32),
+        .packed_tag = CPB_PACKED_TAG(1),
 #endif
     },
     {
@@ -421,6 +506,10 @@ const struct cpb_field_desc cpb_fields_foo_testmesspacked[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(2, CPB_SINT32),
+        .packed_tag = CPB_PACKED_TAG(2),
 #endif
     },
     {
@@ -434,6 +523,10 @@ const struct cpb_field_desc cpb_fields_foo_testmesspacked[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(3, CPB_SFIXED32),
+        .packed_tag = CPB_PACKED_TAG(3),
 #endif
     },
     {
@@ -447,6 +540,10 @@ const struct cpb_field_desc cpb_fields_foo_testmesspacked[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(4, CPB_INT64),
+        .packed_tag = CPB_PACKED_TAG(4),
 #endif
     },
     {
@@ -460,6 +557,10 @@ const struct cpb_field_desc cpb_fields_foo_testmesspacked[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(5, CPB_SINT64),
+        .packed_tag = CPB_PACKED_TAG(5),
 #endif
     },
     {
@@ -473,6 +574,10 @@ const struct cpb_field_desc cpb_fields_foo_testmesspacked[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(6, CPB_SFIXED64),
+        .packed_tag = CPB_PACKED_TAG(6),
 #endif
     },
     {
@@ -486,6 +591,10 @@ const struct cpb_field_desc cpb_fields_foo_testmesspacked[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(7, CPB_UINT32),
+        .packed_tag = CPB_PACKED_TAG(7),
 #endif
     },
     {
@@ -499,6 +608,10 @@ const struct cpb_field_desc cpb_fields_foo_testmesspacked[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(8, CPB_FIXED32),
+        .packed_tag = CPB_PACKED_TAG(8),
 #endif
     },
     {
@@ -512,6 +625,10 @@ const struct cpb_field_desc cpb_fields_foo_testmesspacked[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(9, CPB_UINT64),
+        .packed_tag = CPB_PACKED_TAG(9),
 #endif
     },
     {
@@ -525,6 +642,10 @@ const struct cpb_field_desc cpb_fields_foo_testmesspacked[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(10, CPB_FIXED64),
+        .packed_tag = CPB_PACKED_TAG(10),
 #endif
     },
     {
@@ -538,6 +659,10 @@ const struct cpb_field_desc cpb_fields_foo_testmesspacked[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(11, CPB_FLOAT),
+        .packed_tag = CPB_PACKED_TAG(11),
 #endif
     },
     {
@@ -551,6 +676,10 @@ const struct cpb_field_desc cpb_fields_foo_testmesspacked[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(12, CPB_DOUBLE),
+        .packed_tag = CPB_PACKED_TAG(12),
 #endif
     },
     {
@@ -564,6 +693,10 @@ const struct cpb_field_desc cpb_fields_foo_testmesspacked[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(13, CPB_BOOL),
+        .packed_tag = CPB_PACKED_TAG(13),
 #endif
     },
     {
@@ -577,6 +710,10 @@ const struct cpb_field_desc cpb_fields_foo_testmesspacked[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(14, CPB_ENUM),
+        .packed_tag = CPB_PACKED_TAG(14),
 #endif
     },
     {
@@ -590,6 +727,10 @@ const struct cpb_field_desc cpb_fields_foo_testmesspacked[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(15, CPB_ENUM),
+        .packed_tag = CPB_PACKED_TAG(15),
 #endif
     },
 };
@@ -607,6 +748,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessoptional[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int32 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_INT32),
 #endif
     },
     {
@@ -620,6 +764,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessoptional[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int32 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(2, CPB_SINT32),
 #endif
     },
     {
@@ -633,6 +780,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessoptional[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int32 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(3, CPB_SFIXED32),
 #endif
     },
     {
@@ -646,6 +796,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessoptional[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int64 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(4, CPB_INT64),
 #endif
     },
     {
@@ -659,6 +812,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessoptional[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int64 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(5, CPB_SINT64),
 #endif
     },
     {
@@ -672,6 +828,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessoptional[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int64 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(6, CPB_SFIXED64),
 #endif
     },
     {
@@ -685,6 +844,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessoptional[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.uint32 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(7, CPB_UINT32),
 #endif
     },
     {
@@ -698,6 +860,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessoptional[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.uint32 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(8, CPB_FIXED32),
 #endif
     },
     {
@@ -711,6 +876,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessoptional[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.uint64 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(9, CPB_UINT64),
 #endif
     },
     {
@@ -724,6 +892,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessoptional[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.uint64 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(10, CPB_FIXED64),
 #endif
     },
     {
@@ -737,6 +908,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessoptional[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.float_ = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(11, CPB_FLOAT),
 #endif
     },
     {
@@ -750,6 +924,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessoptional[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.double_ = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(12, CPB_DOUBLE),
 #endif
     },
     {
@@ -763,6 +940,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessoptional[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.bool = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(13, CPB_BOOL),
 #endif
     },
     {
@@ -776,6 +956,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessoptional[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int32 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(14, CPB_ENUM),
 #endif
     },
     {
@@ -789,6 +972,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessoptional[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int32 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(15, CPB_ENUM),
 #endif
     },
     {
@@ -802,6 +988,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessoptional[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(16, CPB_STRING),
 #endif
     },
     {
@@ -815,6 +1004,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessoptional[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(17, CPB_BYTES),
 #endif
     },
     {
@@ -828,6 +1020,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessoptional[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(18, CPB_MESSAGE),
 #endif
     },
 };
@@ -845,6 +1040,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessrequiredint32[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int32 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(42, CPB_INT32),
 #endif
     },
 };
@@ -862,6 +1060,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessrequiredsint32[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int32 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(43, CPB_SINT32),
 #endif
     },
 };
@@ -879,6 +1080,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessrequiredsfixed32[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int32 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(100, CPB_SFIXED32),
 #endif
     },
 };
@@ -896,6 +1100,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessrequiredint64[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int64 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_INT64),
 #endif
     },
 };
@@ -913,6 +1120,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessrequiredsint64[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int64 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(11, CPB_SINT64),
 #endif
     },
 };
@@ -930,6 +1140,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessrequiredsfixed64[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int64 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(12, CPB_SFIXED64),
 #endif
     },
 };
@@ -947,6 +1160,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessrequireduint32[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.uint32 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_UINT32),
 #endif
     },
 };
@@ -964,6 +1180,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessrequiredfixed32[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.uint32 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_FIXED32),
 #endif
     },
 };
@@ -981,6 +1200,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessrequireduint64[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.uint64 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_UINT64),
 #endif
     },
 };
@@ -998,6 +1220,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessrequiredfixed64[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.uint64 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_FIXED64),
 #endif
     },
 };
@@ -1015,6 +1240,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessrequiredfloat[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.float_ = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_FLOAT),
 #endif
     },
 };
@@ -1032,6 +1260,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessrequireddouble[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.double_ = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_DOUBLE),
 #endif
     },
 };
@@ -1049,6 +1280,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessrequiredbool[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.bool = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_BOOL),
 #endif
     },
 };
@@ -1066,6 +1300,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessrequiredenum[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int32 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_ENUM),
 #endif
     },
 };
@@ -1083,6 +1320,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessrequiredenumsmall[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int32 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_ENUM),
 #endif
     },
 };
@@ -1100,6 +1340,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessrequiredstring[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_STRING),
 #endif
     },
 };
@@ -1117,6 +1360,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessrequiredbytes[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_BYTES),
 #endif
     },
 };
@@ -1134,6 +1380,9 @@ const struct cpb_field_desc cpb_fields_foo_testmessrequiredmessage[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_MESSAGE),
 #endif
     },
 };
@@ -1155,6 +1404,9 @@ const struct cpb_field_desc cpb_fields_foo_defaultrequiredvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int32 = -42,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_INT32),
 #endif
     },
     {
@@ -1168,6 +1420,9 @@ const struct cpb_field_desc cpb_fields_foo_defaultrequiredvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.uint32 = 666,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(2, CPB_UINT32),
 #endif
     },
     {
@@ -1181,6 +1436,9 @@ const struct cpb_field_desc cpb_fields_foo_defaultrequiredvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int32 = 100000,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(3, CPB_INT32),
 #endif
     },
     {
@@ -1194,6 +1452,9 @@ const struct cpb_field_desc cpb_fields_foo_defaultrequiredvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.uint32 = 100001,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(4, CPB_UINT32),
 #endif
     },
     {
@@ -1207,6 +1468,9 @@ const struct cpb_field_desc cpb_fields_foo_defaultrequiredvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.float_ = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(5, CPB_FLOAT),
 #endif
     },
     {
@@ -1220,6 +1484,9 @@ const struct cpb_field_desc cpb_fields_foo_defaultrequiredvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.double_ = 4.5,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(6, CPB_DOUBLE),
 #endif
     },
     {
@@ -1233,6 +1500,9 @@ const struct cpb_field_desc cpb_fields_foo_defaultrequiredvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "hi mom\n",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(7, CPB_STRING),
 #endif
     },
     {
@@ -1246,6 +1516,9 @@ const struct cpb_field_desc cpb_fields_foo_defaultrequiredvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "a \000 character",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(8, CPB_BYTES),
 #endif
     },
 };
@@ -1263,6 +1536,9 @@ const struct cpb_field_desc cpb_fields_foo_defaultoptionalvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int32 = -42,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_INT32),
 #endif
     },
     {
@@ -1276,6 +1552,9 @@ const struct cpb_field_desc cpb_fields_foo_defaultoptionalvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.uint32 = 666,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(2, CPB_UINT32),
 #endif
     },
     {
@@ -1289,6 +1568,9 @@ const struct cpb_field_desc cpb_fields_foo_defaultoptionalvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int32 = 100000,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(3, CPB_INT32),
 #endif
     },
     {
@@ -1302,6 +1584,9 @@ const struct cpb_field_desc cpb_fields_foo_defaultoptionalvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.uint32 = 100001,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(4, CPB_UINT32),
 #endif
     },
     {
@@ -1315,6 +1600,9 @@ const struct cpb_field_desc cpb_fields_foo_defaultoptionalvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.float_ = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(5, CPB_FLOAT),
 #endif
     },
     {
@@ -1328,6 +1616,9 @@ const struct cpb_field_desc cpb_fields_foo_defaultoptionalvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.double_ = 4.5,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(6, CPB_DOUBLE),
 #endif
     },
     {
@@ -1341,6 +1632,9 @@ const struct cpb_field_desc cpb_fields_foo_defaultoptionalvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "hi mom\n",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(7, CPB_STRING),
 #endif
     },
     {
@@ -1354,6 +1648,9 @@ const struct cpb_field_desc cpb_fields_foo_defaultoptionalvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "a \000 character",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(8, CPB_BYTES),
 #endif
     },
 };
@@ -1371,6 +1668,9 @@ const struct cpb_field_desc cpb_fields_foo_allocvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_BYTES),
 #endif
     },
     {
@@ -1384,6 +1684,9 @@ const struct cpb_field_desc cpb_fields_foo_allocvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(2, CPB_STRING),
 #endif
     },
     {
@@ -1397,6 +1700,9 @@ const struct cpb_field_desc cpb_fields_foo_allocvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(3, CPB_STRING),
 #endif
     },
     {
@@ -1410,6 +1716,9 @@ const struct cpb_field_desc cpb_fields_foo_allocvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(4, CPB_BYTES),
 #endif
     },
     {
@@ -1423,6 +1732,9 @@ const struct cpb_field_desc cpb_fields_foo_allocvalues[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(5, CPB_MESSAGE),
 #endif
     },
 };
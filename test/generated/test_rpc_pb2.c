@@ -17,6 +17,9 @@ const struct cpb_field_desc cpb_fields_test_phonenumber[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_STRING),
 #endif
     },
     {
@@ -30,6 +33,9 @@ const struct cpb_field_desc cpb_fields_test_phonenumber[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int32 = 1,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(2, CPB_ENUM),
 #endif
     },
 };
@@ -47,6 +53,9 @@ const struct cpb_field_desc cpb_fields_test_person[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_STRING),
 #endif
     },
     {
@@ -60,6 +69,9 @@ const struct cpb_field_desc cpb_fields_test_person[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int32 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(2, CPB_INT32),
 #endif
     },
     {
@@ -73,6 +85,9 @@ const struct cpb_field_desc cpb_fields_test_person[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(3, CPB_STRING),
 #endif
     },
     {
@@ -86,6 +101,9 @@ const struct cpb_field_desc cpb_fields_test_person[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(4, CPB_MESSAGE),
 #endif
     },
 };
@@ -103,6 +121,9 @@ const struct cpb_field_desc cpb_fields_test_lookupresult[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_MESSAGE),
 #endif
     },
 };
@@ -120,6 +141,9 @@ const struct cpb_field_desc cpb_fields_test_name[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string.str = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_STRING),
 #endif
     },
 };
@@ -17,6 +17,9 @@ const struct cpb_field_desc cpb_fields_test_structtest[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int32 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_INT32),
 #endif
     },
     {
@@ -30,6 +33,9 @@ const struct cpb_field_desc cpb_fields_test_structtest[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int64 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(2, CPB_INT64),
 #endif
     },
     {
@@ -43,6 +49,9 @@ const struct cpb_field_desc cpb_fields_test_structtest[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         1,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(3, CPB_BOOL),
 #endif
     },
     {
@@ -56,6 +65,9 @@ const struct cpb_field_desc cpb_fields_test_structtest[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int32 = 1,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(4, CPB_ENUM),
 #endif
     },
     {
@@ -69,6 +81,9 @@ const struct cpb_field_desc cpb_fields_test_structtest[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(5, CPB_STRING),
 #endif
     },
     {
@@ -82,6 +97,9 @@ const struct cpb_field_desc cpb_fields_test_structtest[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(6, CPB_BYTES),
 #endif
     },
     {
@@ -95,6 +113,9 @@ const struct cpb_field_desc cpb_fields_test_structtest[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(7, CPB_MESSAGE),
 #endif
     },
     {
@@ -108,6 +129,9 @@ const struct cpb_field_desc cpb_fields_test_structtest[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.null = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(8, CPB_MESSAGE),
 #endif
     },
 };
@@ -125,6 +149,9 @@ const struct cpb_field_desc cpb_fields_test_structtest_nested1[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int32 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_INT32),
 #endif
     },
     {
@@ -138,6 +165,9 @@ const struct cpb_field_desc cpb_fields_test_structtest_nested1[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.int64 = 0,
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(2, CPB_INT64),
 #endif
     },
 };
@@ -155,6 +185,9 @@ const struct cpb_field_desc cpb_fields_test_structtest_nested2[] = {
 #endif
 #if CPB_FIELD_DEFAULTS
         .def.string = "",
+#endif
+#if CPB_FIELD_TAGS
+        .tag = CPB_TAG(1, CPB_STRING),
 #endif
     },
 };
@@ -17,6 +17,7 @@
  */
 
 #include <cpb/cpb.h>
+#include <cpb/core/encoder2.h>
 
 #include "generated/test_full_pb2.h"
 #include "generated/test_full_vectors.inc"
@@ -1203,6 +1204,12 @@ static void test_empty_packed_repeated(void)
         CHECK_CPB(ret);                                                    \
         len = cpb_encoder_finish(&encoder);                                \
         CHECK_BUF(buf, len, vector);                                        \
+        cpb_encoder_start(&encoder, foo_TestMessPacked, buf, sizeof(buf)); \
+        ret = cpb_encoder_add_packed_array(&encoder, foo_TestMessPacked_test_##field, \
+                                           array, ARRAY_SIZE(array));       \
+        CHECK_CPB(ret);                                                    \
+        len = cpb_encoder_finish(&encoder);                                \
+        CHECK_BUF(buf, len, vector);                                        \
         fields.u.TestMessPacked.test_##field = array;                       \
         cpb_decoder_init(&decoder);                                        \
         cpb_decoder_arg(&decoder, &fields);                                \
@@ -1310,6 +1317,1455 @@ static void test_packed_repeated_enum_big(void)
 }
 
 
+static void test_unknown_fields(void)
+{
+    cpb_err_t ret;
+    struct cpb_decoder decoder;
+    struct testing_fields fields;
+    size_t used;
+    static const u8_t data[] = {
+        0x50, 0xac, 0x02,                           /* 10: varint */
+        0x59, 1, 2, 3, 4, 5, 6, 7, 8,               /* 11: 64bit */
+        0x62, 0x03, 'a', 'b', 'c',                  /* 12: string */
+        0x6b,                                       /* 13: start group */
+        0x08, 0x01,                                 /*   1: varint */
+        0x73,                                       /*   14: start group */
+        0x15, 1, 2, 3, 4,                           /*     2: 32bit */
+        0x74,                                       /*   14: end group */
+        0x6c,                                       /* 13: end group */
+        0xd0, 0x02, 0x2a,                           /* 42: test = 42 */
+        0x7d, 1, 2, 3, 4,                           /* 15: 32bit */
+    };
+    static const u8_t unbalanced[] = { 0x6b, 0x74 };
+    static const u8_t invalid[] = { 0x56, 0x00 };
+
+    fields.u.TestMessRequiredInt32.test = 42;
+    cpb_decoder_init(&decoder);
+    cpb_decoder_arg(&decoder, &fields);
+    cpb_decoder_field_handler(&decoder, generic_field_handler);
+    ret = cpb_decoder_decode(&decoder, foo_TestMessRequiredInt32, (void *) data, sizeof(data), &used);
+    CHECK_CPB(ret);
+    CHECK_ASSERT(used == sizeof(data), "not decoded all bytes");
+
+    ret = cpb_decoder_decode(&decoder, foo_TestMessRequiredInt32, (void *) unbalanced, sizeof(unbalanced), &used);
+    CHECK_ASSERT(ret == CPB_ERR_INVALID_WIRE_TYPE, "unbalanced group not detected");
+    ret = cpb_decoder_decode(&decoder, foo_TestMessRequiredInt32, (void *) invalid, sizeof(invalid), &used);
+    CHECK_ASSERT(ret == CPB_ERR_INVALID_WIRE_TYPE, "invalid wire type not detected");
+}
+
+
+/** Event log filled by the recording handlers. */
+struct record_log {
+    char data[4096];
+    size_t len;
+};
+
+static void record(struct record_log *log, const void *data, size_t len)
+{
+    CHECK_ASSERT(log->len + len <= sizeof(log->data), "record log overflow");
+    memcpy(&log->data[log->len], data, len);
+    log->len += len;
+}
+
+static void record_msg_handler(struct cpb_decoder *decoder,
+                               const struct cpb_msg_desc *msg_desc, void *arg)
+{
+    record(arg, &msg_desc, sizeof(msg_desc));
+}
+
+static void record_field_handler(struct cpb_decoder *decoder,
+                                 const struct cpb_msg_desc *msg_desc,
+                                 const struct cpb_field_desc *field_desc,
+                                 union cpb_value *value, void *arg)
+{
+    record(arg, &field_desc, sizeof(field_desc));
+    if (!value)
+        return;
+    switch (field_desc->opts.typ) {
+    case CPB_STRING:
+        record(arg, value->string.str, value->string.len);
+        break;
+    case CPB_BYTES:
+        record(arg, value->bytes.data, value->bytes.len);
+        break;
+    case CPB_DOUBLE:
+    case CPB_INT64:
+    case CPB_UINT64:
+    case CPB_SINT64:
+    case CPB_FIXED64:
+    case CPB_SFIXED64:
+        record(arg, &value->uint64, sizeof(value->uint64));
+        break;
+    case CPB_BOOL:
+        record(arg, &value->bool, sizeof(value->bool));
+        break;
+    case CPB_ENUM:
+        record(arg, &value->enum_, sizeof(value->enum_));
+        break;
+    default:
+        record(arg, &value->uint32, sizeof(value->uint32));
+        break;
+    }
+}
+
+/** Decodes a buffer and records all decoder events. */
+static void record_decode(const struct cpb_msg_desc *msg_desc,
+                          const u8_t *data, size_t len,
+                          struct record_log *log)
+{
+    cpb_err_t ret;
+    struct cpb_decoder decoder;
+    size_t used;
+
+    log->len = 0;
+    cpb_decoder_init(&decoder);
+    cpb_decoder_arg(&decoder, log);
+    cpb_decoder_msg_handler(&decoder, record_msg_handler, record_msg_handler);
+    cpb_decoder_field_handler(&decoder, record_field_handler);
+    ret = cpb_decoder_decode(&decoder, msg_desc, (void *) data, len, &used);
+    CHECK_CPB(ret);
+    CHECK_ASSERT(used == len, "not decoded all bytes");
+}
+
+/** Decodes a buffer split into segments of seg_len bytes each. */
+static void check_decode_iov(const struct cpb_msg_desc *msg_desc,
+                             const u8_t *data, size_t len, size_t seg_len)
+{
+    cpb_err_t ret;
+    struct cpb_decoder decoder;
+    struct record_log expected, actual;
+    struct cpb_iovec iov[256];
+    u8_t segs[1024];
+    u8_t scratch[64];
+    size_t used, ofs;
+    int iovcnt = 0;
+
+    record_decode(msg_desc, data, len, &expected);
+
+    /* Place the segments apart from each other, with a guard byte between */
+    for (ofs = 0; ofs < len; ofs += seg_len) {
+        iov[iovcnt].base = &segs[ofs + iovcnt];
+        iov[iovcnt].len = len - ofs < seg_len ? len - ofs : seg_len;
+        memcpy(iov[iovcnt].base, &data[ofs], iov[iovcnt].len);
+        segs[ofs + iovcnt + iov[iovcnt].len] = 0xff;
+        iovcnt++;
+    }
+
+    actual.len = 0;
+    cpb_decoder_init(&decoder);
+    cpb_decoder_arg(&decoder, &actual);
+    cpb_decoder_msg_handler(&decoder, record_msg_handler, record_msg_handler);
+    cpb_decoder_field_handler(&decoder, record_field_handler);
+    cpb_decoder_scratch(&decoder, scratch, sizeof(scratch));
+    ret = cpb_decoder_decode_iov(&decoder, msg_desc, iov, iovcnt, &used);
+    CHECK_CPB(ret);
+    CHECK_ASSERT(used == len, "not decoded all bytes");
+    check_buf((u8_t *) actual.data, actual.len, (u8_t *) expected.data,
+              expected.len, "expected", __FILE__, __LINE__);
+}
+
+static void test_decode_iov(void)
+{
+    size_t seg_len;
+
+    for (seg_len = 1; seg_len <= 16; seg_len++) {
+        check_decode_iov(foo_TestMess, test_repeated_strings_2, sizeof(test_repeated_strings_2), seg_len);
+        check_decode_iov(foo_TestMess, test_repeated_submess_1, sizeof(test_repeated_submess_1), seg_len);
+        check_decode_iov(foo_TestMess, test_repeated_uint64_random, sizeof(test_repeated_uint64_random), seg_len);
+        check_decode_iov(foo_TestMessPacked, test_packed_repeated_int32_arr_min_max, sizeof(test_packed_repeated_int32_arr_min_max), seg_len);
+        check_decode_iov(foo_TestMessPacked, test_packed_repeated_double_random, sizeof(test_packed_repeated_double_random), seg_len);
+        check_decode_iov(foo_TestMessOptional, test_optional_sfixed32_min, sizeof(test_optional_sfixed32_min), seg_len);
+    }
+}
+
+/** Allocator counting outstanding allocations */
+static void *counting_alloc(void *ctx, size_t size)
+{
+    (*(int *) ctx)++;
+    return malloc(size);
+}
+
+static void counting_free(void *ctx, void *ptr)
+{
+    (*(int *) ctx)--;
+    free(ptr);
+}
+
+/** Checks a chained encoding against its test vector, flat and gathered. */
+static void check_rencoder_chain(struct cpb_rencoder *encoder,
+                                 const u8_t *expected, size_t expected_len)
+{
+    struct cpb_iovec iov[512];
+    u8_t buf[512];
+    size_t len = 0;
+    int i, iovcnt;
+
+    CHECK_VALUE(cpb_rencoder_finish(encoder), expected_len);
+
+    CHECK_CPB(cpb_rencoder_flatten(encoder, buf, sizeof(buf)));
+    check_buf(buf, expected_len, expected, expected_len, "expected",
+              __FILE__, __LINE__);
+
+    iovcnt = cpb_rencoder_iov(encoder, iov, ARRAY_SIZE(iov));
+    CHECK_ASSERT(iovcnt <= ARRAY_SIZE(iov), "too many segments");
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(&buf[len], iov[i].base, iov[i].len);
+        len += iov[i].len;
+    }
+    check_buf(buf, len, expected, expected_len, "expected",
+              __FILE__, __LINE__);
+
+    CHECK_ASSERT(cpb_rencoder_flatten(encoder, buf, expected_len - 1) ==
+                 CPB_ERR_END_OF_BUF, "end of buffer not detected");
+}
+
+static void test_rencoder_chain(void)
+{
+    static const s32_t submess_values[] = { 42, -10000, 667 };
+    struct cpb_rencoder encoder;
+    struct cpb_allocator allocator;
+    int allocated = 0;
+    size_t seg_size;
+    int i;
+
+    allocator.alloc = counting_alloc;
+    allocator.free = counting_free;
+    allocator.ctx = &allocated;
+
+    cpb_rencoder_init(&encoder);
+
+    for (seg_size = 1; seg_size <= 16; seg_size++) {
+        /* Long string spanning many segments */
+        cpb_rencoder_start_chain(&encoder, foo_TestMess, &allocator, seg_size);
+        CHECK_CPB(cpb_rencoder_add_string(&encoder, foo_TestMess_test_string,
+                                          (char *) repeated_strings_3[0]));
+        check_rencoder_chain(&encoder, test_repeated_strings_3,
+                             sizeof(test_repeated_strings_3));
+
+        /* Nested messages with lengths spanning segment boundaries */
+        cpb_rencoder_start_chain(&encoder, foo_TestMess, &allocator, seg_size);
+        for (i = ARRAY_SIZE(submess_values) - 1; i >= 0; i--) {
+            CHECK_CPB(cpb_rencoder_nested_start(&encoder, foo_TestMess_test_message));
+            CHECK_CPB(cpb_rencoder_add_int32(&encoder, foo_SubMess_test, submess_values[i]));
+            CHECK_CPB(cpb_rencoder_nested_end(&encoder));
+        }
+        check_rencoder_chain(&encoder, test_repeated_submess_1,
+                             sizeof(test_repeated_submess_1));
+
+        /* Fixed width values */
+        cpb_rencoder_start_chain(&encoder, foo_TestMessPacked, NULL, seg_size);
+        CHECK_CPB(cpb_rencoder_packed_repeated_start(&encoder, foo_TestMessPacked_test_double));
+        for (i = ARRAY_SIZE(double_random) - 1; i >= 0; i--)
+            CHECK_CPB(cpb_rencoder_add_double(&encoder, foo_TestMessPacked_test_double,
+                                              double_random[i]));
+        CHECK_CPB(cpb_rencoder_packed_repeated_end(&encoder));
+        check_rencoder_chain(&encoder, test_packed_repeated_double_random,
+                             sizeof(test_packed_repeated_double_random));
+        cpb_rencoder_release(&encoder);
+    }
+
+    CHECK_VALUE(allocated, 0);
+}
+
+static void test_rencoder_ref(void)
+{
+    struct cpb_rencoder encoder;
+    struct cpb_allocator allocator;
+    struct cpb_iovec iov[64];
+    int allocated = 0;
+    size_t seg_size;
+    int i, iovcnt, refs;
+
+    allocator.alloc = counting_alloc;
+    allocator.free = counting_free;
+    allocator.ctx = &allocated;
+
+    cpb_rencoder_init(&encoder);
+    cpb_rencoder_ref_threshold(&encoder, 6);
+
+    for (seg_size = 1; seg_size <= 16; seg_size++) {
+        cpb_rencoder_start_chain(&encoder, foo_TestMess, &allocator, seg_size);
+        for (i = ARRAY_SIZE(repeated_strings_2) - 1; i >= 0; i--)
+            CHECK_CPB(cpb_rencoder_add_string(&encoder, foo_TestMess_test_string,
+                                              (char *) repeated_strings_2[i]));
+        check_rencoder_chain(&encoder, test_repeated_strings_2,
+                             sizeof(test_repeated_strings_2));
+
+        /* Payloads of six bytes and more are referenced, not copied */
+        iovcnt = cpb_rencoder_iov(&encoder, iov, ARRAY_SIZE(iov));
+        refs = 0;
+        for (i = 0; i < iovcnt; i++)
+            if (iov[i].base == repeated_strings_2[2] ||
+                iov[i].base == repeated_strings_2[3] ||
+                iov[i].base == repeated_strings_2[4])
+                refs++;
+        CHECK_VALUE(refs, 3);
+    }
+
+    /* Referenced payload as the very first write */
+    cpb_rencoder_start_chain(&encoder, foo_TestMess, &allocator, 4);
+    CHECK_CPB(cpb_rencoder_add_string(&encoder, foo_TestMess_test_string,
+                                      (char *) repeated_strings_3[0]));
+    check_rencoder_chain(&encoder, test_repeated_strings_3,
+                         sizeof(test_repeated_strings_3));
+
+    cpb_rencoder_release(&encoder);
+    CHECK_VALUE(allocated, 0);
+}
+
+static void test_varint(void)
+{
+    static const u64_t values[] = {
+        0, 1, 127, 128, 16383, 16384, 2097151, 2097152, 268435455, 268435456,
+        U32_MAX, 34359738367LL, 34359738368LL, S64_MAX, U64_MAX
+    };
+    struct cpb_buf buf;
+    u8_t data[16];
+    u64_t value, varint;
+    size_t i, len, expected_len;
+
+    for (i = 0; i < ARRAY_SIZE(values); i++) {
+        /* Reference size, one byte per 7 significant bits */
+        expected_len = 1;
+        for (value = values[i]; value > 127; value >>= 7)
+            expected_len++;
+
+        len = cpb_varint_size(values[i]);
+        CHECK_VALUE(len, expected_len);
+        CHECK_VALUE(cpb_encode_varint(NULL, values[i]), len);
+
+        memset(data, 0xaa, sizeof(data));
+        CHECK_VALUE(cpb_encode_varint(data, values[i]), len);
+        CHECK_VALUE(data[len], 0xaa);
+
+        buf.base = buf.pos = data;
+        buf.end = data + len;
+        CHECK_CPB(cpb_decode_varint(&buf, &varint));
+        CHECK_VALUE(varint, values[i]);
+        CHECK_VALUE(buf.pos - buf.base, len);
+    }
+}
+
+static void test_field_tags(void)
+{
+#if CPB_FIELD_TAGS
+    const struct cpb_msg_desc *msg_desc;
+    const struct cpb_field_desc *field_desc;
+    u8_t key[10];
+    size_t len;
+    int i, j;
+
+    for (i = 0; &cpb_messages_foo[i] <= foo_AllocValues; i++) {
+        msg_desc = &cpb_messages_foo[i];
+        for (j = 0; j < msg_desc->num_fields; j++) {
+            field_desc = &msg_desc->fields[j];
+
+            len = cpb_encode_varint(key, CPB_WIRE_TYPE(field_desc->opts.typ) |
+                                         ((u64_t) field_desc->number << 3));
+            check_buf(field_desc->tag.bytes, field_desc->tag.len, key, len,
+                      "key", __FILE__, __LINE__);
+
+            if (!CPB_IS_PACKED_REPEATED(field_desc)) {
+                CHECK_VALUE(field_desc->packed_tag.len, 0);
+                continue;
+            }
+            len = cpb_encode_varint(key, 2 | ((u64_t) field_desc->number << 3));
+            check_buf(field_desc->packed_tag.bytes, field_desc->packed_tag.len,
+                      key, len, "packed key", __FILE__, __LINE__);
+        }
+    }
+#endif
+}
+
+static void test_encode_unknown_field(void)
+{
+#if CPB_CHECK_FIELDS
+    struct cpb_encoder encoder;
+    u8_t buf[64];
+    s32_t values[] = { 1, 2 };
+
+    cpb_encoder_init(&encoder);
+    cpb_encoder_start(&encoder, foo_TestMess, buf, sizeof(buf));
+
+    /* Fields of other messages, including neighbouring field arrays */
+    CHECK_ASSERT(cpb_encoder_add_int32(&encoder, foo_SubMess_test, 1) ==
+                 CPB_ERR_UNKNOWN_FIELD, "unknown field not detected");
+    CHECK_ASSERT(cpb_encoder_add_int32(&encoder, foo_TestMessPacked_test_int32, 1) ==
+                 CPB_ERR_UNKNOWN_FIELD, "unknown field not detected");
+    CHECK_ASSERT(cpb_encoder_add_packed_array(&encoder, foo_TestMessPacked_test_int32,
+                                              values, ARRAY_SIZE(values)) ==
+                 CPB_ERR_UNKNOWN_FIELD, "unknown field not detected");
+    CHECK_VALUE(cpb_encoder_finish(&encoder), 0);
+
+    /* First and last field of the message */
+    CHECK_CPB(cpb_encoder_add_int32(&encoder, foo_TestMess_test_int32, 1));
+    CHECK_CPB(cpb_encoder_nested_start(&encoder, foo_TestMess_test_message));
+    CHECK_CPB(cpb_encoder_nested_end(&encoder));
+#endif
+}
+
+/** Sink appending to a record log, checking that chunks are bounded */
+static cpb_err_t record_sink(void *arg, const void *data, size_t len)
+{
+    struct record_log *log = arg;
+
+    CHECK_ASSERT(log->len + len <= sizeof(log->data), "sink overflow");
+    memcpy(&log->data[log->len], data, len);
+    log->len += len;
+    return CPB_ERR_OK;
+}
+
+static void test_encoder_sink(void)
+{
+    static const s32_t submess_values[] = { 42, -10000, 667 };
+    struct cpb_encoder encoder;
+    struct record_log out;
+    u8_t staging[40];
+    size_t staging_len, len;
+    int i;
+
+    cpb_encoder_init(&encoder);
+
+    for (staging_len = 24; staging_len <= sizeof(staging); staging_len++) {
+        /* Many short strings through a small staging buffer */
+        out.len = 0;
+        cpb_encoder_start_sink(&encoder, foo_TestMess, staging, staging_len,
+                               record_sink, &out);
+        for (i = 0; i < ARRAY_SIZE(repeated_strings_2); i++)
+            CHECK_CPB(cpb_encoder_add_string(&encoder, foo_TestMess_test_string,
+                                             (char *) repeated_strings_2[i]));
+        CHECK_CPB(cpb_encoder_flush(&encoder));
+        CHECK_VALUE(cpb_encoder_finish(&encoder), sizeof(test_repeated_strings_2));
+        check_buf((u8_t *) out.data, out.len, test_repeated_strings_2,
+                  sizeof(test_repeated_strings_2), "test_repeated_strings_2",
+                  __FILE__, __LINE__);
+
+        /* String larger than the staging buffer */
+        out.len = 0;
+        cpb_encoder_start_sink(&encoder, foo_TestMess, staging, staging_len,
+                               record_sink, &out);
+        CHECK_CPB(cpb_encoder_add_string(&encoder, foo_TestMess_test_string,
+                                         (char *) repeated_strings_3[0]));
+        CHECK_CPB(cpb_encoder_flush(&encoder));
+        CHECK_VALUE(cpb_encoder_finish(&encoder), sizeof(test_repeated_strings_3));
+        check_buf((u8_t *) out.data, out.len, test_repeated_strings_3,
+                  sizeof(test_repeated_strings_3), "test_repeated_strings_3",
+                  __FILE__, __LINE__);
+
+        /* Nested messages, reserved and of known length */
+        out.len = 0;
+        cpb_encoder_start_sink(&encoder, foo_TestMess, staging, staging_len,
+                               record_sink, &out);
+        for (i = 0; i < ARRAY_SIZE(submess_values); i++) {
+            if (i % 2) {
+                CHECK_CPB(cpb_encoder_nested_start(&encoder, foo_TestMess_test_message));
+            } else {
+                len = submess_values[i] < 0 ? 11 : submess_values[i] < 128 ? 2 : 3;
+                CHECK_CPB(cpb_encoder_nested_start_len(&encoder, foo_TestMess_test_message, len));
+            }
+            CHECK_CPB(cpb_encoder_add_int32(&encoder, foo_SubMess_test, submess_values[i]));
+            CHECK_CPB(cpb_encoder_nested_end(&encoder));
+        }
+        CHECK_CPB(cpb_encoder_flush(&encoder));
+        CHECK_VALUE(cpb_encoder_finish(&encoder), sizeof(test_repeated_submess_1));
+        check_buf((u8_t *) out.data, out.len, test_repeated_submess_1,
+                  sizeof(test_repeated_submess_1), "test_repeated_submess_1",
+                  __FILE__, __LINE__);
+
+        /* Packed array larger than the staging buffer */
+        out.len = 0;
+        cpb_encoder_start_sink(&encoder, foo_TestMessPacked, staging, staging_len,
+                               record_sink, &out);
+        CHECK_CPB(cpb_encoder_add_packed_array(&encoder, foo_TestMessPacked_test_double,
+                                               double_random, ARRAY_SIZE(double_random)));
+        CHECK_CPB(cpb_encoder_flush(&encoder));
+        CHECK_VALUE(cpb_encoder_finish(&encoder), sizeof(test_packed_repeated_double_random));
+        check_buf((u8_t *) out.data, out.len, test_packed_repeated_double_random,
+                  sizeof(test_packed_repeated_double_random),
+                  "test_packed_repeated_double_random", __FILE__, __LINE__);
+    }
+
+    /* Packed varints are flushed in runs that fit */
+    for (staging_len = 10; staging_len < 17; staging_len++) {
+        out.len = 0;
+        cpb_encoder_start_sink(&encoder, foo_TestMessPacked, staging, staging_len,
+                               record_sink, &out);
+        CHECK_CPB(cpb_encoder_add_packed_array(&encoder, foo_TestMessPacked_test_int32,
+                                               int32_arr_min_max,
+                                               ARRAY_SIZE(int32_arr_min_max)));
+        CHECK_CPB(cpb_encoder_flush(&encoder));
+        check_buf((u8_t *) out.data, out.len, test_packed_repeated_int32_arr_min_max,
+                  sizeof(test_packed_repeated_int32_arr_min_max),
+                  "test_packed_repeated_int32_arr_min_max", __FILE__, __LINE__);
+    }
+
+    /* Announced length must match */
+    cpb_encoder_start(&encoder, foo_TestMess, staging, sizeof(staging));
+    CHECK_CPB(cpb_encoder_nested_start_len(&encoder, foo_TestMess_test_message, 3));
+    CHECK_CPB(cpb_encoder_add_int32(&encoder, foo_SubMess_test, 1));
+    CHECK_ASSERT(cpb_encoder_nested_end(&encoder) == CPB_ERR_INVALID_FIELD,
+                 "length mismatch not detected");
+}
+
+static void test_sizer(void)
+{
+    static const s32_t submess_values[] = { 42, -10000, 667 };
+    struct cpb_sizer sizer;
+    struct cpb_encoder encoder;
+    union cpb_value value;
+    size_t sizes[2];
+    u8_t buf[sizeof(test_repeated_submess_1)];
+    u8_t packed[sizeof(test_packed_repeated_int32_arr_min_max)];
+    size_t len;
+    int i;
+
+    /* Nested messages, with room for all sizes */
+    cpb_sizer_init(&sizer, sizes, ARRAY_SIZE(sizes));
+    cpb_sizer_start(&sizer, foo_TestMess);
+    for (i = 0; i < ARRAY_SIZE(submess_values); i++) {
+        CHECK_CPB(cpb_sizer_nested_start(&sizer, foo_TestMess_test_message));
+        value.int32 = submess_values[i];
+        CHECK_CPB(cpb_sizer_add_field(&sizer, foo_SubMess_test, &value));
+        CHECK_CPB(cpb_sizer_nested_end(&sizer));
+    }
+    len = cpb_sizer_finish(&sizer);
+    CHECK_VALUE(len, sizeof(test_repeated_submess_1));
+    CHECK_VALUE(cpb_sizer_num_sizes(&sizer), 2);
+    CHECK_VALUE(sizes[0], 2);
+    CHECK_VALUE(sizes[1], 11);
+
+    /*
+     * Encode into a buffer of the exact size, the last message does not have
+     * a size and needs to reserve its length
+     */
+    cpb_encoder_init(&encoder);
+    cpb_encoder_start(&encoder, foo_TestMess, buf, len);
+    cpb_encoder_size_hints(&encoder, sizes, cpb_sizer_num_sizes(&sizer));
+    for (i = 0; i < 2; i++) {
+        CHECK_CPB(cpb_encoder_nested_start(&encoder, foo_TestMess_test_message));
+        CHECK_CPB(cpb_encoder_add_int32(&encoder, foo_SubMess_test, submess_values[i]));
+        CHECK_CPB(cpb_encoder_nested_end(&encoder));
+    }
+    CHECK_ASSERT(cpb_encoder_nested_start(&encoder, foo_TestMess_test_message) ==
+                 CPB_ERR_END_OF_BUF, "missing size not detected");
+
+    /* Encode into a buffer of the exact size, with all sizes */
+    cpb_sizer_init(&sizer, sizes, ARRAY_SIZE(sizes));
+    cpb_sizer_start(&sizer, foo_TestMess);
+    for (i = 1; i < ARRAY_SIZE(submess_values); i++) {
+        CHECK_CPB(cpb_sizer_nested_start(&sizer, foo_TestMess_test_message));
+        value.int32 = submess_values[i];
+        CHECK_CPB(cpb_sizer_add_field(&sizer, foo_SubMess_test, &value));
+        CHECK_CPB(cpb_sizer_nested_end(&sizer));
+    }
+    len = cpb_sizer_finish(&sizer);
+    CHECK_VALUE(cpb_sizer_num_sizes(&sizer), 2);
+
+    cpb_encoder_start(&encoder, foo_TestMess, buf, len);
+    cpb_encoder_size_hints(&encoder, sizes, cpb_sizer_num_sizes(&sizer));
+    for (i = 1; i < ARRAY_SIZE(submess_values); i++) {
+        CHECK_CPB(cpb_encoder_nested_start(&encoder, foo_TestMess_test_message));
+        CHECK_CPB(cpb_encoder_add_int32(&encoder, foo_SubMess_test, submess_values[i]));
+        CHECK_CPB(cpb_encoder_nested_end(&encoder));
+    }
+    CHECK_VALUE(cpb_encoder_finish(&encoder), len);
+    check_buf(buf, len, test_repeated_submess_1 + 5, sizeof(test_repeated_submess_1) - 5,
+              "test_repeated_submess_1", __FILE__, __LINE__);
+
+    /* Packed repeated fields, element by element and in bulk */
+    cpb_sizer_init(&sizer, NULL, 0);
+    cpb_sizer_start(&sizer, foo_TestMessPacked);
+    CHECK_CPB(cpb_sizer_packed_repeated_start(&sizer, foo_TestMessPacked_test_int32));
+    for (i = 0; i < ARRAY_SIZE(int32_arr_min_max); i++) {
+        value.int32 = int32_arr_min_max[i];
+        CHECK_CPB(cpb_sizer_add_field(&sizer, foo_TestMessPacked_test_int32, &value));
+    }
+    CHECK_CPB(cpb_sizer_packed_repeated_end(&sizer));
+    CHECK_VALUE(cpb_sizer_finish(&sizer), sizeof(packed));
+    CHECK_VALUE(cpb_sizer_num_sizes(&sizer), 0);
+
+    cpb_sizer_start(&sizer, foo_TestMessPacked);
+    CHECK_CPB(cpb_sizer_add_packed_array(&sizer, foo_TestMessPacked_test_int32,
+                                         int32_arr_min_max, ARRAY_SIZE(int32_arr_min_max)));
+    CHECK_VALUE(cpb_sizer_finish(&sizer), sizeof(packed));
+
+#if CPB_CHECK_FIELDS
+    /* Fields of other messages */
+    cpb_sizer_start(&sizer, foo_TestMess);
+    value.int32 = 1;
+    CHECK_ASSERT(cpb_sizer_add_field(&sizer, foo_SubMess_test, &value) ==
+                 CPB_ERR_UNKNOWN_FIELD, "unknown field not detected");
+    CHECK_ASSERT(cpb_sizer_nested_start(&sizer, foo_TestMessRequiredMessage_test) ==
+                 CPB_ERR_UNKNOWN_FIELD, "unknown field not detected");
+#endif
+}
+
+static void test_merge(void)
+{
+    static const u8_t submess[] = { 0x20, 0x9b, 0x05 };
+    const struct cpb_field_desc *path[] = { foo_TestMess_test_message };
+    const struct cpb_field_desc *bad_path[] = { foo_TestMessRequiredMessage_test };
+    struct cpb_iovec iov[3];
+    u8_t buf[sizeof(test_repeated_submess_1)];
+    size_t len;
+
+    /* Concatenate the three nested messages */
+    iov[0].base = (void *) test_repeated_submess_1;
+    iov[0].len = 5;
+    iov[1].base = (void *) (test_repeated_submess_1 + 5);
+    iov[1].len = 14;
+    iov[2].base = (void *) (test_repeated_submess_1 + 19);
+    iov[2].len = 6;
+    CHECK_CPB(cpb_merge_concat(iov, ARRAY_SIZE(iov), buf, sizeof(buf), &len));
+    CHECK_BUF(buf, len, test_repeated_submess_1);
+
+    /* Append to the first message in place */
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, test_repeated_submess_1, 5);
+    iov[0].base = buf;
+    CHECK_CPB(cpb_merge_concat(iov, ARRAY_SIZE(iov), buf, sizeof(buf), &len));
+    CHECK_BUF(buf, len, test_repeated_submess_1);
+
+    CHECK_ASSERT(cpb_merge_concat(iov, ARRAY_SIZE(iov), buf, sizeof(buf) - 1, NULL) ==
+                 CPB_ERR_END_OF_BUF, "short buffer not detected");
+
+    /* Splice the last nested message, copied and in place */
+    memset(buf, 0, sizeof(buf));
+    CHECK_CPB(cpb_merge_splice(foo_TestMess, test_repeated_submess_1, 19,
+                               path, ARRAY_SIZE(path), submess, sizeof(submess),
+                               buf, sizeof(buf), &len));
+    CHECK_BUF(buf, len, test_repeated_submess_1);
+
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, test_repeated_submess_1, 19);
+    CHECK_CPB(cpb_merge_splice(foo_TestMess, buf, 19,
+                               path, ARRAY_SIZE(path), submess, sizeof(submess),
+                               buf, sizeof(buf), &len));
+    CHECK_BUF(buf, len, test_repeated_submess_1);
+
+    CHECK_ASSERT(cpb_merge_splice(foo_TestMess, test_repeated_submess_1, 19,
+                                  path, ARRAY_SIZE(path), submess, sizeof(submess),
+                                  buf, sizeof(buf) - 1, NULL) ==
+                 CPB_ERR_END_OF_BUF, "short buffer not detected");
+#if CPB_CHECK_FIELDS
+    CHECK_ASSERT(cpb_merge_splice(foo_TestMess, test_repeated_submess_1, 19,
+                                  bad_path, ARRAY_SIZE(bad_path), submess, sizeof(submess),
+                                  buf, sizeof(buf), NULL) ==
+                 CPB_ERR_UNKNOWN_FIELD, "unknown field not detected");
+#endif
+}
+
+static void test_encoder_raw(void)
+{
+    static const u8_t submess[] = { 0x20, 0x9b, 0x05 };
+    struct cpb_encoder encoder;
+    struct cpb_sizer sizer;
+    struct record_log out;
+    u8_t fragment[16];
+    u8_t staging[24];
+    u8_t buf[64];
+    size_t fragment_len;
+
+    /* Encode a nested message once as a fragment */
+    cpb_encoder_init(&encoder);
+    cpb_encoder_start(&encoder, foo_TestMess, fragment, sizeof(fragment));
+    CHECK_CPB(cpb_encoder_nested_start(&encoder, foo_TestMess_test_message));
+    CHECK_CPB(cpb_encoder_add_int32(&encoder, foo_SubMess_test, 42));
+    CHECK_CPB(cpb_encoder_nested_end(&encoder));
+    fragment_len = cpb_encoder_finish(&encoder);
+
+    /* Fragment, nested message and encoded message */
+    cpb_encoder_start(&encoder, foo_TestMess, buf, sizeof(buf));
+    CHECK_CPB(cpb_encoder_add_raw(&encoder, fragment, fragment_len));
+    CHECK_CPB(cpb_encoder_nested_start(&encoder, foo_TestMess_test_message));
+    CHECK_CPB(cpb_encoder_add_int32(&encoder, foo_SubMess_test, -10000));
+    CHECK_CPB(cpb_encoder_nested_end(&encoder));
+    CHECK_CPB(cpb_encoder_add_message(&encoder, foo_TestMess_test_message,
+                                      submess, sizeof(submess)));
+    CHECK_BUF(buf, cpb_encoder_finish(&encoder), test_repeated_submess_1);
+
+    cpb_sizer_init(&sizer, NULL, 0);
+    cpb_sizer_start(&sizer, foo_TestMess);
+    CHECK_CPB(cpb_sizer_add_raw(&sizer, sizeof(test_repeated_submess_1)));
+    CHECK_VALUE(cpb_sizer_finish(&sizer), sizeof(test_repeated_submess_1));
+
+    /* Out of space */
+    cpb_encoder_start(&encoder, foo_TestMess, buf, sizeof(test_repeated_submess_1) - 1);
+    CHECK_ASSERT(cpb_encoder_add_raw(&encoder, test_repeated_submess_1,
+                                     sizeof(test_repeated_submess_1)) ==
+                 CPB_ERR_END_OF_BUF, "end of buffer not detected");
+    CHECK_VALUE(cpb_encoder_finish(&encoder), 0);
+
+    /* Fragments larger than the staging buffer go to the sink directly */
+    out.len = 0;
+    cpb_encoder_start_sink(&encoder, foo_TestMess, staging, sizeof(staging),
+                           record_sink, &out);
+    CHECK_CPB(cpb_encoder_add_raw(&encoder, fragment, fragment_len));
+    CHECK_CPB(cpb_encoder_add_raw(&encoder, test_repeated_submess_1 + fragment_len,
+                                  sizeof(test_repeated_submess_1) - fragment_len));
+    CHECK_CPB(cpb_encoder_add_raw(&encoder, test_repeated_submess_1,
+                                  sizeof(test_repeated_submess_1)));
+    CHECK_CPB(cpb_encoder_flush(&encoder));
+    CHECK_VALUE(cpb_encoder_finish(&encoder), 2 * sizeof(test_repeated_submess_1));
+    check_buf((u8_t *) out.data, sizeof(test_repeated_submess_1),
+              test_repeated_submess_1, sizeof(test_repeated_submess_1),
+              "test_repeated_submess_1", __FILE__, __LINE__);
+    check_buf((u8_t *) out.data + sizeof(test_repeated_submess_1),
+              out.len - sizeof(test_repeated_submess_1),
+              test_repeated_submess_1, sizeof(test_repeated_submess_1),
+              "test_repeated_submess_1", __FILE__, __LINE__);
+}
+
+static void test_encoder_checkpoint(void)
+{
+    static const s32_t values[] = { 42, -10000, 667 };
+    struct cpb_encoder encoder;
+    struct cpb_encoder_checkpoint checkpoint, inner;
+    struct record_log out;
+    u8_t staging[24];
+    u8_t buf[64];
+    cpb_err_t ret;
+    size_t i;
+
+    /* Add as many nested messages as fit, the third one does not */
+    cpb_encoder_init(&encoder);
+    cpb_encoder_start(&encoder, foo_TestMess, buf, sizeof(test_repeated_submess_1) - 1);
+    for (i = 0; i < ARRAY_SIZE(values); i++) {
+        cpb_encoder_checkpoint(&encoder, &checkpoint);
+        ret = cpb_encoder_nested_start_len(&encoder, foo_TestMess_test_message,
+                                           cpb_varint_size(values[i]) + 1);
+        if (ret == CPB_ERR_OK)
+            ret = cpb_encoder_add_int32(&encoder, foo_SubMess_test, values[i]);
+        if (ret == CPB_ERR_OK)
+            ret = cpb_encoder_nested_end(&encoder);
+        if (ret != CPB_ERR_OK) {
+            CHECK_VALUE(ret, CPB_ERR_END_OF_BUF);
+            cpb_encoder_rollback(&encoder, &checkpoint);
+            break;
+        }
+        cpb_encoder_commit(&encoder, &checkpoint);
+    }
+    CHECK_VALUE(i, 2);
+    CHECK_VALUE(cpb_encoder_finish(&encoder), 5 + 14);
+    check_buf(buf, 5 + 14, test_repeated_submess_1, 5 + 14,
+              "test_repeated_submess_1", __FILE__, __LINE__);
+
+    /* Drop reserved nested messages and nested checkpoints */
+    cpb_encoder_start(&encoder, foo_TestMess, buf, sizeof(buf));
+    CHECK_CPB(cpb_encoder_nested_start(&encoder, foo_TestMess_test_message));
+    CHECK_CPB(cpb_encoder_add_int32(&encoder, foo_SubMess_test, 42));
+    cpb_encoder_checkpoint(&encoder, &checkpoint);
+    CHECK_CPB(cpb_encoder_add_int32(&encoder, foo_SubMess_test, 1));
+    cpb_encoder_checkpoint(&encoder, &inner);
+    CHECK_CPB(cpb_encoder_add_int32(&encoder, foo_SubMess_test, 2));
+    cpb_encoder_commit(&encoder, &inner);
+    cpb_encoder_rollback(&encoder, &checkpoint);
+    CHECK_CPB(cpb_encoder_nested_end(&encoder));
+    cpb_encoder_checkpoint(&encoder, &checkpoint);
+    CHECK_CPB(cpb_encoder_nested_start(&encoder, foo_TestMess_test_message));
+    CHECK_CPB(cpb_encoder_add_int32(&encoder, foo_SubMess_test, 7));
+    cpb_encoder_rollback(&encoder, &checkpoint);
+    CHECK_CPB(cpb_encoder_nested_start(&encoder, foo_TestMess_test_message));
+    CHECK_CPB(cpb_encoder_add_int32(&encoder, foo_SubMess_test, -10000));
+    CHECK_CPB(cpb_encoder_nested_end(&encoder));
+    CHECK_CPB(cpb_encoder_nested_start(&encoder, foo_TestMess_test_message));
+    CHECK_CPB(cpb_encoder_add_int32(&encoder, foo_SubMess_test, 667));
+    CHECK_CPB(cpb_encoder_nested_end(&encoder));
+    CHECK_BUF(buf, cpb_encoder_finish(&encoder), test_repeated_submess_1);
+
+    /* Bytes after a checkpoint are not passed to the sink */
+    out.len = 0;
+    cpb_encoder_start_sink(&encoder, foo_TestMess, staging, sizeof(staging),
+                           record_sink, &out);
+    for (i = 0; i < ARRAY_SIZE(values); i++) {
+        CHECK_CPB(cpb_encoder_nested_start_len(&encoder, foo_TestMess_test_message,
+                                               cpb_varint_size(values[i]) + 1));
+        CHECK_CPB(cpb_encoder_add_int32(&encoder, foo_SubMess_test, values[i]));
+        CHECK_CPB(cpb_encoder_nested_end(&encoder));
+        if (i == 0)
+            cpb_encoder_checkpoint(&encoder, &checkpoint);
+    }
+    CHECK_CPB(cpb_encoder_flush(&encoder));
+    CHECK_VALUE(out.len, 5);
+    CHECK_ASSERT(cpb_encoder_add_raw(&encoder, test_repeated_submess_1,
+                                     sizeof(test_repeated_submess_1)) ==
+                 CPB_ERR_END_OF_BUF, "end of buffer not detected");
+    cpb_encoder_rollback(&encoder, &checkpoint);
+    CHECK_CPB(cpb_encoder_add_raw(&encoder, test_repeated_submess_1 + 5, 14 + 6));
+    CHECK_CPB(cpb_encoder_flush(&encoder));
+    CHECK_VALUE(cpb_encoder_finish(&encoder), sizeof(test_repeated_submess_1));
+    check_buf((u8_t *) out.data, out.len,
+              test_repeated_submess_1, sizeof(test_repeated_submess_1),
+              "test_repeated_submess_1", __FILE__, __LINE__);
+}
+
+static void test_batch(void)
+{
+    struct cpb_batch batch;
+    size_t offsets[4];
+    char str[131];
+    u8_t buf[256];
+    u8_t *record;
+
+    memset(str, 'x', sizeof(str) - 1);
+    str[sizeof(str) - 1] = '\0';
+
+    cpb_batch_init(&batch, buf, sizeof(buf), offsets, ARRAY_SIZE(offsets));
+
+    /* Prefix of the hinted width */
+    CHECK_CPB(cpb_batch_start(&batch, foo_TestMess, 0));
+    CHECK_CPB(cpb_encoder_nested_start(&batch.encoder, foo_TestMess_test_message));
+    CHECK_CPB(cpb_encoder_add_int32(&batch.encoder, foo_SubMess_test, 42));
+    CHECK_CPB(cpb_encoder_nested_end(&batch.encoder));
+    CHECK_CPB(cpb_batch_finish(&batch));
+
+    /* Dropped record */
+    CHECK_CPB(cpb_batch_start(&batch, foo_TestMess, 0));
+    CHECK_CPB(cpb_encoder_add_int32(&batch.encoder, foo_TestMess_test_int32, 1));
+    cpb_batch_abort(&batch);
+
+    /* Padded prefix */
+    CHECK_CPB(cpb_batch_start(&batch, foo_TestMess, 200));
+    CHECK_CPB(cpb_encoder_nested_start(&batch.encoder, foo_TestMess_test_message));
+    CHECK_CPB(cpb_encoder_add_int32(&batch.encoder, foo_SubMess_test, -10000));
+    CHECK_CPB(cpb_encoder_nested_end(&batch.encoder));
+    CHECK_CPB(cpb_batch_finish(&batch));
+
+    /* Message larger than hinted */
+    CHECK_CPB(cpb_batch_start(&batch, foo_TestMess, 0));
+    CHECK_CPB(cpb_encoder_add_string(&batch.encoder, foo_TestMess_test_string, str));
+    CHECK_CPB(cpb_batch_finish(&batch));
+
+    CHECK_VALUE(cpb_batch_num_records(&batch), 3);
+    CHECK_VALUE(offsets[0], 0);
+    CHECK_VALUE(offsets[1], 1 + 5);
+    CHECK_VALUE(offsets[2], 1 + 5 + 2 + 14);
+    CHECK_VALUE(cpb_batch_used(&batch), offsets[2] + 2 + 134);
+
+    record = buf;
+    CHECK_VALUE(record[0], 5);
+    check_buf(record + 1, 5, test_repeated_submess_1, 5,
+              "test_repeated_submess_1", __FILE__, __LINE__);
+    record = buf + offsets[1];
+    CHECK_VALUE(record[0], 0x8e);
+    CHECK_VALUE(record[1], 0x00);
+    check_buf(record + 2, 14, test_repeated_submess_1 + 5, 14,
+              "test_repeated_submess_1", __FILE__, __LINE__);
+    record = buf + offsets[2];
+    CHECK_VALUE(record[0], 0x86);
+    CHECK_VALUE(record[1], 0x01);
+    CHECK_VALUE(record[4], 0x82);
+    CHECK_VALUE(record[5], 1);
+    CHECK_VALUE(record[2 + 134 - 1], 'x');
+
+    /* Out of space and out of record offsets */
+    CHECK_CPB(cpb_batch_start(&batch, foo_TestMess, 0));
+    CHECK_ASSERT(cpb_encoder_add_string(&batch.encoder, foo_TestMess_test_string,
+                                        str) == CPB_ERR_END_OF_BUF,
+                 "end of buffer not detected");
+    cpb_batch_abort(&batch);
+    CHECK_CPB(cpb_batch_start(&batch, foo_TestMess, 0));
+    CHECK_CPB(cpb_batch_finish(&batch));
+    CHECK_ASSERT(cpb_batch_start(&batch, foo_TestMess, 0) == CPB_ERR_MEM,
+                 "record offsets overflow not detected");
+    CHECK_VALUE(cpb_batch_num_records(&batch), 4);
+    CHECK_VALUE(offsets[3], offsets[2] + 2 + 134);
+    CHECK_VALUE(buf[offsets[3]], 0);
+}
+
+struct opt_struct {
+    u32_t present[1];
+    s32_t test_int32;
+    double test_double;
+    cpb_enum_t test_enum;
+    char test_string[8];
+};
+
+CPB_STRUCT_MAP_BEGIN_PRESENCE(opt_presence_map, foo_TestMessOptional,
+                              struct opt_struct, present, 0)
+CPB_STRUCT_MAP_INT32(foo_TestMessOptional_test_int32, struct opt_struct, test_int32, 1)
+CPB_STRUCT_MAP_DOUBLE(foo_TestMessOptional_test_double, struct opt_struct, test_double, 1)
+CPB_STRUCT_MAP_ENUM(foo_TestMessOptional_test_enum, struct opt_struct, test_enum, 1)
+CPB_STRUCT_MAP_STRING(foo_TestMessOptional_test_string, struct opt_struct, test_string, 8, 1)
+CPB_STRUCT_MAP_END
+
+CPB_STRUCT_MAP_BEGIN_FLAGS(opt_defaults_map, foo_TestMessOptional,
+                           struct opt_struct, CPB_STRUCT_MAP_SKIP_DEFAULTS)
+CPB_STRUCT_MAP_INT32(foo_TestMessOptional_test_int32, struct opt_struct, test_int32, 1)
+CPB_STRUCT_MAP_DOUBLE(foo_TestMessOptional_test_double, struct opt_struct, test_double, 1)
+CPB_STRUCT_MAP_ENUM(foo_TestMessOptional_test_enum, struct opt_struct, test_enum, 1)
+CPB_STRUCT_MAP_STRING(foo_TestMessOptional_test_string, struct opt_struct, test_string, 8, 1)
+CPB_STRUCT_MAP_END
+
+struct bytes_struct {
+    u8_t v_bytes[16];
+};
+
+/* Copy of the generated descriptor with the length of its default bytes */
+static struct cpb_field_desc v_bytes_desc;
+
+CPB_STRUCT_MAP_BEGIN_FLAGS(bytes_generated_map, foo_DefaultOptionalValues,
+                           struct bytes_struct, CPB_STRUCT_MAP_SKIP_DEFAULTS)
+CPB_STRUCT_MAP_BYTES(foo_DefaultOptionalValues_v_bytes, struct bytes_struct, v_bytes, 16, 1)
+CPB_STRUCT_MAP_END
+
+CPB_STRUCT_MAP_BEGIN_FLAGS(bytes_defaults_map, foo_DefaultOptionalValues,
+                           struct bytes_struct, CPB_STRUCT_MAP_SKIP_DEFAULTS)
+CPB_STRUCT_MAP_BYTES(&v_bytes_desc, struct bytes_struct, v_bytes, 16, 1)
+CPB_STRUCT_MAP_END
+
+CPB_STRUCT_MAP_BEGIN_FLAGS(bytes_zero_map, foo_TestMessOptional,
+                           struct bytes_struct, CPB_STRUCT_MAP_SKIP_DEFAULTS)
+CPB_STRUCT_MAP_BYTES(foo_TestMessOptional_test_bytes, struct bytes_struct, v_bytes, 16, 1)
+CPB_STRUCT_MAP_END
+
+static void test_struct_presence(void)
+{
+    static const u8_t present_fields[] = {
+        0x08, 0x05,
+        0x61, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x82, 0x01, 0x00
+    };
+    static const u8_t non_default_fields[] = {
+        0x61, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xf8, 0x3f,
+        0x82, 0x01, 0x02, 'a', 'b'
+    };
+    struct cpb_struct_decoder sdecoder;
+    struct bytes_struct bytes;
+    struct opt_struct opt;
+    u8_t buf[64];
+    size_t len;
+
+    /* Explicit zeros are encoded, absent fields are not */
+    memset(&opt, 0, sizeof(opt));
+    opt.test_int32 = 5;
+    opt.test_enum = 3;
+    CPB_STRUCT_SET_PRESENT(&opt_presence_map, &opt, 0);
+    CPB_STRUCT_SET_PRESENT(&opt_presence_map, &opt, 1);
+    CPB_STRUCT_SET_PRESENT(&opt_presence_map, &opt, 3);
+    CHECK_CPB(cpb_struct_encode(&opt_presence_map, &opt, buf, sizeof(buf), &len));
+    CHECK_BUF(buf, len, present_fields);
+    CHECK_VALUE(cpb_encoded_size(&opt_presence_map, &opt), sizeof(present_fields));
+
+    /* The struct decoder sets the presence bits */
+    memset(&opt, 0, sizeof(opt));
+    cpb_struct_decoder_init(&sdecoder);
+    CHECK_CPB(cpb_struct_decoder_decode(&sdecoder, &opt_presence_map, &opt,
+                                        (void *) present_fields,
+                                        sizeof(present_fields), NULL));
+    CHECK_VALUE(opt.present[0], 0x0b);
+    CHECK_VALUE(opt.test_int32, 5);
+
+    /* Default values are left out */
+    memset(&opt, 0, sizeof(opt));
+    opt.test_double = 1.5;
+    strcpy(opt.test_string, "ab");
+    CHECK_CPB(cpb_struct_encode(&opt_defaults_map, &opt, buf, sizeof(buf), &len));
+    CHECK_BUF(buf, len, non_default_fields);
+
+    /* Bytes arrays holding the default bytes followed by zeros */
+    v_bytes_desc = *foo_DefaultOptionalValues_v_bytes;
+    v_bytes_desc.def.bytes.len = 13;
+    memset(&bytes, 0, sizeof(bytes));
+    CHECK_VALUE(cpb_encoded_size(&bytes_zero_map, &bytes), 0);
+    memcpy(bytes.v_bytes, "a \0 character", 13);
+    CHECK_VALUE(cpb_encoded_size(&bytes_defaults_map, &bytes), 0);
+    CHECK_VALUE(cpb_encoded_size(&bytes_zero_map, &bytes), 3 + 16);
+    /* The length of generated bytes defaults is unknown */
+    CHECK_VALUE(cpb_encoded_size(&bytes_generated_map, &bytes), 2 + 16);
+    bytes.v_bytes[15] = 1;
+    CHECK_VALUE(cpb_encoded_size(&bytes_defaults_map, &bytes), 2 + 16);
+}
+
+static void test_struct_diff(void)
+{
+    static const u8_t zero_int32[] = { 0x08, 0x00 };
+    struct opt_struct old, new;
+    u8_t buf[64];
+    size_t len;
+
+    /* Changes to the default value are encoded */
+    memset(&old, 0, sizeof(old));
+    old.test_int32 = 5;
+    old.test_double = 1.5;
+    new = old;
+    new.test_int32 = 0;
+    CHECK_CPB(cpb_struct_diff_encode(&opt_defaults_map, &old, &new,
+                                     buf, sizeof(buf), &len));
+    CHECK_BUF(buf, len, zero_int32);
+    CHECK_CPB(cpb_struct_apply_delta(&opt_defaults_map, &old, buf, len));
+    CHECK_VALUE(old.test_int32, 0);
+
+    /* Fields becoming present are encoded, even with the same value */
+    memset(&old, 0, sizeof(old));
+    CPB_STRUCT_SET_PRESENT(&opt_presence_map, &old, 1);
+    new = old;
+    CPB_STRUCT_SET_PRESENT(&opt_presence_map, &new, 0);
+    CHECK_CPB(cpb_struct_diff_encode(&opt_presence_map, &old, &new,
+                                     buf, sizeof(buf), &len));
+    CHECK_BUF(buf, len, zero_int32);
+
+    /* Removed fields cannot be carried by a delta */
+    CHECK_ASSERT(cpb_struct_diff_encode(&opt_presence_map, &new, &old,
+                                        buf, sizeof(buf), &len) ==
+                 CPB_ERR_INVALID_FIELD, "removed field not detected");
+}
+
+/* Struct map with more fields than an encoding cache tracks */
+#define WIDE_FIELD \
+    CPB_STRUCT_MAP_INT32(foo_TestMessOptional_test_int32, struct opt_struct, test_int32, 1)
+#define WIDE_FIELDS_8 \
+    WIDE_FIELD WIDE_FIELD WIDE_FIELD WIDE_FIELD \
+    WIDE_FIELD WIDE_FIELD WIDE_FIELD WIDE_FIELD
+
+CPB_STRUCT_MAP_BEGIN(wide_map, foo_TestMessOptional, struct opt_struct)
+WIDE_FIELDS_8 WIDE_FIELDS_8 WIDE_FIELDS_8 WIDE_FIELDS_8
+WIDE_FIELDS_8 WIDE_FIELDS_8 WIDE_FIELDS_8 WIDE_FIELDS_8
+WIDE_FIELD
+CPB_STRUCT_MAP_END
+
+static void test_struct_cache(void)
+{
+    struct cpb_struct_cache cache;
+    struct opt_struct opt;
+    u8_t buf[256], buf2[256];
+    size_t len, len2;
+
+    /* Fields marked by index */
+    memset(&opt, 0, sizeof(opt));
+    opt.test_int32 = 5;
+    strcpy(opt.test_string, "ab");
+    cpb_struct_cache_init(&cache, &opt_defaults_map, buf, sizeof(buf));
+    CHECK_CPB(cpb_struct_cache_encode(&cache, &opt, &len));
+    strcpy(opt.test_string, "abcd");
+    cpb_struct_cache_mark_dirty_index(&cache, 3);
+    cpb_struct_cache_mark_dirty_index(&cache, 4);
+    CHECK_CPB(cpb_struct_cache_encode(&cache, &opt, &len));
+    CHECK_CPB(cpb_struct_encode(&opt_defaults_map, &opt, buf2, sizeof(buf2), &len2));
+    check_buf(buf, len, buf2, len2, "opt_defaults_map", __FILE__, __LINE__);
+
+    /* Too many fields, the whole struct is encoded every time */
+    memset(&opt, 0, sizeof(opt));
+    opt.test_int32 = 5;
+    cpb_struct_cache_init(&cache, &wide_map, buf, sizeof(buf));
+    CHECK_CPB(cpb_struct_cache_encode(&cache, &opt, &len));
+    CHECK_VALUE(len, 65 * 2);
+    opt.test_int32 = 300;
+    CHECK_CPB(cpb_struct_cache_encode(&cache, &opt, &len));
+    CHECK_CPB(cpb_struct_encode(&wide_map, &opt, buf2, sizeof(buf2), &len2));
+    check_buf(buf, len, buf2, len2, "wide_map", __FILE__, __LINE__);
+    CHECK_VALUE(len, 65 * 3);
+
+    cpb_struct_cache_init(&cache, &wide_map, buf, 100);
+    CHECK_ASSERT(cpb_struct_cache_encode(&cache, &opt, &len) == CPB_ERR_END_OF_BUF,
+                 "end of buffer not detected");
+}
+
+struct rep_struct {
+    s32_t test_int32[4];
+    u32_t test_uint32[2];
+};
+
+CPB_STRUCT_MAP_BEGIN(rep_map, foo_TestMess, struct rep_struct)
+CPB_STRUCT_MAP_INT32(foo_TestMess_test_int32, struct rep_struct, test_int32, 4)
+CPB_STRUCT_MAP_UINT32(foo_TestMess_test_uint32, struct rep_struct, test_uint32, 2)
+CPB_STRUCT_MAP_END
+
+static void count_field_handler(struct cpb_struct_decoder *sdecoder,
+                                const struct cpb_msg_desc *msg_desc,
+                                const struct cpb_field_desc *field_desc,
+                                union cpb_value *value, void *arg)
+{
+    (*(int *) arg)++;
+}
+
+/* Message holding a message of its own type, to nest arbitrarily deep */
+static const struct cpb_msg_desc node_desc;
+
+static const struct cpb_field_desc node_fields[] = {
+    {
+        .number = 1,
+        .opts.label = CPB_OPTIONAL,
+        .opts.typ = CPB_MESSAGE,
+        .msg_desc = &node_desc,
+    },
+};
+
+static const struct cpb_msg_desc node_desc = { 1, node_fields };
+
+struct node_struct {
+    s32_t unused;
+};
+
+/* Nested nodes share the struct of their parent */
+CPB_STRUCT_MAP_BEGIN(node_map, &node_desc, struct node_struct)
+CPB_STRUCT_MAP_MESSAGE(&node_fields[0], struct node_struct, unused, &node_map, 1)
+CPB_STRUCT_MAP_END
+
+/**
+ * Builds a message of nested nodes.
+ * @param buf Buffer of at least 2 * depth bytes
+ * @param depth Number of nested nodes
+ * @return Returns the length of the message.
+ */
+static size_t nest_nodes(u8_t *buf, int depth)
+{
+    int i;
+
+    for (i = 0; i < depth; i++) {
+        buf[2 * i] = 0x0a;
+        buf[2 * i + 1] = 2 * (depth - i - 1);
+    }
+
+    return 2 * depth;
+}
+
+static void test_struct_decoder(void)
+{
+    static const u8_t fields[] = {
+        0x0a, 0x03, 0x01, 0x02, 0x03,
+        0x98, 0x01, 0x05,
+        0x38, 0x07, 0x38, 0x08, 0x38, 0x09,
+        0x80, 0x01, 0x01,
+        0x8a, 0x01, 0x01, 'x'
+    };
+    struct cpb_struct_decoder sdecoder;
+    struct rep_struct rep;
+    struct node_struct node;
+    u8_t deep[2 * CPB_MAX_DEPTH];
+    size_t used, len;
+    int count = 0;
+
+    /* Packed input, unknown fields, wrong wire types and excess elements */
+    memset(&rep, 0, sizeof(rep));
+    cpb_struct_decoder_init(&sdecoder);
+    CHECK_CPB(cpb_struct_decoder_decode(&sdecoder, &rep_map, &rep,
+                                        (void *) fields, sizeof(fields), &used));
+    CHECK_VALUE(used, sizeof(fields));
+    CHECK_VALUE(rep.test_int32[0], 1);
+    CHECK_VALUE(rep.test_int32[1], 2);
+    CHECK_VALUE(rep.test_int32[2], 3);
+    CHECK_VALUE(rep.test_int32[3], 0);
+    CHECK_VALUE(rep.test_uint32[0], 7);
+    CHECK_VALUE(rep.test_uint32[1], 8);
+
+    /* The field handler also sees the fields that are not mapped */
+    cpb_struct_decoder_arg(&sdecoder, &count);
+    cpb_struct_decoder_field_handler(&sdecoder, count_field_handler);
+    CHECK_CPB(cpb_struct_decoder_decode(&sdecoder, &rep_map, &rep,
+                                        (void *) fields, sizeof(fields), NULL));
+    CHECK_VALUE(count, 7);
+
+    CHECK_ASSERT(cpb_struct_decoder_decode(&sdecoder, &rep_map, &rep,
+                                           (void *) fields, 4, NULL) == CPB_ERR_END_OF_BUF,
+                 "truncated message not detected");
+
+    /* Too deeply nested messages */
+    len = nest_nodes(deep, CPB_MAX_DEPTH - 1);
+    CHECK_CPB(cpb_struct_decoder_decode(&sdecoder, &node_map, &node,
+                                        deep, len, NULL));
+    len = nest_nodes(deep, CPB_MAX_DEPTH);
+    CHECK_ASSERT(cpb_struct_decoder_decode(&sdecoder, &node_map, &node,
+                                           deep, len, NULL) == CPB_ERR_DEPTH,
+                 "nesting depth not detected");
+}
+
+struct int32_iter {
+    const s32_t *array;
+    size_t n;
+    size_t i;
+};
+
+static cpb_bool_t next_int32(void *arg, union cpb_value *value)
+{
+    struct int32_iter *iter = arg;
+
+    if (iter->i == iter->n)
+        return 0;
+    value->int32 = iter->array[iter->i++];
+    return 1;
+}
+
+static void test_encoder_iter(void)
+{
+    struct cpb_encoder encoder;
+    struct int32_iter iter;
+    u8_t buf[64];
+
+    /* Packed */
+    iter.array = int32_arr_min_max;
+    iter.n = ARRAY_SIZE(int32_arr_min_max);
+    iter.i = 0;
+    cpb_encoder_init(&encoder);
+    cpb_encoder_start(&encoder, foo_TestMessPacked, buf, sizeof(buf));
+    CHECK_CPB(cpb_encoder_add_repeated(&encoder, foo_TestMessPacked_test_int32,
+                                       next_int32, &iter));
+    CHECK_BUF(buf, cpb_encoder_finish(&encoder), test_packed_repeated_int32_arr_min_max);
+
+    /* Not packed */
+    iter.i = 0;
+    cpb_encoder_start(&encoder, foo_TestMess, buf, sizeof(buf));
+    CHECK_CPB(cpb_encoder_add_repeated(&encoder, foo_TestMess_test_int32,
+                                       next_int32, &iter));
+    CHECK_BUF(buf, cpb_encoder_finish(&encoder), test_repeated_int32_arr_min_max);
+
+    /* Empty */
+    iter.n = 0;
+    iter.i = 0;
+    cpb_encoder_start(&encoder, foo_TestMessPacked, buf, sizeof(buf));
+    CHECK_CPB(cpb_encoder_add_repeated(&encoder, foo_TestMessPacked_test_int32,
+                                       next_int32, &iter));
+    CHECK_VALUE(cpb_encoder_finish(&encoder), 0);
+
+    /* A packed field that does not fit is dropped */
+    iter.n = ARRAY_SIZE(int32_arr_min_max);
+    iter.i = 0;
+    cpb_encoder_start(&encoder, foo_TestMessPacked, buf,
+                      sizeof(test_packed_repeated_int32_arr_min_max) + 4);
+    CHECK_ASSERT(cpb_encoder_add_repeated(&encoder, foo_TestMessPacked_test_int32,
+                                          next_int32, &iter) == CPB_ERR_END_OF_BUF,
+                 "end of buffer not detected");
+    CHECK_VALUE(encoder.depth, 1);
+    CHECK_VALUE(encoder.packed, 0);
+    CHECK_VALUE(cpb_encoder_finish(&encoder), 0);
+}
+
+static void test_canonical(void)
+{
+    static const u8_t optional_fields[] = {
+        0x82, 0x01, 0x02, 'a', 'b',
+        0x08, 0x00,
+        0x38, 0x85, 0x00,
+        0x92, 0x01, 0x02, 0x20, 0x01,
+        0x98, 0x01, 0x07,
+        0x92, 0x01, 0x02, 0x20, 0x02,
+        0x68, 0x02
+    };
+    static const u8_t optional_canonical[] = {
+        0x38, 0x05,
+        0x68, 0x01,
+        0x82, 0x01, 0x02, 'a', 'b',
+        0x92, 0x01, 0x02, 0x20, 0x02
+    };
+    static const u8_t optional_reordered[] = {
+        0x68, 0x01,
+        0x92, 0x01, 0x02, 0x20, 0x02,
+        0x38, 0x05,
+        0x82, 0x01, 0x02, 'a', 'b'
+    };
+    static const u8_t packed_fields[] = {
+        0x08, 0x01,
+        0x08, 0x96, 0x01,
+        0x0a, 0x06, 0x03, 0xff, 0xff, 0xff, 0xff, 0x0f
+    };
+    static const u8_t packed_canonical[] = {
+        0x0a, 0x0e, 0x01, 0x96, 0x01, 0x03,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01
+    };
+    static const u8_t unpacked_fields[] = {
+        0x92, 0x01, 0x03, 0x20, 0x81, 0x00,
+        0x0a, 0x02, 0x01, 0x02,
+        0x92, 0x01, 0x00
+    };
+    static const u8_t unpacked_canonical[] = {
+        0x08, 0x01,
+        0x08, 0x02,
+        0x92, 0x01, 0x02, 0x20, 0x01,
+        0x92, 0x01, 0x00
+    };
+    static const u8_t default_fields[] = {
+        0x08, 0xd6, 0xff, 0xff, 0xff, 0x0f,
+        0x3a, 0x07, 'h', 'i', ' ', 'm', 'o', 'm', '\n',
+        0x10, 0x9b, 0x05
+    };
+    static const u8_t default_canonical[] = {
+        0x10, 0x9b, 0x05
+    };
+    static const u8_t truncated[] = {
+        0x82, 0x01, 0x05, 'a', 'b'
+    };
+    u8_t deep[2 * CPB_MAX_DEPTH];
+    u8_t buf[64];
+    size_t len;
+    u64_t hash, other;
+
+    /* Fields are ordered, defaults and unknown fields dropped */
+    CHECK_CPB(cpb_canonical_encode(foo_TestMessOptional, optional_fields,
+                                   sizeof(optional_fields), buf, sizeof(buf),
+                                   &len, &hash));
+    CHECK_BUF(buf, len, optional_canonical);
+    CHECK_VALUE(hash, cpb_canonical_hash(optional_canonical,
+                                         sizeof(optional_canonical)));
+
+    /* Equal messages encode and hash the same */
+    CHECK_CPB(cpb_canonical_encode(foo_TestMessOptional, optional_reordered,
+                                   sizeof(optional_reordered), buf, sizeof(buf),
+                                   &len, &other));
+    CHECK_BUF(buf, len, optional_canonical);
+    CHECK_VALUE(other, hash);
+    CHECK_ASSERT(cpb_canonical_hash(optional_canonical,
+                                    sizeof(optional_canonical) - 1) != hash,
+                 "hash does not depend on the message");
+
+    /* Repeated scalars are packed or unpacked as declared */
+    CHECK_CPB(cpb_canonical_encode(foo_TestMessPacked, packed_fields,
+                                   sizeof(packed_fields), buf, sizeof(buf),
+                                   &len, NULL));
+    CHECK_BUF(buf, len, packed_canonical);
+    CHECK_CPB(cpb_canonical_encode(foo_TestMess, unpacked_fields,
+                                   sizeof(unpacked_fields), buf, sizeof(buf),
+                                   &len, NULL));
+    CHECK_BUF(buf, len, unpacked_canonical);
+
+    /* Declared defaults are dropped */
+    CHECK_CPB(cpb_canonical_encode(foo_DefaultOptionalValues, default_fields,
+                                   sizeof(default_fields), buf, sizeof(buf),
+                                   &len, NULL));
+    CHECK_BUF(buf, len, default_canonical);
+
+    CHECK_ASSERT(cpb_canonical_encode(foo_TestMessOptional, optional_fields,
+                                      sizeof(optional_fields), buf,
+                                      sizeof(optional_canonical) - 1,
+                                      &len, NULL) == CPB_ERR_END_OF_BUF,
+                 "end of buffer not detected");
+    CHECK_ASSERT(cpb_canonical_encode(foo_TestMessOptional, truncated,
+                                      sizeof(truncated), buf, sizeof(buf),
+                                      &len, NULL) == CPB_ERR_END_OF_BUF,
+                 "truncated message not detected");
+
+    /* Too deeply nested messages */
+    len = nest_nodes(deep, CPB_MAX_DEPTH - 1);
+    CHECK_CPB(cpb_canonical_encode(&node_desc, deep, len, buf, sizeof(buf),
+                                   &len, NULL));
+    CHECK_VALUE(len, 2 * (CPB_MAX_DEPTH - 1));
+    len = nest_nodes(deep, CPB_MAX_DEPTH);
+    CHECK_ASSERT(cpb_canonical_encode(&node_desc, deep, len, buf, sizeof(buf),
+                                      &len, NULL) == CPB_ERR_DEPTH,
+                 "nesting depth not detected");
+}
+
+static size_t encode_template_mess(u8_t *buf, size_t len, s32_t id, s32_t sub)
+{
+    struct cpb_encoder encoder;
+
+    cpb_encoder_init(&encoder);
+    cpb_encoder_start(&encoder, foo_TestMess, buf, len);
+    CHECK_CPB(cpb_encoder_add_int32(&encoder, foo_TestMess_test_int32, id));
+    CHECK_CPB(cpb_encoder_add_string(&encoder, foo_TestMess_test_string, "fixed"));
+    CHECK_CPB(cpb_encoder_nested_start(&encoder, foo_TestMess_test_message));
+    CHECK_CPB(cpb_encoder_add_int32(&encoder, foo_SubMess_test, sub));
+    CHECK_CPB(cpb_encoder_nested_end(&encoder));
+    CHECK_CPB(cpb_encoder_add_int32(&encoder, foo_TestMess_test_int32, id));
+    return cpb_encoder_finish(&encoder);
+}
+
+static void test_template(void)
+{
+    static const s32_t values[][2] = {
+        { 5, 7 }, { -1, 300 }, { 127, S32_MIN }, { 1, 2 }
+    };
+    const struct cpb_field_desc *fields[] = {
+        foo_TestMess_test_int32, foo_SubMess_test
+    };
+    struct cpb_template tmpl;
+    union cpb_value slots[3];
+    u8_t template_buf[64];
+    u8_t expected[64];
+    u8_t buf[64];
+    size_t template_len, expected_len, len;
+    int i;
+
+    template_len = encode_template_mess(template_buf, sizeof(template_buf), 1, 2);
+    CHECK_CPB(cpb_template_create(&tmpl, foo_TestMess, template_buf, template_len,
+                                  fields, ARRAY_SIZE(fields)));
+    CHECK_VALUE(tmpl.num_slots, 3);
+    CHECK_VALUE(tmpl.num_lens, 1);
+
+    for (i = 0; i < ARRAY_SIZE(values); i++) {
+        expected_len = encode_template_mess(expected, sizeof(expected),
+                                            values[i][0], values[i][1]);
+        slots[0].int32 = values[i][0];
+        slots[1].int32 = values[i][1];
+        slots[2].int32 = values[i][0];
+        CHECK_VALUE(cpb_template_size(&tmpl, slots), expected_len);
+
+        memset(buf, 0, sizeof(buf));
+        CHECK_CPB(cpb_template_stamp(&tmpl, slots, buf, sizeof(buf), &len));
+        check_buf(buf, len, expected, expected_len, "expected", __FILE__, __LINE__);
+
+        CHECK_ASSERT(cpb_template_stamp(&tmpl, slots, buf, expected_len - 1, NULL) ==
+                     CPB_ERR_END_OF_BUF, "end of buffer not detected");
+    }
+
+    /* Only nested messages holding placeholders are recorded */
+    CHECK_CPB(cpb_template_create(&tmpl, foo_TestMess, test_repeated_submess_1,
+                                  sizeof(test_repeated_submess_1), fields, 1));
+    CHECK_VALUE(tmpl.num_slots, 0);
+    CHECK_VALUE(tmpl.num_lens, 0);
+    CHECK_CPB(cpb_template_create(&tmpl, foo_TestMess, test_repeated_submess_1,
+                                  sizeof(test_repeated_submess_1), fields + 1, 1));
+    CHECK_VALUE(tmpl.num_slots, 3);
+    CHECK_VALUE(tmpl.num_lens, 3);
+
+    /* Truncated message */
+    CHECK_ASSERT(cpb_template_create(&tmpl, foo_TestMess, test_repeated_submess_1,
+                                     sizeof(test_repeated_submess_1) - 1, fields, 1) ==
+                 CPB_ERR_END_OF_BUF, "truncated message not detected");
+}
+
+static void test_rencoder(void)
+{
+    static const s32_t submess_values[] = { 42, -10000, 667 };
+    struct cpb_rencoder encoder;
+    u8_t buf[512];
+    size_t len;
+    int i;
+
+    cpb_rencoder_init(&encoder);
+
+    /* Repeated strings, added in reverse */
+    cpb_rencoder_start(&encoder, foo_TestMess, buf, sizeof(buf));
+    for (i = ARRAY_SIZE(repeated_strings_2) - 1; i >= 0; i--)
+        CHECK_CPB(cpb_rencoder_add_string(&encoder, foo_TestMess_test_string,
+                                          (char *) repeated_strings_2[i]));
+    len = cpb_rencoder_finish(&encoder);
+    CHECK_BUF(cpb_rencoder_data(&encoder), len, test_repeated_strings_2);
+
+    /* Repeated submessages */
+    cpb_rencoder_start(&encoder, foo_TestMess, buf, sizeof(buf));
+    for (i = ARRAY_SIZE(submess_values) - 1; i >= 0; i--) {
+        CHECK_CPB(cpb_rencoder_nested_start(&encoder, foo_TestMess_test_message));
+        CHECK_CPB(cpb_rencoder_add_int32(&encoder, foo_SubMess_test, submess_values[i]));
+        CHECK_CPB(cpb_rencoder_nested_end(&encoder));
+    }
+    len = cpb_rencoder_finish(&encoder);
+    CHECK_BUF(cpb_rencoder_data(&encoder), len, test_repeated_submess_1);
+
+    /* Packed repeated field */
+    cpb_rencoder_start(&encoder, foo_TestMessPacked, buf, sizeof(buf));
+    CHECK_CPB(cpb_rencoder_packed_repeated_start(&encoder, foo_TestMessPacked_test_int32));
+    for (i = ARRAY_SIZE(int32_arr_min_max) - 1; i >= 0; i--)
+        CHECK_CPB(cpb_rencoder_add_int32(&encoder, foo_TestMessPacked_test_int32,
+                                         int32_arr_min_max[i]));
+    CHECK_CPB(cpb_rencoder_packed_repeated_end(&encoder));
+    len = cpb_rencoder_finish(&encoder);
+    CHECK_BUF(cpb_rencoder_data(&encoder), len, test_packed_repeated_int32_arr_min_max);
+
+#if CPB_CHECK_FIELDS
+    /* Unknown field */
+    cpb_rencoder_start(&encoder, foo_TestMessPacked, buf, sizeof(buf));
+    CHECK_ASSERT(cpb_rencoder_add_int32(&encoder, foo_TestMess_test_int32, 1) ==
+                 CPB_ERR_UNKNOWN_FIELD, "unknown field not detected");
+#endif
+
+    /* Buffer too small */
+    cpb_rencoder_start(&encoder, foo_TestMess, buf, 10);
+    CHECK_ASSERT(cpb_rencoder_add_string(&encoder, foo_TestMess_test_string,
+                                         "hello world") == CPB_ERR_END_OF_BUF,
+                 "end of buffer not detected");
+}
+
+
 
 #if 0
 
@@ -1498,6 +2954,28 @@ static struct test_entry tests[] = {
     { "packed repeated small enum", test_packed_repeated_enum_small },
     { "packed repeated big enum", test_packed_repeated_enum_big },
 
+    { "unknown fields", test_unknown_fields },
+    { "decode iov", test_decode_iov },
+    { "rencoder", test_rencoder },
+    { "rencoder chain", test_rencoder_chain },
+    { "rencoder ref", test_rencoder_ref },
+    { "varint", test_varint },
+    { "field tags", test_field_tags },
+    { "encode unknown field", test_encode_unknown_field },
+    { "encoder sink", test_encoder_sink },
+    { "sizer", test_sizer },
+    { "merge", test_merge },
+    { "encoder raw", test_encoder_raw },
+    { "encoder checkpoint", test_encoder_checkpoint },
+    { "encoder iterator", test_encoder_iter },
+    { "template", test_template },
+    { "batch", test_batch },
+    { "struct presence", test_struct_presence },
+    { "struct diff", test_struct_diff },
+    { "struct cache", test_struct_cache },
+    { "canonical", test_canonical },
+    { "struct decoder", test_struct_decoder },
+
     { "required default values", test_required_default_values },
     { "optional default values", test_optional_default_values },
     
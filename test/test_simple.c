@@ -19,11 +19,46 @@
 
 #include "generated/test_simple_pb2.h"
 
+/*
+ * Encodes a lookup result with a person, optionally with a long name and the
+ * first and second phone number.
+ */
+static size_t encode_lookup_result(char *buf, size_t size,
+                                   int name, int phone1, int phone2)
+{
+    static char long_name[111];
+    struct cpb_encoder encoder;
+    
+    memset(long_name, 'x', sizeof(long_name) - 1);
+    
+    cpb_encoder_init(&encoder);
+    cpb_encoder_start(&encoder, test_LookupResult, buf, size);
+    cpb_encoder_nested_start(&encoder, test_LookupResult_person);
+    if (name)
+        cpb_encoder_add_string(&encoder, test_Person_name, long_name);
+    if (phone1) {
+        cpb_encoder_nested_start(&encoder, test_Person_phone);
+        cpb_encoder_add_string(&encoder, test_PhoneNumber_number, "phone 1");
+        cpb_encoder_nested_end(&encoder);
+    }
+    if (phone2) {
+        cpb_encoder_nested_start(&encoder, test_Person_phone);
+        cpb_encoder_add_string(&encoder, test_PhoneNumber_number, "phone 2");
+        cpb_encoder_nested_end(&encoder);
+    }
+    cpb_encoder_nested_end(&encoder);
+    
+    return cpb_encoder_finish(&encoder);
+}
+
 int main()
 {
     char buf[4096];
-    size_t len;
+    char expected[4096];
+    char phone[64];
+    size_t len, expected_len, phone_len;
     cpb_err_t ret;
+    const struct cpb_field_desc *path[] = { test_LookupResult_person, test_Person_phone };
     
     struct cpb_decoder decoder;
     struct cpb_encoder encoder;
@@ -55,5 +90,34 @@ int main()
     
     printf("ret = %d\n", ret);
     
+    /* Splice a phone number into the person of a lookup result */
+    len = encode_lookup_result(buf, sizeof(buf), 1, 1, 0);
+    expected_len = encode_lookup_result(expected, sizeof(expected), 1, 1, 1);
+    cpb_encoder_start(&encoder, test_PhoneNumber, phone, sizeof(phone));
+    cpb_encoder_add_string(&encoder, test_PhoneNumber_number, "phone 2");
+    phone_len = cpb_encoder_finish(&encoder);
+    
+    ret = cpb_merge_splice(test_LookupResult, buf, len, path, 2, phone, phone_len,
+                           buf, sizeof(buf), &len);
+    
+    printf("splice ret = %d, length = %d\n", ret, (int)len);
+    
+    if (ret != CPB_ERR_OK || len != expected_len || memcmp(buf, expected, len) != 0) {
+        printf("spliced message differs\n");
+        return 1;
+    }
+    
+    /* Splice into an empty lookup result */
+    expected_len = encode_lookup_result(expected, sizeof(expected), 0, 0, 1);
+    ret = cpb_merge_splice(test_LookupResult, buf, 0, path, 2, phone, phone_len,
+                           buf, sizeof(buf), &len);
+    
+    printf("splice into empty message ret = %d, length = %d\n", ret, (int)len);
+    
+    if (ret != CPB_ERR_OK || len != expected_len || memcmp(buf, expected, len) != 0) {
+        printf("spliced message differs\n");
+        return 1;
+    }
+    
     return 0;
 }
@@ -76,10 +76,15 @@ void print_buf(u8_t *buf, size_t len)
     printf(" }");
 }
 
+static struct test_struct batch_structs[100];
+static struct cpb_iovec batch_spans[100];
+static u8_t batch_buf[32768];
+
 int main()
 {
     char buf[4096];
-    size_t len;
+    char buf2[4096];
+    size_t len, len2;
     cpb_err_t ret;
     u8_t bytes[] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07 };
     struct test_struct test_struct_instance;
@@ -87,6 +92,7 @@ int main()
     
     struct cpb_encoder encoder;
     struct cpb_struct_decoder sdecoder;
+    struct cpb_struct_cache cache;
 
     cpb_encoder_init(&encoder);
     cpb_encoder_start(&encoder, test_StructTest, buf, sizeof(buf));
@@ -134,5 +140,141 @@ int main()
     for (i = 0; i < 8; i++)
         printf("test_struct.nested2[%d].field_string = '%s'\n", i, test_struct_instance.nested2[i].field_string);
     
+    ret = cpb_struct_encode(&test_struct_map, &test_struct_instance, buf2, sizeof(buf2), &len2);
+    
+    printf("struct encode ret = %d, length = %d, size = %d\n", ret, len2, cpb_encoded_size(&test_struct_map, &test_struct_instance));
+    
+    if (ret != CPB_ERR_OK || len2 != len || memcmp(buf, buf2, len) != 0) {
+        printf("struct encoded message differs\n");
+        return 1;
+    }
+    
+    ret = cpb_struct_encode(&test_struct_map, &test_struct_instance, buf2, len - 1, NULL);
+    
+    printf("struct encode into short buffer ret = %d\n", ret);
+    
+    if (ret != CPB_ERR_END_OF_BUF)
+        return 1;
+    
+    ret = cpb_struct_encode_parallel(&test_struct_map, &test_struct_instance, buf2, sizeof(buf2), &len2, 3, NULL);
+    
+    printf("parallel struct encode ret = %d, length = %d\n", ret, len2);
+    
+    if (ret != CPB_ERR_OK || len2 != len || memcmp(buf, buf2, len) != 0) {
+        printf("parallel struct encoded message differs\n");
+        return 1;
+    }
+    
+    ret = cpb_struct_encode_parallel(&test_struct_map, &test_struct_instance, buf2, len - 1, NULL, 3, NULL);
+    
+    printf("parallel struct encode into short buffer ret = %d\n", ret);
+    
+    if (ret != CPB_ERR_END_OF_BUF)
+        return 1;
+    
+    for (i = 0; i < 100; i++) {
+        batch_structs[i] = test_struct_instance;
+        batch_structs[i].field_int32 = i * 1000;
+    }
+    
+    ret = cpb_struct_encode_batch(&test_struct_map, batch_structs, 100, 1, batch_buf, sizeof(batch_buf), batch_spans, &len2, 4);
+    
+    printf("struct batch encode ret = %d, length = %d\n", ret, len2);
+    
+    if (ret != CPB_ERR_OK)
+        return 1;
+    
+    len = 0;
+    for (i = 0; i < 100; i++) {
+        cpb_struct_encode(&test_struct_map, &batch_structs[i], buf2, sizeof(buf2), &len);
+        if (batch_spans[i].len != len || memcmp(batch_spans[i].base, buf2, len) != 0 ||
+            ((u8_t *) batch_spans[i].base)[-2] != (u8_t) (len | 0x80) ||
+            ((u8_t *) batch_spans[i].base)[-1] != (u8_t) (len >> 7)) {
+            printf("struct batch record %d differs\n", i);
+            return 1;
+        }
+    }
+    
+    if ((u8_t *) batch_spans[99].base + batch_spans[99].len != batch_buf + len2)
+        return 1;
+    
+    ret = cpb_struct_encode_batch(&test_struct_map, batch_structs, 100, 0, batch_buf, len2 - 201, batch_spans, NULL, 4);
+    
+    printf("struct batch encode into short buffer ret = %d\n", ret);
+    
+    if (ret != CPB_ERR_END_OF_BUF)
+        return 1;
+    
+    cpb_struct_cache_init(&cache, &test_struct_map, buf, sizeof(buf));
+    ret = cpb_struct_cache_encode(&cache, &test_struct_instance, &len);
+    cpb_struct_encode(&test_struct_map, &test_struct_instance, buf2, sizeof(buf2), &len2);
+    
+    printf("struct cache encode ret = %d, length = %d\n", ret, len);
+    
+    if (ret != CPB_ERR_OK || len2 != len || memcmp(buf, buf2, len) != 0)
+        return 1;
+    
+    /* Same size, re-encoded in place */
+    strcpy(test_struct_instance.nested2[3].field_string, "test string X");
+    cpb_struct_cache_mark_dirty(&cache, test_StructTest_nested2);
+    /* Grows and shrinks, clean fields move */
+    test_struct_instance.field_int32 = -1;
+    cpb_struct_cache_mark_dirty(&cache, test_StructTest_field_int32);
+    strcpy(test_struct_instance.field_string, "short");
+    cpb_struct_cache_mark_dirty(&cache, test_StructTest_field_string);
+    
+    ret = cpb_struct_cache_encode(&cache, &test_struct_instance, &len);
+    cpb_struct_encode(&test_struct_map, &test_struct_instance, buf2, sizeof(buf2), &len2);
+    
+    printf("struct cache re-encode ret = %d, length = %d\n", ret, len);
+    
+    if (ret != CPB_ERR_OK || len2 != len || memcmp(buf, buf2, len) != 0) {
+        printf("struct cache encoded message differs\n");
+        return 1;
+    }
+    
+    ret = cpb_struct_diff_encode(&test_struct_map, &test_struct_instance, &test_struct_instance, buf2, sizeof(buf2), &len2);
+    
+    printf("struct diff of equal structs ret = %d, length = %d\n", ret, len2);
+    
+    if (ret != CPB_ERR_OK || len2 != 0)
+        return 1;
+    
+    batch_structs[0] = test_struct_instance;
+    batch_structs[1] = test_struct_instance;
+    batch_structs[1].field_int64 = 42;
+    batch_structs[1].nested1.field_int32 = 7;
+    strcpy(batch_structs[1].nested2[5].field_string, "changed");
+    
+    ret = cpb_struct_diff_encode(&test_struct_map, &batch_structs[0], &batch_structs[1], buf2, sizeof(buf2), &len2);
+    
+    printf("struct diff ret = %d, length = %d\n", ret, len2);
+    
+    /* 2 bytes for field_int64, 4 for nested1 and 8 nested2 elements */
+    if (ret != CPB_ERR_OK || len2 != 2 + 4 + 7 * 17 + 11)
+        return 1;
+    
+    ret = cpb_struct_apply_delta(&test_struct_map, &batch_structs[0], buf2, len2);
+    cpb_struct_encode(&test_struct_map, &batch_structs[0], buf, sizeof(buf), &len);
+    cpb_struct_encode(&test_struct_map, &batch_structs[1], buf2, sizeof(buf2), &len2);
+    
+    printf("struct apply delta ret = %d\n", ret);
+    
+    if (ret != CPB_ERR_OK || len2 != len || memcmp(buf, buf2, len) != 0) {
+        printf("struct with applied delta differs\n");
+        return 1;
+    }
+    
+    /* Bytes behind the end of a nested string are not compared */
+    batch_structs[1] = batch_structs[0];
+    batch_structs[1].nested2[2].field_string[31] = 'x';
+    
+    ret = cpb_struct_diff_encode(&test_struct_map, &batch_structs[0], &batch_structs[1], buf2, sizeof(buf2), &len2);
+    
+    printf("struct diff of nested string tails ret = %d, length = %d\n", ret, len2);
+    
+    if (ret != CPB_ERR_OK || len2 != 0)
+        return 1;
+    
     return 0;
 }